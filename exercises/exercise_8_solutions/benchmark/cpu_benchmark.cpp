@@ -0,0 +1,690 @@
+// Microbenchmarks of the CPU side hot paths: loading OBJ files, converting assimp meshes to the Vertex
+// layout (Model::ConvertMesh(), the part of processMesh() that does not need GL), building the leaves
+// like GenerateOffsets() does, the frustum and light culling kernels and decoding textures with stb_image.
+// Every size of every benchmark is warmed up, then timed over a number of samples of many calls each, so
+// the timer resolution does not matter. The median and its spread (median absolute deviation) are kept
+// rather than the mean, a few samples disturbed by the rest of the system should not move the result.
+// The results are written as JSON, and compared against a stored run with --baseline: a benchmark counts
+// as slower or faster only if the medians differ by more than the threshold and by more than the noise.
+//
+// usage: cpu_benchmark [options]
+//   --filter <text>      only the benchmarks whose name contains the text
+//   --max-size <n>       skip the sizes above n (1000000 by default)
+//   --repetitions <n>    samples per benchmark (20 by default)
+//   --min-time <ms>      shortest sample, more calls are made per sample until it is reached (20 by default)
+//   --max-time <s>       time budget of one benchmark, fewer samples are taken past it (10 by default, 5 samples at least)
+//   --output <file>      the results (cpu_benchmark.json by default)
+//   --baseline <file>    the results of an earlier run to compare with, returns 1 if anything got slower
+//   --threshold <pct>    smallest change that counts, in percent (5 by default)
+//
+// loadOBJ() logs every file it loads on stdout, so the report goes to stderr.
+// The textures the exercise copies next to the executable are decoded too when the benchmark runs from there.
+
+#include "model.h"
+#include "objloader.h"
+#include "ecs.h"
+#include "components.h"
+#include "scene_graph.h"
+#include "light_culling.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+typedef std::chrono::high_resolution_clock Clock;
+
+// keeps the compiler from removing the computation of a value nobody reads: the value has to exist in
+// memory, because the empty asm statement could read it through its address
+template <typename T>
+inline void doNotOptimize(const T &value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "g"(&value) : "memory");
+#else
+    static const void* volatile sink;
+    sink = &value;
+#endif
+}
+
+struct Options
+{
+    std::string filter;
+    long long maxSize = 1000000;
+    int repetitions = 20;
+    double minSampleSeconds = 0.02;
+    double maxSeconds = 10.0;
+    double warmupSeconds = 0.1;
+    std::string output = "cpu_benchmark.json";
+    std::string baseline;
+    double threshold = 5.0;
+};
+
+struct Result
+{
+    std::string name;
+    long long size = 0;
+    std::string unit; // what size counts
+    long long iterations = 0; // calls per sample
+    std::vector<double> samples; // nanoseconds per call
+    double median = 0.0, mad = 0.0, mean = 0.0, stddev = 0.0, min = 0.0, max = 0.0;
+};
+
+double secondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void computeStatistics(Result &result)
+{
+    std::vector<double> sorted = result.samples;
+    std::sort(sorted.begin(), sorted.end());
+    size_t n = sorted.size();
+    result.median = n % 2 ? sorted[n / 2] : 0.5 * (sorted[n / 2 - 1] + sorted[n / 2]);
+    result.min = sorted.front();
+    result.max = sorted.back();
+
+    double sum = 0.0;
+    for (double sample : sorted)
+        sum += sample;
+    result.mean = sum / n;
+    double squares = 0.0;
+    for (double sample : sorted)
+        squares += (sample - result.mean) * (sample - result.mean);
+    result.stddev = n > 1 ? std::sqrt(squares / (n - 1)) : 0.0;
+
+    std::vector<double> deviations(n);
+    for (size_t i = 0; i < n; i++)
+        deviations[i] = std::fabs(sorted[i] - result.median);
+    std::sort(deviations.begin(), deviations.end());
+    result.mad = n % 2 ? deviations[n / 2] : 0.5 * (deviations[n / 2 - 1] + deviations[n / 2]);
+}
+
+class Runner
+{
+public:
+    std::vector<Result> results;
+
+    explicit Runner(const Options &options) : options(options) {}
+
+    bool Enabled(const std::string &name, long long size) const
+    {
+        return size <= options.maxSize && (options.filter.empty() || name.find(options.filter) != std::string::npos);
+    }
+
+    // times function(), which does one call of the code under test. Whatever the call produces has to go
+    // through doNotOptimize(), or the compiler may drop it
+    void Run(const std::string &name, long long size, const char* unit, const std::function<void()> &function)
+    {
+        if (!Enabled(name, size))
+            return;
+
+        // warmup: caches, branch predictors, the allocator and the CPU clock settle down. It also tells
+        // about how long one call takes
+        long long calls = 0;
+        Clock::time_point start = Clock::now();
+        do
+        {
+            function();
+            calls++;
+        } while (secondsSince(start) < options.warmupSeconds);
+        double estimate = secondsSince(start) / calls;
+
+        Result result;
+        result.name = name;
+        result.size = size;
+        result.unit = unit;
+        result.iterations = std::max(1LL, (long long)std::ceil(options.minSampleSeconds / estimate));
+        double sampleSeconds = estimate * result.iterations;
+        int repetitions = std::max(std::min(options.repetitions, (int)(options.maxSeconds / sampleSeconds)), 5);
+
+        for (int sample = 0; sample < repetitions; sample++)
+        {
+            start = Clock::now();
+            for (long long i = 0; i < result.iterations; i++)
+                function();
+            result.samples.push_back(secondsSince(start) * 1e9 / result.iterations);
+        }
+        computeStatistics(result);
+        std::fprintf(stderr, "%-36s %9lld %-10s %14.0f %10.1f%% %12.2f\n", name.c_str(), size, unit, result.median,
+                     100.0 * result.mad / result.median, result.median / size);
+        results.push_back(result);
+    }
+
+private:
+    Options options;
+};
+
+// benchmarks
+
+// a flat grid of quads with positions, texture coordinates and normals, written out as triangles
+void writeGridObj(const std::string &path, int quadsPerSide)
+{
+    FILE* file = std::fopen(path.c_str(), "w");
+    if (!file)
+        return;
+    int side = quadsPerSide + 1;
+    std::mt19937 random(quadsPerSide);
+    std::uniform_real_distribution<float> height(-0.05f, 0.05f);
+    for (int y = 0; y < side; y++)
+        for (int x = 0; x < side; x++)
+            std::fprintf(file, "v %f %f %f\n", (float)x / quadsPerSide, height(random), (float)y / quadsPerSide);
+    for (int y = 0; y < side; y++)
+        for (int x = 0; x < side; x++)
+            std::fprintf(file, "vt %f %f\n", (float)x / quadsPerSide, (float)y / quadsPerSide);
+    for (int i = 0; i < side * side; i++)
+        std::fprintf(file, "vn 0.000000 1.000000 0.000000\n");
+    for (int y = 0; y < quadsPerSide; y++)
+    {
+        for (int x = 0; x < quadsPerSide; x++)
+        {
+            // obj indices start at 1
+            int a = y * side + x + 1, b = a + 1, c = a + side + 1, d = a + side;
+            std::fprintf(file, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, b, b, b, c, c, c);
+            std::fprintf(file, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, c, c, c, d, d, d);
+        }
+    }
+    std::fclose(file);
+}
+
+void benchmarkLoadObj(Runner &runner)
+{
+    for (long long triangles = 1000; triangles <= 1000000; triangles *= 10)
+    {
+        if (!runner.Enabled("loadOBJ", triangles))
+            continue;
+        int quadsPerSide = (int)std::sqrt(triangles / 2.0);
+        std::string path = "cpu_benchmark_" + std::to_string(triangles) + ".obj";
+        writeGridObj(path, quadsPerSide);
+        runner.Run("loadOBJ", triangles, "triangles", [&path]() {
+            std::vector<glm::vec3> vertices, normals;
+            std::vector<glm::vec2> uvs;
+            loadOBJ(path.c_str(), vertices, uvs, normals);
+            doNotOptimize(vertices.data());
+            doNotOptimize(uvs.data());
+            doNotOptimize(normals.data());
+        });
+        std::remove(path.c_str());
+    }
+}
+
+// a grid mesh as assimp hands it to processMesh(), triangulated and with tangents
+std::unique_ptr<aiMesh> makeGridMesh(int verticesPerSide)
+{
+    std::unique_ptr<aiMesh> mesh(new aiMesh());
+    int count = verticesPerSide * verticesPerSide;
+    mesh->mNumVertices = count;
+    mesh->mVertices = new aiVector3D[count];
+    mesh->mNormals = new aiVector3D[count];
+    mesh->mTangents = new aiVector3D[count];
+    mesh->mBitangents = new aiVector3D[count];
+    mesh->mTextureCoords[0] = new aiVector3D[count];
+    for (int i = 0; i < count; i++)
+    {
+        float u = (float)(i % verticesPerSide) / (verticesPerSide - 1), v = (float)(i / verticesPerSide) / (verticesPerSide - 1);
+        mesh->mVertices[i].x = u;
+        mesh->mVertices[i].y = 0.0f;
+        mesh->mVertices[i].z = v;
+        mesh->mNormals[i].x = 0.0f;
+        mesh->mNormals[i].y = 1.0f;
+        mesh->mNormals[i].z = 0.0f;
+        mesh->mTangents[i].x = 1.0f;
+        mesh->mTangents[i].y = 0.0f;
+        mesh->mTangents[i].z = 0.0f;
+        mesh->mBitangents[i].x = 0.0f;
+        mesh->mBitangents[i].y = 0.0f;
+        mesh->mBitangents[i].z = 1.0f;
+        mesh->mTextureCoords[0][i].x = u;
+        mesh->mTextureCoords[0][i].y = v;
+        mesh->mTextureCoords[0][i].z = 0.0f;
+    }
+
+    int quads = (verticesPerSide - 1) * (verticesPerSide - 1);
+    mesh->mNumFaces = quads * 2;
+    mesh->mFaces = new aiFace[quads * 2];
+    for (int q = 0; q < quads; q++)
+    {
+        unsigned int a = (unsigned int)(q / (verticesPerSide - 1) * verticesPerSide + q % (verticesPerSide - 1));
+        unsigned int b = a + 1, c = a + verticesPerSide + 1, d = a + verticesPerSide;
+        unsigned int corners[2][3] = { { a, b, c }, { a, c, d } };
+        for (int t = 0; t < 2; t++)
+        {
+            aiFace &face = mesh->mFaces[q * 2 + t];
+            face.mNumIndices = 3;
+            face.mIndices = new unsigned int[3];
+            std::memcpy(face.mIndices, corners[t], sizeof(corners[t]));
+        }
+    }
+    return mesh;
+}
+
+void benchmarkConvertMesh(Runner &runner)
+{
+    for (long long vertices = 1000; vertices <= 1000000; vertices *= 10)
+    {
+        if (!runner.Enabled("Model::ConvertMesh", vertices))
+            continue;
+        int side = (int)std::sqrt((double)vertices);
+        std::unique_ptr<aiMesh> mesh = makeGridMesh(side);
+        runner.Run("Model::ConvertMesh", vertices, "vertices", [&mesh]() {
+            std::vector<Vertex> converted;
+            std::vector<unsigned int> indices;
+            Model::ConvertMesh(mesh.get(), converted, indices);
+            doNotOptimize(converted.data());
+            doNotOptimize(indices.data());
+        });
+    }
+}
+
+// the placement of GenerateOffsets(): a wall of randomly rotated and scaled leaves
+glm::mat4 leafPlacement(int i)
+{
+    const float rLow = 0.6f;
+    const float rHigh = 1.6f;
+    glm::mat4 baseMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(i % 10, (int)i / 10, 0.0));
+    float rx = static_cast<float>(rand() / static_cast<float>(RAND_MAX / 6.28f));
+    float ry = static_cast<float>(rand() / static_cast<float>(RAND_MAX / 6.28f));
+    float rz = static_cast<float>(rand() / static_cast<float>(RAND_MAX / 6.28f));
+    baseMatrix = glm::rotate(baseMatrix, rz, glm::vec3(0.0f, 0.0f, 1.0f));
+    baseMatrix = glm::rotate(baseMatrix, ry, glm::vec3(0.0f, 1.0f, 0.0f));
+    baseMatrix = glm::rotate(baseMatrix, rx, glm::vec3(1.0f, 0.0f, 0.0f));
+    float r = rLow + static_cast<float>(rand() / static_cast<float>(RAND_MAX / (rHigh - rLow)));
+    return glm::scale(baseMatrix, glm::vec3(r, r, 1.0));
+}
+
+void benchmarkGenerateOffsets(Runner &runner)
+{
+    for (long long leaves = 1000; leaves <= 1000000; leaves *= 10)
+    {
+        if (!runner.Enabled("GenerateOffsets/placement", leaves) && !runner.Enabled("GenerateOffsets/scene", leaves))
+            continue;
+        int count = (int)leaves;
+        std::vector<glm::mat4> models(count);
+        runner.Run("GenerateOffsets/placement", leaves, "leaves", [&models, count]() {
+            std::srand(1);
+            for (int i = 0; i < count; i++)
+                models[i] = leafPlacement(i);
+            doNotOptimize(models.data());
+        });
+
+        // everything GenerateOffsets() does the first time: the placement, one scene node and one entity per leaf
+        runner.Run("GenerateOffsets/scene", leaves, "leaves", [&models, count]() {
+            std::srand(1);
+            SceneGraph graph;
+            EntityStore store;
+            int root = graph.AddNode(SceneGraph::NO_PARENT, glm::mat4(1.0f));
+            MaterialComponent material = {};
+            for (int i = 0; i < count; i++)
+            {
+                models[i] = leafPlacement(i);
+                int node = graph.AddNode(root, models[i]);
+                BoundsComponent bounds = { glm::vec3(0.0f), std::sqrt(2.0f), glm::vec3(0.0f), 0.0f };
+                UpdateWorldBounds(bounds, models[i]);
+                store.Create(TransformComponent{ node, models[i] }, bounds, material, InstanceComponent{ i });
+            }
+            doNotOptimize(graph);
+            doNotOptimize(store);
+        });
+    }
+}
+
+// leaves spread over a 400 x 400 area around the camera, like the entities of the scene
+void fillScene(EntityStore &store, int count)
+{
+    std::mt19937 random(count);
+    std::uniform_real_distribution<float> position(-200.0f, 200.0f);
+    MaterialComponent material = {};
+    for (int i = 0; i < count; i++)
+    {
+        glm::mat4 world = glm::translate(glm::mat4(1.0f), glm::vec3(position(random), position(random) * 0.05f, position(random)));
+        BoundsComponent bounds = { glm::vec3(0.0f), std::sqrt(2.0f), glm::vec3(0.0f), 0.0f };
+        UpdateWorldBounds(bounds, world);
+        store.Create(TransformComponent{ i, world }, bounds, material, InstanceComponent{ i });
+    }
+}
+
+void benchmarkCulling(Runner &runner)
+{
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 10.0f, 0.0f), glm::vec3(1.0f, 10.0f, 1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 100.0f);
+    glm::vec4 planes[6];
+    FrustumPlanes(projection * view, planes);
+
+    for (long long entities = 1000; entities <= 1000000; entities *= 10)
+    {
+        if (!runner.Enabled("frustumCull", entities) && !runner.Enabled("lightCull", entities))
+            continue;
+        EntityStore store;
+        fillScene(store, (int)entities);
+
+        // bounding spheres against the view frustum, the visible entities are gathered
+        std::vector<Entity> visible;
+        std::vector<EntityStore::Chunk> chunks;
+        runner.Run("frustumCull", entities, "entities", [&store, &planes, &visible, &chunks]() {
+            visible.clear();
+            store.CollectChunks<BoundsComponent>(chunks);
+            for (const EntityStore::Chunk &chunk : chunks)
+            {
+                const BoundsComponent* bounds = EntityStore::Column<BoundsComponent>(chunk);
+                for (int i = 0; i < chunk.count; i++)
+                    if (SphereInFrustum(planes, bounds[i].center, bounds[i].radius))
+                        visible.push_back(chunk.entities[i]);
+            }
+            doNotOptimize(visible.data());
+        });
+
+        // cullLight(): the screen rectangle of the light sphere, then the leaves the sphere reaches
+        const int viewport[4] = { 0, 0, 1920, 1080 };
+        glm::vec3 lightPosition(20.0f, 5.0f, 20.0f);
+        float lightRadius = 15.0f;
+        std::vector<glm::mat4> lit;
+        runner.Run("lightCull", entities, "entities", [&]() {
+            lit.clear();
+            LightScreenBounds bounds = ComputeLightScreenBounds(lightPosition, lightRadius, view, projection, 0.1f, 100.0f, viewport[2], viewport[3]);
+            doNotOptimize(bounds);
+            store.ForEach<TransformComponent, BoundsComponent>([&](int count, TransformComponent* transforms, BoundsComponent* spheres) {
+                for (int i = 0; i < count; i++)
+                {
+                    glm::vec3 offset = spheres[i].center - lightPosition;
+                    float reach = lightRadius + spheres[i].radius;
+                    if (glm::dot(offset, offset) <= reach * reach)
+                        lit.push_back(transforms[i].world);
+                }
+            });
+            doNotOptimize(lit.data());
+        });
+    }
+}
+
+// a 24 bit TGA, uncompressed or run length encoded, of 8 pixel wide stripes with some noise
+std::vector<unsigned char> makeTga(int size, bool runLength)
+{
+    std::vector<unsigned char> file(18, 0);
+    file[2] = runLength ? 10 : 2;
+    file[12] = (unsigned char)(size & 255);
+    file[13] = (unsigned char)(size >> 8);
+    file[14] = (unsigned char)(size & 255);
+    file[15] = (unsigned char)(size >> 8);
+    file[16] = 24;
+
+    std::mt19937 random(size);
+    std::vector<unsigned char> pixels(size * size * 3);
+    for (int i = 0; i < size * size; i++)
+    {
+        if (i % 8 == 0)
+        {
+            unsigned int color = random();
+            pixels[i * 3] = (unsigned char)color;
+            pixels[i * 3 + 1] = (unsigned char)(color >> 8);
+            pixels[i * 3 + 2] = (unsigned char)(color >> 16);
+        }
+        else
+        {
+            std::memcpy(&pixels[i * 3], &pixels[(i - 1) * 3], 3);
+        }
+    }
+    if (!runLength)
+    {
+        file.insert(file.end(), pixels.begin(), pixels.end());
+        return file;
+    }
+    // a stripe becomes one run packet, packets do not cross rows
+    for (int row = 0; row < size; row++)
+    {
+        for (int x = 0; x < size;)
+        {
+            int run = 1;
+            const unsigned char* pixel = &pixels[(row * size + x) * 3];
+            while (x + run < size && run < 128 && std::memcmp(pixel, pixel + run * 3, 3) == 0)
+                run++;
+            file.push_back((unsigned char)(0x80 | (run - 1)));
+            file.insert(file.end(), pixel, pixel + 3);
+            x += run;
+        }
+    }
+    return file;
+}
+
+bool readFile(const std::string &path, std::vector<unsigned char> &data)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return !data.empty();
+}
+
+void benchmarkDecode(Runner &runner, const std::string &name, const std::vector<unsigned char> &data)
+{
+    int width = 0, height = 0, channels = 0;
+    if (!stbi_info_from_memory(data.data(), (int)data.size(), &width, &height, &channels))
+    {
+        std::fprintf(stderr, "%s: %s\n", name.c_str(), stbi_failure_reason());
+        return;
+    }
+    // the same call as TextureFromFile(), with the file already in memory
+    runner.Run(name, (long long)width * height, "pixels", [&data]() {
+        int w, h, n;
+        unsigned char* pixels = stbi_load_from_memory(data.data(), (int)data.size(), &w, &h, &n, 0);
+        doNotOptimize(pixels);
+        stbi_image_free(pixels);
+    });
+}
+
+void benchmarkTextures(Runner &runner)
+{
+    for (int size = 256; size <= 2048; size *= 2)
+    {
+        if (runner.Enabled("textureDecode/tga", (long long)size * size))
+            benchmarkDecode(runner, "textureDecode/tga", makeTga(size, false));
+        if (runner.Enabled("textureDecode/tga-rle", (long long)size * size))
+            benchmarkDecode(runner, "textureDecode/tga-rle", makeTga(size, true));
+    }
+
+    const char* files[] = { "leafTexture.jpg", "leaf05_basecolor.png", "leaf05_normal.png", "leaf05_roughness.png", "leaf05_opacity.png" };
+    for (const char* file : files)
+    {
+        std::vector<unsigned char> data;
+        std::string name = std::string("textureDecode/") + file;
+        if (runner.Enabled(name, 0) && readFile(file, data))
+            benchmarkDecode(runner, name, data);
+    }
+}
+
+// baseline
+
+std::string jsonString(const std::string &text)
+{
+    std::string quoted = "\"";
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+            quoted += '\\';
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+bool writeJson(const std::string &path, const Options &options, const std::vector<Result> &results)
+{
+    std::ofstream file(path);
+    if (!file)
+        return false;
+    file.precision(10);
+    file << "{\n";
+    file << "  \"benchmark\": \"cpu_benchmark\",\n";
+#ifdef __VERSION__
+    file << "  \"compiler\": " << jsonString(__VERSION__) << ",\n";
+#endif
+#ifdef NDEBUG
+    file << "  \"optimized\": true,\n";
+#else
+    file << "  \"optimized\": false,\n";
+#endif
+    file << "  \"repetitions\": " << options.repetitions << ",\n";
+    file << "  \"min_sample_ms\": " << options.minSampleSeconds * 1e3 << ",\n";
+    file << "  \"results\": [\n";
+    // one result per line, readBaseline() depends on it
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const Result &result = results[i];
+        file << "    {\"name\": " << jsonString(result.name) << ", \"size\": " << result.size
+             << ", \"unit\": " << jsonString(result.unit) << ", \"iterations\": " << result.iterations
+             << ", \"samples\": " << result.samples.size() << ", \"median_ns\": " << result.median
+             << ", \"mad_ns\": " << result.mad << ", \"mean_ns\": " << result.mean << ", \"stddev_ns\": " << result.stddev
+             << ", \"min_ns\": " << result.min << ", \"max_ns\": " << result.max
+             << ", \"ns_per_item\": " << result.median / result.size << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n}\n";
+    return (bool)file;
+}
+
+// the value after "key": in a line of the results, the line must have it
+bool findValue(const std::string &line, const char* key, std::string &value)
+{
+    std::string pattern = std::string("\"") + key + "\": ";
+    size_t start = line.find(pattern);
+    if (start == std::string::npos)
+        return false;
+    start += pattern.size();
+    if (line[start] == '"')
+    {
+        size_t end = line.find('"', start + 1);
+        value = line.substr(start + 1, end - start - 1);
+    }
+    else
+    {
+        size_t end = line.find_first_of(",}", start);
+        value = line.substr(start, end - start);
+    }
+    return true;
+}
+
+// reads the results of writeJson(), not a general JSON parser
+std::vector<Result> readBaseline(const std::string &path)
+{
+    std::vector<Result> results;
+    std::ifstream file(path);
+    std::string line, name, size, median, mad;
+    while (std::getline(file, line))
+    {
+        if (!findValue(line, "name", name) || !findValue(line, "size", size) || !findValue(line, "median_ns", median) || !findValue(line, "mad_ns", mad))
+            continue;
+        Result result;
+        result.name = name;
+        result.size = std::atoll(size.c_str());
+        result.median = std::atof(median.c_str());
+        result.mad = std::atof(mad.c_str());
+        results.push_back(result);
+    }
+    return results;
+}
+
+// prints the change of every benchmark that is in both runs, returns the number that got slower
+int compareWithBaseline(const std::vector<Result> &results, const std::vector<Result> &baseline, double threshold)
+{
+    std::fprintf(stderr, "\n%-36s %9s %14s %14s %9s\n", "compared with baseline", "size", "baseline ns", "median ns", "change");
+    int slower = 0;
+    for (const Result &result : results)
+    {
+        for (const Result &base : baseline)
+        {
+            if (base.name != result.name || base.size != result.size || base.median <= 0.0)
+                continue;
+            double change = 100.0 * (result.median - base.median) / base.median;
+            // 1.4826 * MAD estimates the standard deviation of normally distributed samples, the difference
+            // has to stand out of the noise of both runs
+            double noise = 3.0 * 1.4826 * (result.mad + base.mad);
+            const char* verdict = "";
+            if (std::fabs(change) > threshold && std::fabs(result.median - base.median) > noise)
+                verdict = change > 0.0 ? "slower" : "faster";
+            if (change > 0.0 && verdict[0])
+                slower++;
+            std::fprintf(stderr, "%-36s %9lld %14.0f %14.0f %+8.1f%% %s\n", result.name.c_str(), result.size, base.median,
+                         result.median, change, verdict);
+        }
+    }
+    return slower;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!value)
+        {
+            std::fprintf(stderr, "unknown option or missing value: %s\n", argument.c_str());
+            return 2;
+        }
+        if (argument == "--filter")
+            options.filter = value;
+        else if (argument == "--max-size")
+            options.maxSize = std::atoll(value);
+        else if (argument == "--repetitions")
+            options.repetitions = std::max(std::atoi(value), 5);
+        else if (argument == "--min-time")
+            options.minSampleSeconds = std::atof(value) / 1e3;
+        else if (argument == "--max-time")
+            options.maxSeconds = std::atof(value);
+        else if (argument == "--output")
+            options.output = value;
+        else if (argument == "--baseline")
+            options.baseline = value;
+        else if (argument == "--threshold")
+            options.threshold = std::atof(value);
+        else
+        {
+            std::fprintf(stderr, "unknown option: %s\n", argument.c_str());
+            return 2;
+        }
+        i++;
+    }
+
+#ifndef NDEBUG
+    std::fprintf(stderr, "warning: not an optimized build, the timings are not representative\n");
+#endif
+    std::fprintf(stderr, "%-36s %9s %-10s %14s %11s %12s\n", "benchmark", "size", "unit", "median ns", "spread", "ns per item");
+
+    Runner runner(options);
+    benchmarkLoadObj(runner);
+    benchmarkConvertMesh(runner);
+    benchmarkGenerateOffsets(runner);
+    benchmarkCulling(runner);
+    benchmarkTextures(runner);
+
+    if (!writeJson(options.output, options, runner.results))
+        std::fprintf(stderr, "could not write %s\n", options.output.c_str());
+
+    if (!options.baseline.empty())
+    {
+        std::vector<Result> baseline = readBaseline(options.baseline);
+        if (baseline.empty())
+        {
+            std::fprintf(stderr, "no results in %s\n", options.baseline.c_str());
+            return 2;
+        }
+        if (compareWithBaseline(runner.results, baseline, options.threshold) > 0)
+            return 1;
+    }
+    return 0;
+}
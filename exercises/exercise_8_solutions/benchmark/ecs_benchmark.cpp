@@ -0,0 +1,212 @@
+// Times the per-frame systems of the entity store for growing numbers of renderables:
+// the transform system (world matrix and bounds), the culling system (bounds against the view frustum)
+// and the sorting system (sort key of the visible entities, then the sort).
+// The same work is done on one heap object per renderable, reached through a pointer array, for comparison.
+// The ns per entity should stay about flat from 1k to 1M entities if the systems scale linearly.
+//
+// usage: ecs_benchmark [max entities] (1000000 by default)
+
+#include "ecs.h"
+#include "components.h"
+#include "light_culling.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+typedef std::chrono::high_resolution_clock Clock;
+
+double secondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// material in the high bits, depth in the low bits, like RenderQueue::MakeKey
+uint64_t sortKey(unsigned int material, float viewDepth)
+{
+    float t = std::min(std::max(viewDepth / 100.0f, 0.0f), 1.0f);
+    return ((uint64_t)material << 32) | (uint32_t)(t * 4294967295.0);
+}
+
+struct Timings
+{
+    double transform = 0.0, cull = 0.0, sort = 0.0;
+    int visible = 0;
+};
+
+// the scene graph's world matrices, the entities copy theirs from here like updateSceneGraph() does
+std::vector<glm::mat4> makeNodes(int count, std::mt19937 &random)
+{
+    std::uniform_real_distribution<float> position(-200.0f, 200.0f);
+    std::uniform_real_distribution<float> angle(0.0f, 6.28f);
+    std::vector<glm::mat4> nodes(count);
+    for (glm::mat4 &node : nodes)
+    {
+        node = glm::translate(glm::mat4(1.0f), glm::vec3(position(random), position(random) * 0.1f, position(random)));
+        node = glm::rotate(node, angle(random), glm::vec3(0.0f, 1.0f, 0.0f));
+    }
+    return nodes;
+}
+
+Timings runEntityStore(int count, const std::vector<glm::mat4> &nodes, const glm::mat4 &view, const glm::mat4 &viewProjection, int frames)
+{
+    EntityStore store;
+    for (int i = 0; i < count; i++)
+    {
+        BoundsComponent bounds = { glm::vec3(0.0f), 1.5f, glm::vec3(0.0f), 0.0f };
+        MaterialComponent material = {};
+        material.diffuse = (unsigned int)(i % 16);
+        store.Create(TransformComponent{ i, glm::mat4(1.0f) }, bounds, MeshComponent{ nullptr, 0 }, material);
+    }
+
+    glm::vec4 planes[6];
+    FrustumPlanes(viewProjection, planes);
+    std::vector<uint64_t> keys;
+    keys.reserve(count);
+
+    Timings timings;
+    for (int frame = 0; frame < frames; frame++)
+    {
+        Clock::time_point start = Clock::now();
+        store.ForEach<TransformComponent, BoundsComponent>([&nodes](int n, TransformComponent* transforms, BoundsComponent* bounds) {
+            for (int i = 0; i < n; i++)
+            {
+                transforms[i].world = nodes[transforms[i].node];
+                UpdateWorldBounds(bounds[i], transforms[i].world);
+            }
+        });
+        timings.transform += secondsSince(start);
+
+        // the culling and sort key systems run in one pass over the chunks, the visible keys are gathered
+        start = Clock::now();
+        keys.clear();
+        store.ForEach<BoundsComponent, MaterialComponent>([&](int n, BoundsComponent* bounds, MaterialComponent* materials) {
+            for (int i = 0; i < n; i++)
+            {
+                if (!SphereInFrustum(planes, bounds[i].center, bounds[i].radius))
+                    continue;
+                float viewDepth = -(view * glm::vec4(bounds[i].center, 1.0f)).z;
+                keys.push_back(sortKey(materials[i].diffuse, viewDepth));
+            }
+        });
+        timings.cull += secondsSince(start);
+
+        start = Clock::now();
+        std::sort(keys.begin(), keys.end());
+        timings.sort += secondsSince(start);
+        timings.visible = (int)keys.size();
+    }
+    return timings;
+}
+
+// one object per renderable, allocated on its own and reached through a pointer, with the fields
+// every system needs mixed together, as a class hierarchy of scene objects would have them
+struct Renderable
+{
+    const glm::mat4* node;
+    glm::mat4 world;
+    glm::vec3 localCenter;
+    float localRadius;
+    glm::vec3 center;
+    float radius;
+    unsigned int material;
+    char otherState[64]; // name, flags and the rest of a typical scene object
+};
+
+Timings runPointers(int count, const std::vector<glm::mat4> &nodes, const glm::mat4 &view, const glm::mat4 &viewProjection, int frames,
+                    std::mt19937 &random)
+{
+    std::vector<std::unique_ptr<Renderable>> objects(count);
+    for (int i = 0; i < count; i++)
+    {
+        objects[i].reset(new Renderable());
+        objects[i]->node = &nodes[i];
+        objects[i]->localCenter = glm::vec3(0.0f);
+        objects[i]->localRadius = 1.5f;
+        objects[i]->material = (unsigned int)(i % 16);
+    }
+    // objects created over time do not end up next to each other in memory
+    std::vector<Renderable*> scene(count);
+    for (int i = 0; i < count; i++)
+        scene[i] = objects[i].get();
+    std::shuffle(scene.begin(), scene.end(), random);
+
+    glm::vec4 planes[6];
+    FrustumPlanes(viewProjection, planes);
+    std::vector<uint64_t> keys;
+    keys.reserve(count);
+
+    Timings timings;
+    for (int frame = 0; frame < frames; frame++)
+    {
+        Clock::time_point start = Clock::now();
+        for (Renderable* object : scene)
+        {
+            object->world = *object->node;
+            BoundsComponent bounds = { object->localCenter, object->localRadius, glm::vec3(0.0f), 0.0f };
+            UpdateWorldBounds(bounds, object->world);
+            object->center = bounds.center;
+            object->radius = bounds.radius;
+        }
+        timings.transform += secondsSince(start);
+
+        start = Clock::now();
+        keys.clear();
+        for (Renderable* object : scene)
+        {
+            if (!SphereInFrustum(planes, object->center, object->radius))
+                continue;
+            float viewDepth = -(view * glm::vec4(object->center, 1.0f)).z;
+            keys.push_back(sortKey(object->material, viewDepth));
+        }
+        timings.cull += secondsSince(start);
+
+        start = Clock::now();
+        std::sort(keys.begin(), keys.end());
+        timings.sort += secondsSince(start);
+        timings.visible = (int)keys.size();
+    }
+    return timings;
+}
+
+void printRow(const char* layout, int count, const Timings &timings, int frames)
+{
+    double perEntity = 1e9 / ((double)count * frames);
+    std::printf("%-9s %9d %9d %12.2f %12.2f %12.2f %12.2f\n", layout, count, timings.visible,
+                timings.transform * perEntity, timings.cull * perEntity, timings.sort * perEntity,
+                (timings.transform + timings.cull + timings.sort) * 1e3 / frames);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    int maxCount = argc > 1 ? std::atoi(argv[1]) : 1000000;
+
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 10.0f, 0.0f), glm::vec3(1.0f, 10.0f, 1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 100.0f);
+    glm::mat4 viewProjection = projection * view;
+
+    std::printf("%-9s %9s %9s %12s %12s %12s %12s\n", "layout", "entities", "visible", "transform ns", "cull ns", "sort ns", "frame ms");
+    for (int count = 1000; count <= maxCount; count *= 10)
+    {
+        std::mt19937 random(count);
+        std::vector<glm::mat4> nodes = makeNodes(count, random);
+        // about the same amount of work for every size, so small sizes are not lost in the timer resolution
+        int frames = std::max(3, 10000000 / count);
+
+        printRow("chunks", count, runEntityStore(count, nodes, view, viewProjection, frames), frames);
+        printRow("pointers", count, runPointers(count, nodes, view, viewProjection, frames, random), frames);
+    }
+    return 0;
+}
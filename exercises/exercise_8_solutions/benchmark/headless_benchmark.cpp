@@ -0,0 +1,635 @@
+// Renders exercise 8 without a window, for machines without a display or a GPU: the GL context comes from
+// EGL with no surface (Mesa's surfaceless platform, llvmpipe when there is no GPU) and the frames are drawn
+// into a framebuffer object of a fixed size. The scene, shaders and assets are the ones of the exercise,
+// main.cpp is compiled into this file without its main().
+// A recorded camera path (press R in the exercise to record one) or an orbit around the leaves is played
+// back at a fixed 60 Hz step, and the CPU and GPU time and the GL counters of every frame are written to CSV,
+// with the percentiles in a second file. With --overdraw the color passes count their fragments instead of
+// shading (see overdraw.h), and the fragments per pixel of every frame and their histogram are written too.
+// With --target-ms the resolution is scaled to hold that GPU time (see dynamic_resolution.h) and the scale
+// of every frame is written. The GPU time of the leaf shading passes is written with every frame, and when the
+// back-lit light is shaded at a reduced resolution (see translucency.h) a few poses of the path are also drawn
+// at full rate, and the error of the reduced images against them goes into the summary. The leaves of each
+// material tier (see material_lod.h) and the GPU time of their main pass draw are written with every frame,
+// and the error of each cheaper tier is measured the same way, against the full material. The leaves left
+// by the density LOD (see density_lod.h) are written with every frame. With a static model, the batched
+// draws (see static_batch.h) are compared the same way against one draw per mesh, they should match.
+//
+// usage: exercise_8_solutions_headless [options]
+//   --frames N          frames to measure (600)
+//   --warmup N          frames drawn before measuring (60)
+//   --width W --height H  resolution (1280x720)
+//   --instances N       leaves drawn (all)
+//   --lights N          lights, at least the directional and the animated point light (2)
+//   --mode leaf|phong|pbr  shading model (leaf)
+//   --path file         camera path recorded by the exercise (orbit around the leaves)
+//   --output file       per frame CSV (benchmark_frames.csv)
+//   --summary file      percentile CSV (benchmark_summary.csv)
+//   --no-light-culling --no-shadow-cache --no-batching  turn the optimizations off
+//   --overdraw          count the fragments per pixel instead of shading
+//   --target-ms T       scale the resolution to hold T GPU milliseconds per frame
+//   --translucency full|half|quarter  resolution of the back-lit light of the leaves (half)
+//   --no-material-lod   shade every leaf with the full material
+//   --no-density-lod    draw every leaf at any distance
+//   --model file        static model placed in front of the leaves, drawn batched and per mesh to compare them
+
+#define EXERCISE8_NO_MAIN
+#include "main.cpp"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+struct BenchmarkOptions
+{
+    int frames = 600;
+    int warmup = 60;
+    int width = 1280, height = 720;
+    int instances = MAX_LEAF_INSTANCES;
+    int lights = 2;
+    std::string mode = "leaf";
+    std::string path;
+    std::string output = "benchmark_frames.csv";
+    std::string summary = "benchmark_summary.csv";
+    bool lightCulling = true, shadowCaching = true, staticBatching = true;
+    bool overdraw = false;
+    float targetMilliseconds = 0.0f; // dynamic resolution off when 0
+    std::string translucency = "half";
+    bool materialLod = true;
+    bool densityLod = true;
+    std::string model; // no static model when empty
+};
+
+struct FrameRow
+{
+    int frame;
+    double cpuMilliseconds, gpuMilliseconds;
+    double shadingMilliseconds; // of the leaves, see leafShadingMilliseconds()
+    bool gpuResolved;
+    unsigned int glIssued, glElided;
+    uint64_t counters[GLStats::COUNTER_COUNT];
+    bool queried;
+    bool overdrawResolved;
+    OverdrawStats overdraw;
+    float renderScale;
+    int tierLeaves[MaterialLod::TIER_COUNT];
+    double tierMilliseconds[MaterialLod::TIER_COUNT]; // of the main pass draw of the tier
+    int drawnLeaves; // left by the density LOD
+};
+
+bool parseOptions(int argc, char** argv, BenchmarkOptions &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string name = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (name == "--frames" && hasValue) options.frames = std::atoi(argv[++i]);
+        else if (name == "--warmup" && hasValue) options.warmup = std::atoi(argv[++i]);
+        else if (name == "--width" && hasValue) options.width = std::atoi(argv[++i]);
+        else if (name == "--height" && hasValue) options.height = std::atoi(argv[++i]);
+        else if (name == "--instances" && hasValue) options.instances = std::atoi(argv[++i]);
+        else if (name == "--lights" && hasValue) options.lights = std::atoi(argv[++i]);
+        else if (name == "--mode" && hasValue) options.mode = argv[++i];
+        else if (name == "--path" && hasValue) options.path = argv[++i];
+        else if (name == "--output" && hasValue) options.output = argv[++i];
+        else if (name == "--summary" && hasValue) options.summary = argv[++i];
+        else if (name == "--no-light-culling") options.lightCulling = false;
+        else if (name == "--no-shadow-cache") options.shadowCaching = false;
+        else if (name == "--no-batching") options.staticBatching = false;
+        else if (name == "--overdraw") options.overdraw = true;
+        else if (name == "--translucency" && hasValue) options.translucency = argv[++i];
+        else if (name == "--no-material-lod") options.materialLod = false;
+        else if (name == "--no-density-lod") options.densityLod = false;
+        else if (name == "--model" && hasValue) options.model = argv[++i];
+        else if (name == "--target-ms" && hasValue) options.targetMilliseconds = (float)std::atof(argv[++i]);
+        else
+        {
+            std::cout << "unknown option " << name << ", see the top of headless_benchmark.cpp" << std::endl;
+            return false;
+        }
+    }
+    if (options.frames < 1 || options.width < 1 || options.height < 1)
+    {
+        std::cout << "frames, width and height must be positive" << std::endl;
+        return false;
+    }
+    if (options.mode != "leaf" && options.mode != "phong" && options.mode != "pbr")
+    {
+        std::cout << "unknown mode " << options.mode << ", use leaf, phong or pbr" << std::endl;
+        return false;
+    }
+    if (options.translucency != "full" && options.translucency != "half" && options.translucency != "quarter")
+    {
+        std::cout << "unknown translucency resolution " << options.translucency << ", use full, half or quarter" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// an OpenGL 3.3 core context without any surface, made current on this thread
+bool createHeadlessContext(EGLDisplay &display, EGLContext &context)
+{
+    display = EGL_NO_DISPLAY;
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+    if (getPlatformDisplay)
+        display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+#endif
+    if (display == EGL_NO_DISPLAY)
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    EGLint major = 0, minor = 0;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+    {
+        std::cout << "Failed to initialize EGL" << std::endl;
+        return false;
+    }
+    if (!eglBindAPI(EGL_OPENGL_API))
+    {
+        std::cout << "EGL has no desktop OpenGL" << std::endl;
+        return false;
+    }
+
+    // nothing is drawn to a surface, any config that can do OpenGL will do
+    const EGLint configAttributes[] = { EGL_SURFACE_TYPE, 0, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+    EGLConfig config = nullptr;
+    EGLint configCount = 0;
+    if (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0)
+        config = nullptr; // EGL_KHR_no_config_context
+
+    const EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+    if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+    {
+        std::cout << "Failed to create a surfaceless OpenGL 3.3 core context (EGL " << major << "." << minor << ")" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// the framebuffer the frames are drawn into, sRGB like the window
+GLuint createSceneFramebuffer(int width, int height)
+{
+    GLuint framebuffer, color, depth;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glGenRenderbuffers(1, &color);
+    glBindRenderbuffer(GL_RENDERBUFFER, color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_SRGB8_ALPHA8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+    glGenRenderbuffers(1, &depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "The benchmark framebuffer is not complete" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return framebuffer;
+}
+
+// nearest rank
+double percentile(std::vector<double> values, double p)
+{
+    if (values.empty())
+        return 0.0;
+    std::sort(values.begin(), values.end());
+    size_t rank = (size_t)std::ceil(p / 100.0 * (double)values.size());
+    return values[rank > 0 ? rank - 1 : 0];
+}
+
+void writeFrames(const std::string &path, const std::vector<FrameRow> &rows, const BenchmarkOptions &options)
+{
+    std::ofstream file(path);
+    file << "frame,cpu ms,gpu ms,leaf shading ms,leaves drawn,gl calls issued,gl calls elided";
+    if (GLStats::ENABLED)
+        for (int i = 0; i < GLStats::COUNTER_COUNT; i++)
+            file << "," << GLStats::CounterName(i);
+    if (options.overdraw)
+    {
+        file << ",overdraw min,overdraw average,overdraw max";
+        for (int i = 0; i < OverdrawStats::HISTOGRAM_BINS; i++)
+            file << ",pixels " << i << (i == OverdrawStats::HISTOGRAM_BINS - 1 ? "+" : "");
+    }
+    if (options.targetMilliseconds > 0.0f)
+        file << ",render scale";
+    for (int tier = 0; tier < MaterialLod::TIER_COUNT; tier++)
+        file << "," << MaterialLod::TierName(tier) << " leaves," << MaterialLod::TierName(tier) << " ms";
+    file << "\n";
+    for (const FrameRow &row : rows)
+    {
+        file << row.frame << "," << row.cpuMilliseconds << ",";
+        if (row.gpuResolved)
+            file << row.gpuMilliseconds;
+        file << ",";
+        if (row.gpuResolved)
+            file << row.shadingMilliseconds;
+        file << "," << row.drawnLeaves << "," << row.glIssued << "," << row.glElided;
+        if (GLStats::ENABLED)
+            for (int i = 0; i < GLStats::COUNTER_COUNT; i++)
+            {
+                file << ",";
+                if (row.queried || (i != GLStats::PRIMITIVES_GENERATED && i != GLStats::SAMPLES_PASSED))
+                    file << row.counters[i];
+            }
+        if (options.overdraw)
+        {
+            // empty when the counts of the frame were not read back
+            if (row.overdrawResolved)
+                file << "," << row.overdraw.min << "," << row.overdraw.average << "," << row.overdraw.max;
+            else
+                file << ",,,";
+            for (int i = 0; i < OverdrawStats::HISTOGRAM_BINS; i++)
+            {
+                file << ",";
+                if (row.overdrawResolved)
+                    file << row.overdraw.histogram[i];
+            }
+        }
+        if (options.targetMilliseconds > 0.0f)
+            file << "," << row.renderScale;
+        for (int tier = 0; tier < MaterialLod::TIER_COUNT; tier++)
+        {
+            file << "," << row.tierLeaves[tier] << ",";
+            if (row.gpuResolved)
+                file << row.tierMilliseconds[tier];
+        }
+        file << "\n";
+    }
+    if (!file)
+        std::cout << "could not write " << path << std::endl;
+}
+
+// difference of the images drawn with a cheaper setting from the reference ones, in 8 bit sRGB values
+struct ImageError
+{
+    int images = 0;
+    double rmse = 0.0, psnr = 0.0;
+    int maxError = 0;
+    double pixelsOff = 0.0; // share of the pixels with a channel off by more than 2
+};
+
+// draws samples poses spread over the path twice, after configure(true) for the reference and configure(false)
+// for the setting under test, without moving anything in between, and compares the two images
+ImageError compareImages(const CameraPath &path, const BenchmarkOptions &options, int samples, const std::function<void(bool)> &configure)
+{
+    ImageError error;
+    bool scaling = dynamicResolution.enabled;
+    dynamicResolution.enabled = false;
+    deltaTime = 0.0f;
+
+    size_t size = (size_t)options.width * options.height * 4;
+    std::vector<unsigned char> reference(size), reduced(size);
+    double squared = 0.0;
+    uint64_t values = 0, pixelsOff = 0;
+    for (int sample = 0; sample < samples; sample++)
+    {
+        CameraKey key = path.Sample(path.Duration() * ((float)sample + 0.5f) / (float)samples);
+        camera.SetPose(key.position, key.yaw, key.pitch, key.zoom);
+        sceneLight(1).position = key.lightPosition;
+        for (int pass = 0; pass < 2; pass++)
+        {
+            configure(pass == 0);
+            renderFrame();
+            glStats.EndFrame();
+            glState.BindFramebuffer(sceneFramebuffer);
+            glReadPixels(0, 0, options.width, options.height, GL_RGBA, GL_UNSIGNED_BYTE, pass == 0 ? &reference[0] : &reduced[0]);
+        }
+        for (size_t pixel = 0; pixel < size; pixel += 4)
+        {
+            int pixelError = 0;
+            for (size_t channel = pixel; channel < pixel + 3; channel++)
+            {
+                int difference = std::abs((int)reference[channel] - (int)reduced[channel]);
+                squared += (double)(difference * difference);
+                pixelError = std::max(pixelError, difference);
+            }
+            values += 3;
+            pixelsOff += pixelError > 2 ? 1 : 0;
+            error.maxError = std::max(error.maxError, pixelError);
+        }
+        error.images++;
+    }
+
+    dynamicResolution.enabled = scaling;
+    double mse = values > 0 ? squared / (double)values : 0.0;
+    error.rmse = std::sqrt(mse);
+    error.psnr = mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : std::numeric_limits<double>::infinity();
+    error.pixelsOff = values > 0 ? (double)pixelsOff / (double)(values / 3) : 0.0;
+    return error;
+}
+
+// the back-lit light at full rate and at the rate under test
+ImageError compareTranslucency(const CameraPath &path, const BenchmarkOptions &options, int samples)
+{
+    int divisor = translucency.divisor;
+    ImageError error = compareImages(path, options, samples, [divisor](bool reference) { translucency.divisor = reference ? 1 : divisor; });
+    translucency.divisor = divisor;
+    return error;
+}
+
+// every leaf with the full material, and only the leaves of one tier with the material of the tier
+ImageError compareMaterialTier(const CameraPath &path, const BenchmarkOptions &options, int samples, int tier)
+{
+    ImageError error = compareImages(path, options, samples, [tier](bool reference) {
+        materialLod.enabled = !reference;
+        materialLod.isolatedTier = tier;
+    });
+    materialLod.enabled = true;
+    materialLod.isolatedTier = -1;
+    return error;
+}
+
+// the static models drawn one mesh at a time, and in the multi-draws of their batches
+ImageError compareBatching(const CameraPath &path, const BenchmarkOptions &options, int samples)
+{
+    ImageError error = compareImages(path, options, samples, [](bool reference) { staticBatching = !reference; });
+    staticBatching = true;
+    return error;
+}
+
+void writeSummary(const std::string &path, const std::vector<FrameRow> &rows, const BenchmarkOptions &options, const ImageError &error,
+                  const ImageError tierErrors[MaterialLod::TIER_COUNT], const ImageError &batchError)
+{
+    std::vector<double> cpu, gpu, shading, drawnLeaves, overdrawAverage, overdrawMax;
+    std::vector<double> tierLeaves[MaterialLod::TIER_COUNT], tierTimes[MaterialLod::TIER_COUNT];
+    uint64_t histogram[OverdrawStats::HISTOGRAM_BINS] = {};
+    for (const FrameRow &row : rows)
+    {
+        cpu.push_back(row.cpuMilliseconds);
+        drawnLeaves.push_back(row.drawnLeaves);
+        for (int tier = 0; tier < MaterialLod::TIER_COUNT; tier++)
+            tierLeaves[tier].push_back(row.tierLeaves[tier]);
+        if (row.gpuResolved)
+        {
+            gpu.push_back(row.gpuMilliseconds);
+            shading.push_back(row.shadingMilliseconds);
+            for (int tier = 0; tier < MaterialLod::TIER_COUNT; tier++)
+                tierTimes[tier].push_back(row.tierMilliseconds[tier]);
+        }
+        if (row.overdrawResolved)
+        {
+            overdrawAverage.push_back(row.overdraw.average);
+            overdrawMax.push_back(row.overdraw.max);
+            for (int i = 0; i < OverdrawStats::HISTOGRAM_BINS; i++)
+                histogram[i] += row.overdraw.histogram[i];
+        }
+    }
+
+    std::ofstream file(path);
+    file << "# " << rows.size() << " frames at " << options.width << "x" << options.height << ", " << options.instances << " leaves, "
+         << options.lights << " lights, " << (options.overdraw ? "overdraw counting" : options.mode + " shading");
+    if (options.targetMilliseconds > 0.0f)
+        file << ", resolution scaled to " << options.targetMilliseconds << " GPU ms";
+    if (!options.densityLod)
+        file << ", no density LOD";
+    if (options.mode == "leaf" && !options.overdraw)
+        file << ", " << options.translucency << " rate translucency" << (options.materialLod ? "" : ", no material LOD");
+    file << "\n";
+    file << "metric,mean,p50,p90,p95,p99,max\n";
+    std::cout << "metric   mean     p50      p90      p95      p99      max" << std::endl;
+    auto writeMetric = [&file](const std::string &name, const std::vector<double> &values) {
+        double mean = 0.0;
+        for (double value : values)
+            mean += value;
+        mean = values.empty() ? 0.0 : mean / (double)values.size();
+        double p[] = { percentile(values, 50), percentile(values, 90), percentile(values, 95), percentile(values, 99), percentile(values, 100) };
+        file << name << "," << mean << "," << p[0] << "," << p[1] << "," << p[2] << "," << p[3] << "," << p[4] << "\n";
+        std::printf("%-8s %-8.3f %-8.3f %-8.3f %-8.3f %-8.3f %-8.3f\n", name.c_str(), mean, p[0], p[1], p[2], p[3], p[4]);
+    };
+    writeMetric("cpu ms", cpu);
+    writeMetric("gpu ms", gpu);
+    writeMetric("leaf shading ms", shading);
+    writeMetric("leaves drawn", drawnLeaves);
+    if (options.overdraw)
+    {
+        writeMetric("overdraw average", overdrawAverage);
+        writeMetric("overdraw max", overdrawMax);
+    }
+    else
+    {
+        for (int tier = 0; tier < MaterialLod::TIER_COUNT; tier++)
+        {
+            writeMetric(std::string(MaterialLod::TierName(tier)) + " leaves", tierLeaves[tier]);
+            writeMetric(std::string(MaterialLod::TierName(tier)) + " ms", tierTimes[tier]);
+        }
+    }
+    if (options.overdraw)
+    {
+        // the pixels of all the measured frames, by how many fragments they got
+        uint64_t pixels = 0;
+        for (uint64_t count : histogram)
+            pixels += count;
+        file << "\nfragments per pixel,share of pixels\n";
+        std::cout << "fragments per pixel:";
+        for (int i = 0; i < OverdrawStats::HISTOGRAM_BINS; i++)
+        {
+            double share = pixels > 0 ? (double)histogram[i] / (double)pixels : 0.0;
+            file << i << (i == OverdrawStats::HISTOGRAM_BINS - 1 ? "+" : "") << "," << share << "\n";
+            std::printf(" %d%s: %.1f%%", i, i == OverdrawStats::HISTOGRAM_BINS - 1 ? "+" : "", share * 100.0);
+        }
+        std::cout << std::endl;
+    }
+    if (error.images > 0)
+    {
+        file << "\ntranslucency error against full rate,images,rmse,psnr db,max,share of pixels off by more than 2\n";
+        file << options.translucency << "," << error.images << "," << error.rmse << "," << error.psnr << "," << error.maxError
+             << "," << error.pixelsOff << "\n";
+        std::printf("%s rate translucency against full rate, %d images: rmse %.3f, psnr %.1f dB, max %d, %.2f%% of the pixels off by more than 2\n",
+                    options.translucency.c_str(), error.images, error.rmse, error.psnr, error.maxError, error.pixelsOff * 100.0);
+    }
+    if (tierErrors[MaterialLod::TIER_MID].images > 0 || tierErrors[MaterialLod::TIER_FAR].images > 0)
+    {
+        // the near tier is the full material, it has no error
+        file << "\nmaterial tier error against the full material,images,rmse,psnr db,max,share of pixels off by more than 2\n";
+        for (int tier = MaterialLod::TIER_MID; tier < MaterialLod::TIER_COUNT; tier++)
+        {
+            const ImageError &tierError = tierErrors[tier];
+            file << MaterialLod::TierName(tier) << "," << tierError.images << "," << tierError.rmse << "," << tierError.psnr << ","
+                 << tierError.maxError << "," << tierError.pixelsOff << "\n";
+            std::printf("%s tier material against the full one, %d images: rmse %.3f, psnr %.1f dB, max %d, %.2f%% of the pixels off by more than 2\n",
+                        MaterialLod::TierName(tier), tierError.images, tierError.rmse, tierError.psnr, tierError.maxError, tierError.pixelsOff * 100.0);
+        }
+    }
+    if (batchError.images > 0)
+    {
+        file << "\nstatic batches against one draw per mesh,images,rmse,psnr db,max,share of pixels off by more than 2\n";
+        file << "batched," << batchError.images << "," << batchError.rmse << "," << batchError.psnr << "," << batchError.maxError
+             << "," << batchError.pixelsOff << "\n";
+        std::printf("static batches against one draw per mesh, %d images: rmse %.3f, psnr %.1f dB, max %d, %.2f%% of the pixels off by more than 2\n",
+                    batchError.images, batchError.rmse, batchError.psnr, batchError.maxError, batchError.pixelsOff * 100.0);
+    }
+    if (!file)
+        std::cout << "could not write " << path << std::endl;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    BenchmarkOptions options;
+    if (!parseOptions(argc, argv, options))
+        return 1;
+
+    EGLDisplay display;
+    EGLContext context;
+    if (!createHeadlessContext(display, context))
+        return 1;
+    if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress))
+    {
+        std::cout << "Failed to initialize GLAD" << std::endl;
+        return 1;
+    }
+    glStats.Install();
+    std::cout << "rendering with " << glGetString(GL_RENDERER) << std::endl;
+
+    screenWidth = options.width;
+    screenHeight = options.height;
+    sceneFramebuffer = createSceneFramebuffer(options.width, options.height);
+    initScene();
+    glState.Viewport(0, 0, options.width, options.height);
+    if (!options.model.empty())
+        addStaticModel(new Model(options.model), glm::translate(glm::mat4(1.0f), glm::vec3(4.5f, 0.0f, 3.0f)));
+
+    // the settings under test
+    instanceCount = std::max(1, std::min(options.instances, MAX_LEAF_INSTANCES));
+    options.instances = instanceCount;
+    casterVersion++;
+    options.lights = std::max(options.lights, 2);
+    while (lightCount() < options.lights)
+        addPointLight();
+    shader = options.mode == "phong" ? phong_shading : options.mode == "pbr" ? pbr_shading : leaf_shading;
+    lightCulling = options.lightCulling;
+    shadowCaching = options.shadowCaching;
+    staticBatching = options.staticBatching;
+    overdrawView = options.overdraw;
+    translucency.divisor = options.translucency == "quarter" ? 4 : options.translucency == "half" ? 2 : 1;
+    materialLod.enabled = options.materialLod;
+    densityLod.enabled = options.densityLod;
+    dynamicResolution.enabled = options.targetMilliseconds > 0.0f;
+    if (dynamicResolution.enabled)
+        dynamicResolution.targetMilliseconds = options.targetMilliseconds;
+    lightRotationSpeed = 0.0f; // the path moves the light
+
+    CameraPath path;
+    if (options.path.empty() || !path.Load(options.path))
+    {
+        if (!options.path.empty())
+            std::cout << "could not read the camera path " << options.path << ", orbiting the leaves instead" << std::endl;
+        path = CameraPath::Orbit(glm::vec3(4.5f, 4.5f, 0.0f), 9.0f, 1.0f, 10.0f);
+    }
+
+    // the profiler and the GL counters get their GPU results a few frames late, each frame is collected
+    // once they had the time to arrive
+    const float frameTime = 1.0f / 60.0f;
+    const int latency = std::max(Profiler::QUERY_LATENCY, GLStats::QUERY_LATENCY) + 1;
+    int totalFrames = options.warmup + options.frames;
+    std::vector<uint64_t> profileFrames(totalFrames), sceneFrames(totalFrames);
+    std::vector<FrameRow> rows;
+    rows.reserve(options.frames);
+
+    auto collect = [&](int frame) {
+        if (frame < options.warmup)
+            return;
+        FrameRow &row = rows[frame - options.warmup];
+        if (const ProfileFrame* profile = profiler.Frame(profileFrames[frame]))
+        {
+            row.cpuMilliseconds = profile->cpuDuration / 1000.0;
+            row.gpuMilliseconds = profile->gpuDuration / 1000.0;
+            row.shadingMilliseconds = leafShadingMilliseconds(*profile);
+            for (int tier = 0; tier < MaterialLod::TIER_COUNT; tier++)
+                row.tierMilliseconds[tier] = profile->GpuTime(mainPassTierNames[tier]) / 1000.0;
+            row.gpuResolved = profile->gpuResolved;
+        }
+        if (const GLStats::Frame* counts = glStats.FrameAt((uint64_t)frame))
+        {
+            std::memcpy(row.counters, counts->counters, sizeof(row.counters));
+            row.queried = counts->queried;
+        }
+        if (const OverdrawStats* stats = overdraw.StatsAt(sceneFrames[frame]))
+        {
+            row.overdraw = *stats;
+            row.overdrawResolved = true;
+        }
+    };
+
+    for (int frame = 0; frame < totalFrames; frame++)
+    {
+        CameraKey key = path.Sample((float)frame * frameTime);
+        camera.SetPose(key.position, key.yaw, key.pitch, key.zoom);
+        sceneLight(1).position = key.lightPosition;
+        deltaTime = frameTime;
+
+        renderFrame();
+        profileFrames[frame] = profiler.CurrentFrame();
+        sceneFrames[frame] = frameIndex;
+        if (frame >= options.warmup)
+        {
+            FrameRow row = {};
+            row.frame = frame - options.warmup;
+            row.glIssued = glState.IssuedTotal();
+            row.glElided = glState.ElidedTotal();
+            row.renderScale = dynamicResolution.enabled && !overdrawView ? dynamicResolution.Scale() : 1.0f;
+            for (int tier = 0; tier < MaterialLod::TIER_COUNT; tier++)
+                row.tierLeaves[tier] = materialLod.count[tier];
+            row.drawnLeaves = densityLod.drawn;
+            rows.push_back(row);
+        }
+        glStats.EndFrame();
+        // what the swap would do, so the GPU never falls far behind
+        glFlush();
+
+        if (frame >= latency)
+            collect(frame - latency);
+    }
+
+    // empty frames until the results of the last frames are in
+    glFinish();
+    if (options.overdraw)
+        overdraw.Collect();
+    for (int i = 0; i < latency; i++)
+    {
+        profiler.BeginFrame();
+        glStats.BeginFrame();
+        glStats.EndFrame();
+    }
+    for (int frame = std::max(0, totalFrames - latency); frame < totalFrames; frame++)
+        collect(frame);
+
+    // after the measured frames, so the comparison does not disturb them
+    ImageError error;
+    if (translucency.Reduced() && shader == leaf_shading && !overdrawView)
+        error = compareTranslucency(path, options, 8);
+    ImageError tierErrors[MaterialLod::TIER_COUNT];
+    if (materialLod.enabled && shader == leaf_shading && !overdrawView)
+        for (int tier = MaterialLod::TIER_MID; tier < MaterialLod::TIER_COUNT; tier++)
+            tierErrors[tier] = compareMaterialTier(path, options, 8, tier);
+    ImageError batchError;
+    if (staticBatching && !staticModels.empty() && !overdrawView)
+        batchError = compareBatching(path, options, 8);
+
+    writeFrames(options.output, rows, options);
+    writeSummary(options.summary, rows, options, error, tierErrors, batchError);
+    std::cout << "wrote " << rows.size() << " frames to " << options.output << " and the percentiles to " << options.summary << std::endl;
+
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(display, context);
+    eglTerminate(display);
+    return 0;
+}
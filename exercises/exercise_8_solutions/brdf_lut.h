@@ -0,0 +1,124 @@
+#ifndef BRDF_LUT_H
+#define BRDF_LUT_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include "job_system.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// The second half of the split sum approximation of the image based specular (Karis 2013): the GGX
+// BRDF integrated over the hemisphere with a white environment, for a given N.V and roughness. With
+// Schlick's Fresnel it splits into a scale and a bias of F0, so the specular of the environment is
+//     prefiltered sky (EnvironmentBaker) * (F0 * A + B)
+// instead of prefiltered sky * F(N.V), which also takes in the shadowing and masking of the rough
+// surfaces at grazing angles. The table does not depend on the scene, it is computed at startup with
+// a group of rows per job.
+// Texel (i, j) holds A and B at N.V = (i + 0.5) / SIZE and roughness = (j + 0.5) / SIZE, so the shaders
+// sample it with linear filtering at (N.V, roughness) directly.
+class BrdfLut
+{
+public:
+    static const int SIZE = 128;
+    static const int SAMPLES = 512; // GGX samples per texel
+
+    // half float RG, A in red and B in green, row j is roughness
+    std::vector<uint16_t> texels;
+    double milliseconds = 0.0;
+
+    void Generate(JobSystem &jobs)
+    {
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        texels.assign((size_t)SIZE * SIZE * 2, 0);
+        JobCounter generated;
+        jobs.ParallelFor("integrate brdf", SIZE, 4, [this](int begin, int end) {
+            std::vector<glm::vec3> halfVectors;
+            for (int j = begin; j < end; j++)
+            {
+                float roughness = (j + 0.5f) / SIZE;
+                sampleHalfVectors(roughness, halfVectors);
+                for (int i = 0; i < SIZE; i++)
+                {
+                    glm::vec2 scaleBias = integrate((i + 0.5f) / SIZE, roughness, halfVectors);
+                    texels[((size_t)j * SIZE + i) * 2 + 0] = glm::packHalf1x16(scaleBias.x);
+                    texels[((size_t)j * SIZE + i) * 2 + 1] = glm::packHalf1x16(scaleBias.y);
+                }
+            }
+        }, &generated);
+        jobs.Wait(generated);
+        milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    // A and B of a view angle and a roughness
+    static glm::vec2 Integrate(float NdotV, float roughness)
+    {
+        std::vector<glm::vec3> halfVectors;
+        sampleHalfVectors(roughness, halfVectors);
+        return integrate(NdotV, roughness, halfVectors);
+    }
+
+private:
+    // the GGX distribution of a roughness importance sampled on a Hammersley set, around N = (0, 0, 1).
+    // The same for every N.V, so a row of the table computes them once
+    static void sampleHalfVectors(float roughness, std::vector<glm::vec3> &halfVectors)
+    {
+        const float pi = 3.14159265f;
+        float a = roughness * roughness;
+        halfVectors.resize(SAMPLES);
+        for (int i = 0; i < SAMPLES; i++)
+        {
+            float u = (float)i / SAMPLES, w = radicalInverse((uint32_t)i);
+            float phi = 2.0f * pi * u;
+            float cosTheta = std::sqrt((1.0f - w) / (1.0f + (a * a - 1.0f) * w));
+            float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+            halfVectors[i] = glm::vec3(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+        }
+    }
+
+    static glm::vec2 integrate(float NdotV, float roughness, const std::vector<glm::vec3> &halfVectors)
+    {
+        float a = roughness * roughness;
+        // N = (0, 0, 1), V in the xz plane
+        glm::vec3 v(std::sqrt(1.0f - NdotV * NdotV), 0.0f, NdotV);
+        float smithV = smithG1(NdotV, a);
+        float scale = 0.0f, bias = 0.0f;
+        for (const glm::vec3 &h : halfVectors)
+        {
+            float VdotH = glm::dot(v, h);
+            glm::vec3 l = h * (2.0f * VdotH) - v;
+            float NdotL = l.z, NdotH = h.z;
+            if (NdotL <= 0.0f || VdotH <= 0.0f)
+                continue;
+            // the BRDF over the pdf of the sample, D cancels out: G * V.H / (N.H * N.V)
+            float visibility = smithV * smithG1(NdotL, a) * VdotH / (NdotH * NdotV);
+            float m = 1.0f - VdotH;
+            float fresnel = m * m * m * m * m;
+            scale += (1.0f - fresnel) * visibility;
+            bias += fresnel * visibility;
+        }
+        return glm::vec2(scale, bias) / (float)SAMPLES;
+    }
+
+    // the Smith GGX masking of the shaders (GeometrySchlickGGX)
+    static float smithG1(float cosAngle, float a)
+    {
+        float a2 = a * a;
+        return 2.0f * cosAngle / (cosAngle + std::sqrt(a2 + (1.0f - a2) * cosAngle * cosAngle));
+    }
+
+    static float radicalInverse(uint32_t bits)
+    {
+        bits = (bits << 16u) | (bits >> 16u);
+        bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+        bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+        bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+        bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+        return (float)bits * 2.3283064365386963e-10f;
+    }
+};
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef CAMERA_PATH_H
+#define CAMERA_PATH_H
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// one sample of a camera path: the camera pose and the position of the animated light at a time
+struct CameraKey
+{
+    float time;
+    glm::vec3 position;
+    float yaw, pitch, zoom;
+    glm::vec3 lightPosition;
+};
+
+// A camera and light path recorded from the interactive exercise and played back by the benchmark.
+// Stored as CSV, one key per line: time,x,y,z,yaw,pitch,zoom,light x,light y,light z
+class CameraPath
+{
+public:
+    std::vector<CameraKey> keys; // sorted by time
+
+    bool Empty() const { return keys.empty(); }
+    float Duration() const { return keys.empty() ? 0.0f : keys.back().time; }
+
+    void Add(const CameraKey &key)
+    {
+        keys.push_back(key);
+    }
+
+    // the pose at time, interpolated between the keys. The path loops past its end
+    CameraKey Sample(float time) const
+    {
+        if (keys.size() == 1 || Duration() <= 0.0f)
+            return keys.front();
+        time = std::fmod(time, Duration());
+        size_t next = 1;
+        while (next < keys.size() - 1 && keys[next].time < time)
+            next++;
+        const CameraKey &a = keys[next - 1], &b = keys[next];
+        float t = b.time > a.time ? (time - a.time) / (b.time - a.time) : 0.0f;
+        t = glm::clamp(t, 0.0f, 1.0f);
+
+        CameraKey key;
+        key.time = time;
+        key.position = glm::mix(a.position, b.position, t);
+        // the camera does not wrap its yaw, so this follows the recorded turn
+        key.yaw = a.yaw + (b.yaw - a.yaw) * t;
+        key.pitch = a.pitch + (b.pitch - a.pitch) * t;
+        key.zoom = a.zoom + (b.zoom - a.zoom) * t;
+        key.lightPosition = glm::mix(a.lightPosition, b.lightPosition, t);
+        return key;
+    }
+
+    // returns false if the file cannot be read or has no keys. Lines starting with # are skipped
+    bool Load(const std::string &path)
+    {
+        keys.clear();
+        std::ifstream file(path);
+        if (!file)
+            return false;
+        std::string line;
+        while (std::getline(file, line))
+        {
+            if (line.empty() || line[0] == '#')
+                continue;
+            for (char &c : line)
+                if (c == ',')
+                    c = ' ';
+            std::istringstream values(line);
+            CameraKey key;
+            if (values >> key.time >> key.position.x >> key.position.y >> key.position.z >> key.yaw >> key.pitch >> key.zoom
+                       >> key.lightPosition.x >> key.lightPosition.y >> key.lightPosition.z)
+                keys.push_back(key);
+        }
+        return !keys.empty();
+    }
+
+    bool Save(const std::string &path) const
+    {
+        std::ofstream file(path);
+        if (!file)
+            return false;
+        file << "# time,x,y,z,yaw,pitch,zoom,light x,light y,light z\n";
+        for (const CameraKey &key : keys)
+            file << key.time << "," << key.position.x << "," << key.position.y << "," << key.position.z << ","
+                 << key.yaw << "," << key.pitch << "," << key.zoom << ","
+                 << key.lightPosition.x << "," << key.lightPosition.y << "," << key.lightPosition.z << "\n";
+        return (bool)file;
+    }
+
+    // a path around a point, looking at it, for when there is no recording: one turn in the given time,
+    // with the light circling the other way
+    static CameraPath Orbit(glm::vec3 center, float radius, float height, float duration, int keyCount = 64)
+    {
+        CameraPath path;
+        for (int i = 0; i <= keyCount; i++)
+        {
+            float t = (float)i / (float)keyCount;
+            float angle = t * 6.2831853f;
+            CameraKey key;
+            key.time = t * duration;
+            key.position = center + glm::vec3(std::cos(angle) * radius, height, std::sin(angle) * radius);
+            glm::vec3 toCenter = glm::normalize(center - key.position);
+            key.yaw = glm::degrees(std::atan2(toCenter.z, toCenter.x));
+            // keep turning the same way instead of jumping back at 180 degrees
+            while (i > 0 && key.yaw < path.keys.back().yaw - 180.0f)
+                key.yaw += 360.0f;
+            while (i > 0 && key.yaw > path.keys.back().yaw + 180.0f)
+                key.yaw -= 360.0f;
+            key.pitch = glm::degrees(std::asin(toCenter.y));
+            key.zoom = 45.0f;
+            key.lightPosition = center + glm::vec3(std::cos(-angle) * 3.0f, 1.5f, std::sin(-angle) * 3.0f);
+            path.Add(key);
+        }
+        return path;
+    }
+};
+
+#endif
@@ -0,0 +1,397 @@
+#ifndef COMMAND_LIST_H
+#define COMMAND_LIST_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "gl_state.h"
+#include "stream_buffer.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+// A pass recorded as a compact stream of binary commands, so the CPU work of preparing it (culling,
+// picking uniforms, choosing instance ranges) can run on any thread while every GL call stays on the
+// thread that owns the context. Each command is a small header (opcode and size) followed by a plain
+// struct, and the draws that stream their instance transforms carry the transforms inline.
+// Recording touches nothing but the list's own bytes, which are kept between frames: every list is a
+// private arena of the job recording it, so passes record in parallel without locks or allocations.
+// Replay() walks the bytes in order on the GL thread, going through glState like the rest of the renderer.
+// Uniforms are set by location, see Shader::location(), since glGetUniformLocation is a GL call.
+class CommandList
+{
+public:
+    // the per-instance model matrix of the instanced draws takes 4 locations starting here, see initQuadBuffers()
+    static const GLuint INSTANCE_ATTRIBUTE = 5;
+
+    // forgets the commands, keeping the memory for the next frame
+    void Reset()
+    {
+        bytes.clear();
+        commandCount = 0;
+    }
+
+    size_t Size() const { return bytes.size(); }
+    size_t Capacity() const { return bytes.capacity(); }
+    int CommandCount() const { return commandCount; }
+
+    // recording, no GL calls
+    // ------------------------------------------------------------------------
+    void UseProgram(GLuint program)
+    {
+        Name command = { program };
+        push(CMD_USE_PROGRAM, command);
+    }
+
+    void BindTexture(GLuint unit, GLenum target, GLuint texture)
+    {
+        TextureCommand command = { unit, target, texture };
+        push(CMD_BIND_TEXTURE, command);
+    }
+
+    void BindFramebuffer(GLuint framebuffer)
+    {
+        Name command = { framebuffer };
+        push(CMD_BIND_FRAMEBUFFER, command);
+    }
+
+    // attaches a layer of a depth texture array to the bound framebuffer
+    void FramebufferDepthLayer(GLuint texture, int layer)
+    {
+        LayerCommand command = { texture, layer };
+        push(CMD_FRAMEBUFFER_DEPTH_LAYER, command);
+    }
+
+    void SetEnabled(GLenum capability, bool enabled)
+    {
+        Pair command = { capability, enabled ? 1u : 0u };
+        push(CMD_SET_ENABLED, command);
+    }
+
+    void DepthFunc(GLenum func)
+    {
+        Name command = { func };
+        push(CMD_DEPTH_FUNC, command);
+    }
+
+    void BlendFunc(GLenum source, GLenum destination)
+    {
+        Pair command = { source, destination };
+        push(CMD_BLEND_FUNC, command);
+    }
+
+    void Viewport(int x, int y, int width, int height)
+    {
+        Rect command = { x, y, width, height };
+        push(CMD_VIEWPORT, command);
+    }
+
+    void Scissor(int x, int y, int width, int height)
+    {
+        Rect command = { x, y, width, height };
+        push(CMD_SCISSOR, command);
+    }
+
+    void Clear(GLbitfield mask)
+    {
+        Name command = { mask };
+        push(CMD_CLEAR, command);
+    }
+
+    // clears one color attachment of the bound framebuffer to value, whatever the clear color is
+    void ClearColorBuffer(int drawBuffer, const glm::vec4 &value)
+    {
+        ClearBufferCommand command = { drawBuffer, { value.x, value.y, value.z, value.w } };
+        push(CMD_CLEAR_COLOR_BUFFER, command);
+    }
+
+    void SetInt(GLint location, int value)
+    {
+        UniformInt command = { location, value };
+        push(CMD_UNIFORM_INT, command);
+    }
+
+    void SetFloat(GLint location, float value)
+    {
+        UniformFloats<1> command = { location, { value } };
+        push(CMD_UNIFORM_FLOAT, command);
+    }
+
+    void SetVec2(GLint location, const glm::vec2 &value)
+    {
+        UniformFloats<2> command = { location, { value.x, value.y } };
+        push(CMD_UNIFORM_VEC2, command);
+    }
+
+    void SetVec3(GLint location, const glm::vec3 &value)
+    {
+        UniformFloats<3> command = { location, { value.x, value.y, value.z } };
+        push(CMD_UNIFORM_VEC3, command);
+    }
+
+    void SetVec4(GLint location, const glm::vec4 &value)
+    {
+        UniformFloats<4> command = { location, { value.x, value.y, value.z, value.w } };
+        push(CMD_UNIFORM_VEC4, command);
+    }
+
+    void SetMat4(GLint location, const glm::mat4 &value)
+    {
+        UniformFloats<16> command;
+        command.location = location;
+        std::memcpy(command.values, &value[0][0], sizeof(command.values));
+        push(CMD_UNIFORM_MAT4, command);
+    }
+
+    // binds a range of a buffer (e.g. a StreamBuffer section) to a uniform block binding point
+    void BindUniformBlockRange(GLuint binding, GLuint buffer, GLintptr offset, GLsizeiptr size)
+    {
+        BufferRange command = { binding, buffer, (int64_t)offset, (int64_t)size };
+        push(CMD_UNIFORM_BLOCK_RANGE, command);
+    }
+
+    // instances [0, instanceCount) of the matrices at instanceOffset in instanceBuffer
+    void DrawArraysInstanced(GLuint vao, GLenum mode, int vertexCount, int instanceCount, GLuint instanceBuffer, GLintptr instanceOffset)
+    {
+        if (instanceCount <= 0)
+            return;
+        DrawInstanced command = { vao, mode, vertexCount, instanceCount, instanceBuffer, (int64_t)instanceOffset };
+        push(CMD_DRAW_ARRAYS_INSTANCED, command);
+    }
+
+    // like DrawArraysInstanced(), with the matrices copied into the list and uploaded to the stream buffer on replay.
+    // if the stream buffer is full the fallback instances (fallbackCount matrices at fallbackOffset) are drawn instead
+    void DrawArraysInstancedStreamed(GLuint vao, GLenum mode, int vertexCount, const glm::mat4* transforms, int instanceCount,
+                                     GLuint fallbackBuffer, int fallbackCount, GLintptr fallbackOffset = 0)
+    {
+        if (instanceCount <= 0)
+            return;
+        DrawStreamed command = { vao, mode, vertexCount, instanceCount, fallbackBuffer, fallbackCount, (int64_t)fallbackOffset };
+        push(CMD_DRAW_ARRAYS_INSTANCED_STREAMED, command, transforms, instanceCount * sizeof(glm::mat4));
+    }
+
+    // indexed draw out of a shared vertex and index buffer, e.g. a GeometryArena allocation
+    void DrawElementsBaseVertex(GLuint vao, GLenum mode, int indexCount, GLintptr indexOffset, GLint baseVertex)
+    {
+        DrawElements command = { vao, mode, indexCount, baseVertex, (int64_t)indexOffset };
+        push(CMD_DRAW_ELEMENTS_BASE_VERTEX, command);
+    }
+
+    // playback, on the GL thread
+    // ------------------------------------------------------------------------
+    void Replay(StreamBuffer &stream) const
+    {
+        size_t at = 0;
+        while (at < bytes.size())
+        {
+            Header header = read<Header>(at);
+            size_t payload = at + sizeof(Header);
+            switch (header.op)
+            {
+            case CMD_USE_PROGRAM:
+                glState.UseProgram(read<Name>(payload).value);
+                break;
+            case CMD_BIND_TEXTURE:
+            {
+                TextureCommand command = read<TextureCommand>(payload);
+                glState.BindTexture(command.unit, command.target, command.texture);
+                break;
+            }
+            case CMD_BIND_FRAMEBUFFER:
+                glState.BindFramebuffer(read<Name>(payload).value);
+                break;
+            case CMD_FRAMEBUFFER_DEPTH_LAYER:
+            {
+                LayerCommand command = read<LayerCommand>(payload);
+                glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, command.texture, 0, command.layer);
+                break;
+            }
+            case CMD_SET_ENABLED:
+            {
+                Pair command = read<Pair>(payload);
+                glState.SetEnabled(command.first, command.second != 0);
+                break;
+            }
+            case CMD_DEPTH_FUNC:
+                glState.DepthFunc(read<Name>(payload).value);
+                break;
+            case CMD_BLEND_FUNC:
+            {
+                Pair command = read<Pair>(payload);
+                glState.BlendFunc(command.first, command.second);
+                break;
+            }
+            case CMD_VIEWPORT:
+            {
+                Rect command = read<Rect>(payload);
+                glState.Viewport(command.x, command.y, command.width, command.height);
+                break;
+            }
+            case CMD_SCISSOR:
+            {
+                Rect command = read<Rect>(payload);
+                glState.Scissor(command.x, command.y, command.width, command.height);
+                break;
+            }
+            case CMD_CLEAR:
+                glClear(read<Name>(payload).value);
+                break;
+            case CMD_CLEAR_COLOR_BUFFER:
+            {
+                ClearBufferCommand command = read<ClearBufferCommand>(payload);
+                glClearBufferfv(GL_COLOR, command.drawBuffer, command.values);
+                break;
+            }
+            case CMD_UNIFORM_INT:
+            {
+                UniformInt command = read<UniformInt>(payload);
+                glUniform1i(command.location, command.value);
+                break;
+            }
+            case CMD_UNIFORM_FLOAT:
+            {
+                UniformFloats<1> command = read<UniformFloats<1> >(payload);
+                glUniform1f(command.location, command.values[0]);
+                break;
+            }
+            case CMD_UNIFORM_VEC2:
+            {
+                UniformFloats<2> command = read<UniformFloats<2> >(payload);
+                glUniform2fv(command.location, 1, command.values);
+                break;
+            }
+            case CMD_UNIFORM_VEC3:
+            {
+                UniformFloats<3> command = read<UniformFloats<3> >(payload);
+                glUniform3fv(command.location, 1, command.values);
+                break;
+            }
+            case CMD_UNIFORM_VEC4:
+            {
+                UniformFloats<4> command = read<UniformFloats<4> >(payload);
+                glUniform4fv(command.location, 1, command.values);
+                break;
+            }
+            case CMD_UNIFORM_MAT4:
+            {
+                UniformFloats<16> command = read<UniformFloats<16> >(payload);
+                glUniformMatrix4fv(command.location, 1, GL_FALSE, command.values);
+                break;
+            }
+            case CMD_UNIFORM_BLOCK_RANGE:
+            {
+                BufferRange command = read<BufferRange>(payload);
+                glBindBufferRange(GL_UNIFORM_BUFFER, command.binding, command.buffer, (GLintptr)command.offset, (GLsizeiptr)command.size);
+                break;
+            }
+            case CMD_DRAW_ARRAYS_INSTANCED:
+            {
+                DrawInstanced command = read<DrawInstanced>(payload);
+                drawInstances(command.vao, command.mode, command.vertexCount, command.instanceCount, command.instanceBuffer, (GLintptr)command.instanceOffset);
+                break;
+            }
+            case CMD_DRAW_ARRAYS_INSTANCED_STREAMED:
+            {
+                DrawStreamed command = read<DrawStreamed>(payload);
+                const unsigned char* transforms = &bytes[payload + sizeof(DrawStreamed)];
+                GLintptr offset = stream.Upload(transforms, command.instanceCount * sizeof(glm::mat4));
+                if (offset < 0)
+                    drawInstances(command.vao, command.mode, command.vertexCount, command.fallbackCount, command.fallbackBuffer, (GLintptr)command.fallbackOffset);
+                else
+                    drawInstances(command.vao, command.mode, command.vertexCount, command.instanceCount, stream.Buffer(), offset);
+                break;
+            }
+            case CMD_DRAW_ELEMENTS_BASE_VERTEX:
+            {
+                DrawElements command = read<DrawElements>(payload);
+                glState.BindVertexArray(command.vao);
+                glDrawElementsBaseVertex(command.mode, command.indexCount, GL_UNSIGNED_INT, (void*)(intptr_t)command.indexOffset, command.baseVertex);
+                break;
+            }
+            }
+            at += header.size;
+        }
+    }
+
+private:
+    enum Opcode : uint32_t
+    {
+        CMD_USE_PROGRAM,
+        CMD_BIND_TEXTURE,
+        CMD_BIND_FRAMEBUFFER,
+        CMD_FRAMEBUFFER_DEPTH_LAYER,
+        CMD_SET_ENABLED,
+        CMD_DEPTH_FUNC,
+        CMD_BLEND_FUNC,
+        CMD_VIEWPORT,
+        CMD_SCISSOR,
+        CMD_CLEAR,
+        CMD_CLEAR_COLOR_BUFFER,
+        CMD_UNIFORM_INT,
+        CMD_UNIFORM_FLOAT,
+        CMD_UNIFORM_VEC2,
+        CMD_UNIFORM_VEC3,
+        CMD_UNIFORM_VEC4,
+        CMD_UNIFORM_MAT4,
+        CMD_UNIFORM_BLOCK_RANGE,
+        CMD_DRAW_ARRAYS_INSTANCED,
+        CMD_DRAW_ARRAYS_INSTANCED_STREAMED,
+        CMD_DRAW_ELEMENTS_BASE_VERTEX
+    };
+
+    struct Header
+    {
+        uint32_t op;
+        uint32_t size; // of the whole command, header and inline data included
+    };
+
+    // payloads
+    struct Name { uint32_t value; };
+    struct Pair { uint32_t first, second; };
+    struct Rect { int32_t x, y, width, height; };
+    struct TextureCommand { uint32_t unit, target, texture; };
+    struct LayerCommand { uint32_t texture; int32_t layer; };
+    struct ClearBufferCommand { int32_t drawBuffer; float values[4]; };
+    struct UniformInt { int32_t location, value; };
+    template <int N> struct UniformFloats { int32_t location; float values[N]; };
+    struct BufferRange { uint32_t binding, buffer; int64_t offset, size; };
+    struct DrawInstanced { uint32_t vao, mode; int32_t vertexCount, instanceCount; uint32_t instanceBuffer; int64_t instanceOffset; };
+    struct DrawStreamed { uint32_t vao, mode; int32_t vertexCount, instanceCount; uint32_t fallbackBuffer; int32_t fallbackCount; int64_t fallbackOffset; };
+    struct DrawElements { uint32_t vao, mode; int32_t indexCount, baseVertex; int64_t indexOffset; };
+
+    std::vector<unsigned char> bytes;
+    int commandCount = 0;
+
+    template <typename T>
+    void push(Opcode op, const T &command, const void* data = nullptr, size_t dataSize = 0)
+    {
+        Header header = { (uint32_t)op, (uint32_t)(sizeof(Header) + sizeof(T) + dataSize) };
+        size_t at = bytes.size();
+        bytes.resize(at + header.size);
+        std::memcpy(&bytes[at], &header, sizeof(Header));
+        std::memcpy(&bytes[at + sizeof(Header)], &command, sizeof(T));
+        if (dataSize > 0)
+            std::memcpy(&bytes[at + sizeof(Header) + sizeof(T)], data, dataSize);
+        commandCount++;
+    }
+
+    // commands follow each other without alignment, so they are copied out instead of cast in place
+    template <typename T>
+    T read(size_t at) const
+    {
+        T value;
+        std::memcpy(&value, &bytes[at], sizeof(T));
+        return value;
+    }
+
+    // there is no base instance in OpenGL 3.3, so the instance attributes are pointed at the first instance instead
+    static void drawInstances(GLuint vao, GLenum mode, int vertexCount, int instanceCount, GLuint buffer, GLintptr offset)
+    {
+        glState.InstanceMatrices(vao, INSTANCE_ATTRIBUTE, buffer, offset);
+        glDrawArraysInstanced(mode, 0, vertexCount, instanceCount);
+    }
+};
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef COMPONENTS_H
+#define COMPONENTS_H
+
+#include <glm/glm.hpp>
+
+class Model;
+
+// components of the renderable entities, see ecs.h
+
+// placement, the world matrix is copied from the scene graph node when the node moves
+struct TransformComponent
+{
+    int node;
+    glm::mat4 world;
+};
+
+// bounding sphere, local to the node and in world space
+struct BoundsComponent
+{
+    glm::vec3 localCenter;
+    float localRadius;
+    glm::vec3 center;
+    float radius;
+};
+
+// a mesh of a loaded model
+struct MeshComponent
+{
+    Model* model;
+    int mesh;
+};
+
+// the textures of a material, 0 when not used
+struct MaterialComponent
+{
+    unsigned int diffuse;
+    unsigned int normal;
+    unsigned int translucency;
+    unsigned int roughness;
+    unsigned int opacity; // single channel, only used by the shadow caster pass
+};
+
+// slot in the per-instance transforms of an instanced draw
+struct InstanceComponent
+{
+    int instance;
+};
+
+// world bounds of a sphere placed by the matrix, the radius grows with the largest axis scale
+inline void UpdateWorldBounds(BoundsComponent &bounds, const glm::mat4 &world)
+{
+    bounds.center = glm::vec3(world * glm::vec4(bounds.localCenter, 1.0f));
+    float scale = glm::max(glm::length(glm::vec3(world[0])), glm::max(glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2]))));
+    bounds.radius = bounds.localRadius * scale;
+}
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef DENSITY_LOD_H
+#define DENSITY_LOD_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Density level of detail of the leaves: past startDistance the leaves are thinned out, so the number of
+// leaves drawn falls with their size on screen instead of staying flat. Every leaf gets a random rank
+// in [0, 1) when it is scattered, a hash of its index so it does not change from run to run. At a
+// distance with a density d the leaves of rank below d are kept, the ones up to d + fadeBand dissolve
+// with a dither, and the others are not drawn. The leaves that are drawn grow by 1 / sqrt of the share
+// drawn, so the foliage keeps about the same coverage.
+// The dissolve of a leaf travels in the bottom row of its instance matrix (always 0 for an affine
+// matrix), see common_shading.vert.
+class DensityLod
+{
+public:
+    bool enabled = true;
+    float startDistance = 10.0f; // full density closer than this
+    float minDensity = 0.05f;    // share of the leaves kept at any distance
+    float fadeBand = 0.05f;      // ranks over which a leaf dissolves
+
+    std::vector<float> ranks;  // of every leaf
+    std::vector<float> scales; // size of every leaf in the last Thin(), 1 when it was not drawn
+
+    // the result of the last frame, filled by the caller
+    int drawn = 0, fading = 0;
+
+    // ranks of the leaves 0 to count - 1
+    void Scatter(int count)
+    {
+        ranks.resize(count);
+        scales.assign(count, 1.0f);
+        for (int i = 0; i < count; i++)
+            ranks[i] = Rank((uint32_t)i);
+    }
+
+    // share of the leaves kept, fading ones excluded, at a distance from the camera. The size of a leaf on
+    // screen falls with the square of the distance, so does the density
+    float Density(float distance) const
+    {
+        if (!enabled || distance <= startDistance)
+            return 1.0f;
+        float ratio = startDistance / distance;
+        return std::max(minDensity, ratio * ratio);
+    }
+
+    // the matrix drawn for the leaf instance at a distance from the camera, false when it is not drawn
+    bool Thin(int instance, const glm::mat4 &model, float distance, glm::mat4 &drawnModel)
+    {
+        float density = Density(distance);
+        float visibility = density >= 1.0f ? 1.0f : glm::clamp((density + fadeBand - ranks[instance]) / fadeBand, 0.0f, 1.0f);
+        scales[instance] = 1.0f;
+        if (visibility <= 0.0f)
+            return false;
+
+        // about half of the fade band is still on screen
+        float scale = 1.0f / std::sqrt(std::min(1.0f, density + 0.5f * fadeBand));
+        scales[instance] = scale;
+        drawnModel = model;
+        drawnModel[0] *= scale;
+        drawnModel[1] *= scale;
+        drawnModel[0][3] = 1.0f - visibility; // dissolve
+        return true;
+    }
+
+    float ScaleOf(int instance) const
+    {
+        return instance < (int)scales.size() ? scales[instance] : 1.0f;
+    }
+
+    // uniform in [0, 1), the lowbias32 integer hash
+    static float Rank(uint32_t index)
+    {
+        uint32_t x = index + 0x9E3779B9u;
+        x ^= x >> 16;
+        x *= 0x7FEB352Du;
+        x ^= x >> 15;
+        x *= 0x846CA68Bu;
+        x ^= x >> 16;
+        return (float)(x >> 8) * (1.0f / 16777216.0f);
+    }
+};
+
+#endif
@@ -0,0 +1,166 @@
+#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+
+#include <glad/glad.h>
+
+#include "gl_state.h"
+#include "profiler.h"
+#include "shader.h"
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Draws the scene into an offscreen target at a fraction of the output size, and scales it up to the
+// output with a contrast adaptive sharpening filter before the GUI is drawn on top.
+// The scale follows the GPU time of the frames measured by the profiler: the time of the passes drawn at
+// the render size is taken as proportional to its pixel count, which gives the scale that would have met
+// the target with the time of the other passes (shadows, upscale, GUI) on top, and the scale moves a part
+// of the way there every frame. The measured frames are a few frames old (the GPU
+// timer queries are read late), so the scale each frame was drawn at is remembered until its time arrives.
+// The target is allocated at the output size and the scaled frame uses its lower left part, so changing
+// the scale never reallocates anything.
+class DynamicResolution
+{
+public:
+    bool enabled = false;
+    float targetMilliseconds = 16.0f; // GPU time per frame to hold
+    float minScale = 0.5f;            // of each axis
+    float maxScale = 1.0f;
+    float sharpness = 0.5f;           // of the upscale filter, 0 to 1
+    // GPU scopes (prefixes) whose time does not depend on the render size, they are left out of the scaling
+    std::vector<const char*> fixedCostScopes = { "shadow map", "shadow atlas", "upscale", "gui" };
+
+    // the scale the next frame is drawn at, of each axis
+    float Scale() const { return scale; }
+    // the last GPU time the scale was adjusted with, and the part of it in fixedCostScopes
+    float MeasuredMilliseconds() const { return measuredMilliseconds; }
+    float FixedMilliseconds() const { return fixedMilliseconds; }
+
+    // adjusts the scale with the newest frame the profiler has the GPU time of, once per frame
+    void Update(const Profiler &profiler)
+    {
+        uint64_t current = profiler.CurrentFrame();
+        // the frames before a pause (scaling off, the profiler not recording) were not drawn at the remembered scale
+        if (current != lastUpdateFrame + 1)
+            firstScaledFrame = current;
+        lastUpdateFrame = current;
+        frameScales[current % SCALE_HISTORY] = scale;
+
+        const ProfileFrame* frame = profiler.LatestResolvedFrame();
+        if (!frame || !frame->gpuResolved || frame->index < firstScaledFrame || frame->index <= lastMeasuredFrame
+            || frame->gpuDuration <= 0.0)
+            return;
+        lastMeasuredFrame = frame->index;
+        measuredMilliseconds = (float)(frame->gpuDuration / 1000.0);
+        double fixed = 0.0;
+        for (const char* scope : fixedCostScopes)
+            fixed += frame->GpuTime(scope);
+        fixedMilliseconds = (float)(fixed / 1000.0);
+        float scaledMilliseconds = measuredMilliseconds - fixedMilliseconds;
+        if (scaledMilliseconds <= 0.0f)
+            return;
+
+        // within a few percent of the target is good enough, chasing the noise would make the image pump.
+        // when the fixed passes alone take the whole budget the scale goes down to minScale
+        float ratio = std::fmax(targetMilliseconds - fixedMilliseconds, 0.0f) / scaledMilliseconds;
+        if (std::fabs(ratio - 1.0f) < 0.05f)
+            return;
+        float drawnScale = frameScales[frame->index % SCALE_HISTORY];
+        float wanted = drawnScale * std::sqrt(ratio);
+        float next = scale + (wanted - scale) * 0.25f;
+        next = std::floor(next * 100.0f + 0.5f) / 100.0f; // whole percents, so the size changes less often
+        scale = std::fmin(std::fmax(next, minScale), maxScale);
+    }
+
+    // the target at the size of the output, call when the output may have been resized
+    void Resize(int width, int height)
+    {
+        if (framebuffer != 0 && outputWidth == width && outputHeight == height)
+            return;
+        release();
+        outputWidth = width;
+        outputHeight = height;
+
+        // sRGB like the window, the shaders write linear colors with GL_FRAMEBUFFER_SRGB enabled
+        glGenTextures(1, &colorTexture);
+        glState.BindTexture(0, GL_TEXTURE_2D, colorTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8_ALPHA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        glGenRenderbuffers(1, &depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+        glGenFramebuffers(1, &framebuffer);
+        glState.BindFramebuffer(framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::DYNAMIC_RESOLUTION:: the scaled framebuffer is not complete" << std::endl;
+
+        if (!upscaleShader)
+            upscaleShader.reset(new Shader("shaders/fullscreen.vert", "shaders/upscale.frag"));
+        if (emptyVAO == 0)
+            glGenVertexArrays(1, &emptyVAO);
+    }
+
+    GLuint Framebuffer() const { return framebuffer; }
+
+    // the size the scene is drawn at this frame
+    int Width() const { return scaledSize(outputWidth); }
+    int Height() const { return scaledSize(outputHeight); }
+
+    // draws the scaled frame over the whole viewport of the bound framebuffer
+    void Upscale()
+    {
+        glState.SetEnabled(GL_DEPTH_TEST, false);
+        glState.SetEnabled(GL_BLEND, false);
+        glState.SetEnabled(GL_SCISSOR_TEST, false);
+        upscaleShader->use();
+        upscaleShader->setInt("scene", 0);
+        // the part of the texture that was drawn, and the size of one of its texels
+        upscaleShader->setVec2("region", (float)Width() / outputWidth, (float)Height() / outputHeight);
+        upscaleShader->setVec2("texelSize", 1.0f / outputWidth, 1.0f / outputHeight);
+        upscaleShader->setFloat("sharpness", sharpness);
+        glState.BindTexture(0, GL_TEXTURE_2D, colorTexture);
+        glState.BindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+
+private:
+    static const int SCALE_HISTORY = 16; // longer than the latency of the GPU timings (Profiler::QUERY_LATENCY)
+
+    float scale = 1.0f;
+    float frameScales[SCALE_HISTORY] = {};
+    uint64_t lastUpdateFrame = 0, firstScaledFrame = 0, lastMeasuredFrame = 0;
+    float measuredMilliseconds = 0.0f, fixedMilliseconds = 0.0f;
+
+    int outputWidth = 0, outputHeight = 0;
+    GLuint framebuffer = 0, colorTexture = 0, depthBuffer = 0, emptyVAO = 0;
+    std::unique_ptr<Shader> upscaleShader;
+
+    int scaledSize(int size) const
+    {
+        int scaled = (int)(size * scale + 0.5f);
+        return scaled < 1 ? 1 : (scaled > size ? size : scaled);
+    }
+
+    void release()
+    {
+        if (framebuffer == 0)
+            return;
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteTextures(1, &colorTexture);
+        glDeleteRenderbuffers(1, &depthBuffer);
+        framebuffer = 0;
+        // the deleted objects were bound, the next names may be the same
+        glState.Invalidate();
+    }
+};
+
+#endif
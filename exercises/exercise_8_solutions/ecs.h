@@ -0,0 +1,294 @@
+#ifndef ECS_H
+#define ECS_H
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// handle to an entity. The generation tells a destroyed entity apart from a new one that reuses its index
+struct Entity
+{
+    uint32_t index = UINT32_MAX;
+    uint32_t generation = 0;
+
+    bool operator==(const Entity &other) const { return index == other.index && generation == other.generation; }
+    bool operator!=(const Entity &other) const { return !(*this == other); }
+};
+
+// Entities grouped by archetype: all the entities with the same set of component types live together,
+// in chunks of CHUNK_BYTES where every component type has its own array (structure of arrays).
+// A system asks for the component types it reads, and gets each matching chunk as plain arrays, so
+// it walks memory linearly instead of chasing pointers, and the chunks can be split between jobs.
+// Components must be plain structs (trivially copyable): rows are moved with memcpy when entities are destroyed.
+// Creating or destroying entities while a system iterates over the chunks is not allowed.
+class EntityStore
+{
+public:
+    static const int MAX_COMPONENTS = 32;
+    static const size_t CHUNK_BYTES = 16 * 1024;
+
+    class Archetype;
+
+    // one chunk of an archetype, handed to the systems
+    struct Chunk
+    {
+        Archetype* archetype;
+        int count;
+        Entity* entities;
+        unsigned char* data;
+    };
+
+    class Archetype
+    {
+    public:
+        uint32_t Mask() const { return mask; }
+        int ChunkCapacity() const { return capacity; }
+        int EntityCount() const { return entityCount; }
+        int ChunkCount() const { return (int)chunks.size(); }
+
+    private:
+        friend class EntityStore;
+        uint32_t mask = 0;
+        int capacity = 0;
+        int entityCount = 0;
+        size_t sizes[MAX_COMPONENTS] = {};
+        size_t offsets[MAX_COMPONENTS] = {}; // of each component array in a chunk
+        size_t entityOffset = 0;
+        size_t chunkBytes = 0;
+        std::vector<std::unique_ptr<unsigned char[]>> storage;
+        std::vector<Chunk> chunks;
+    };
+
+    // the id of a component type, assigned the first time the type is used
+    template <typename T>
+    static int ComponentId()
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "components are moved with memcpy");
+        static const int id = nextComponentId()++;
+        return id;
+    }
+
+    template <typename... Ts>
+    static uint32_t MaskOf()
+    {
+        uint32_t mask = 0;
+        int ids[] = { ComponentId<Ts>()... };
+        for (int id : ids)
+            mask |= 1u << id;
+        return mask;
+    }
+
+    // adds an entity with the given components
+    template <typename... Ts>
+    Entity Create(const Ts&... components)
+    {
+        size_t sizes[] = { sizeof(Ts)... };
+        int ids[] = { ComponentId<Ts>()... };
+        Archetype* archetype = findArchetype(MaskOf<Ts...>(), ids, sizes, (int)sizeof...(Ts));
+
+        Entity entity = allocateEntity();
+        Record &record = records[entity.index];
+        record.archetype = archetype;
+        record.row = archetype->entityCount;
+        Chunk &chunk = appendRow(*archetype);
+        chunk.entities[chunk.count - 1] = entity;
+
+        const void* values[] = { &components... };
+        for (int i = 0; i < (int)sizeof...(Ts); i++)
+            std::memcpy(chunk.data + archetype->offsets[ids[i]] + (chunk.count - 1) * sizes[i], values[i], sizes[i]);
+        return entity;
+    }
+
+    // removes the entity, the last entity of its archetype takes its place
+    void Destroy(Entity entity)
+    {
+        if (!Alive(entity))
+            return;
+        Record &record = records[entity.index];
+        Archetype &archetype = *record.archetype;
+        int row = record.row;
+        int last = archetype.entityCount - 1;
+        Chunk &to = archetype.chunks[row / archetype.capacity];
+        Chunk &from = archetype.chunks[last / archetype.capacity];
+        int toRow = row % archetype.capacity, fromRow = last % archetype.capacity;
+        if (row != last)
+        {
+            for (int id = 0; id < MAX_COMPONENTS; id++)
+            {
+                if (!(archetype.mask & (1u << id)))
+                    continue;
+                size_t size = archetype.sizes[id];
+                std::memcpy(to.data + archetype.offsets[id] + toRow * size, from.data + archetype.offsets[id] + fromRow * size, size);
+            }
+            Entity moved = from.entities[fromRow];
+            to.entities[toRow] = moved;
+            records[moved.index].row = row;
+        }
+        from.count--;
+        archetype.entityCount--;
+        if (from.count == 0)
+        {
+            archetype.chunks.pop_back();
+            archetype.storage.pop_back();
+        }
+
+        record.archetype = nullptr;
+        record.generation++;
+        freeIndices.push_back(entity.index);
+        liveEntities--;
+    }
+
+    bool Alive(Entity entity) const
+    {
+        return entity.index < records.size() && records[entity.index].archetype != nullptr
+            && records[entity.index].generation == entity.generation;
+    }
+
+    // the component of the entity, nullptr if it does not have one
+    template <typename T>
+    T* Get(Entity entity)
+    {
+        if (!Alive(entity))
+            return nullptr;
+        const Record &record = records[entity.index];
+        int id = ComponentId<T>();
+        if (!(record.archetype->mask & (1u << id)))
+            return nullptr;
+        Chunk &chunk = record.archetype->chunks[record.row / record.archetype->capacity];
+        return Column<T>(chunk) + record.row % record.archetype->capacity;
+    }
+
+    // the array of a component in a chunk, the archetype must have it
+    template <typename T>
+    static T* Column(const Chunk &chunk)
+    {
+        return reinterpret_cast<T*>(chunk.data + chunk.archetype->offsets[ComponentId<T>()]);
+    }
+
+    // the chunks of every archetype that has all of the component types, for splitting the work between jobs
+    template <typename... Ts>
+    void CollectChunks(std::vector<Chunk> &result) const
+    {
+        result.clear();
+        uint32_t mask = MaskOf<Ts...>();
+        for (const std::unique_ptr<Archetype> &archetype : archetypes)
+            if ((archetype->mask & mask) == mask)
+                result.insert(result.end(), archetype->chunks.begin(), archetype->chunks.end());
+    }
+
+    // calls function(count, Ts* ...) with the component arrays of every matching chunk.
+    // entities keep their creation order within an archetype until one of them is destroyed
+    template <typename... Ts, typename Function>
+    void ForEach(Function function)
+    {
+        uint32_t mask = MaskOf<Ts...>();
+        for (std::unique_ptr<Archetype> &archetype : archetypes)
+        {
+            if ((archetype->mask & mask) != mask)
+                continue;
+            for (Chunk &chunk : archetype->chunks)
+                function(chunk.count, Column<Ts>(chunk)...);
+        }
+    }
+
+    int EntityCount() const { return liveEntities; }
+    int ArchetypeCount() const { return (int)archetypes.size(); }
+    const Archetype& GetArchetype(int i) const { return *archetypes[i]; }
+
+private:
+    struct Record
+    {
+        Archetype* archetype = nullptr;
+        int row = 0;
+        uint32_t generation = 0;
+    };
+
+    std::vector<std::unique_ptr<Archetype>> archetypes;
+    std::vector<Record> records;
+    std::vector<uint32_t> freeIndices;
+    int liveEntities = 0;
+
+    static int& nextComponentId()
+    {
+        static int next = 0;
+        return next;
+    }
+
+    Entity allocateEntity()
+    {
+        Entity entity;
+        if (!freeIndices.empty())
+        {
+            entity.index = freeIndices.back();
+            freeIndices.pop_back();
+        }
+        else
+        {
+            entity.index = (uint32_t)records.size();
+            records.emplace_back();
+        }
+        entity.generation = records[entity.index].generation;
+        liveEntities++;
+        return entity;
+    }
+
+    Archetype* findArchetype(uint32_t mask, const int* ids, const size_t* sizes, int count)
+    {
+        for (std::unique_ptr<Archetype> &archetype : archetypes)
+            if (archetype->mask == mask)
+                return archetype.get();
+
+        std::unique_ptr<Archetype> archetype(new Archetype());
+        archetype->mask = mask;
+        size_t rowBytes = sizeof(Entity);
+        for (int i = 0; i < count; i++)
+        {
+            archetype->sizes[ids[i]] = sizes[i];
+            rowBytes += sizes[i];
+        }
+
+        // every array starts 16 byte aligned, leave room for the padding
+        const size_t alignment = 16;
+        archetype->capacity = (int)((CHUNK_BYTES - alignment * (count + 1)) / rowBytes);
+        if (archetype->capacity < 1)
+            archetype->capacity = 1;
+        size_t offset = 0;
+        archetype->entityOffset = offset;
+        offset += ((sizeof(Entity) * archetype->capacity + alignment - 1) & ~(alignment - 1));
+        for (int id = 0; id < MAX_COMPONENTS; id++)
+        {
+            if (!(mask & (1u << id)))
+                continue;
+            archetype->offsets[id] = offset;
+            offset += ((archetype->sizes[id] * archetype->capacity + alignment - 1) & ~(alignment - 1));
+        }
+        archetype->chunkBytes = offset;
+        archetypes.push_back(std::move(archetype));
+        return archetypes.back().get();
+    }
+
+    // the chunk the new last row of the archetype is in
+    Chunk& appendRow(Archetype &archetype)
+    {
+        if (archetype.chunks.empty() || archetype.chunks.back().count == archetype.capacity)
+        {
+            archetype.storage.emplace_back(new unsigned char[archetype.chunkBytes + 15]);
+            unsigned char* base = archetype.storage.back().get();
+            base = reinterpret_cast<unsigned char*>((reinterpret_cast<uintptr_t>(base) + 15) & ~(uintptr_t)15);
+            Chunk chunk;
+            chunk.archetype = &archetype;
+            chunk.count = 0;
+            chunk.entities = reinterpret_cast<Entity*>(base + archetype.entityOffset);
+            chunk.data = base;
+            archetype.chunks.push_back(chunk);
+        }
+        archetype.entityCount++;
+        Chunk &chunk = archetype.chunks.back();
+        chunk.count++;
+        return chunk;
+    }
+};
+
+#endif
@@ -0,0 +1,518 @@
+#ifndef ENVIRONMENT_BAKE_H
+#define ENVIRONMENT_BAKE_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include "job_system.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define ENVIRONMENT_BAKE_SSE
+#endif
+
+// a face of the sky as loaded, 8 bit sRGB rows, in the order of GL_TEXTURE_CUBE_MAP_POSITIVE_X + i
+struct CubemapFace
+{
+    int size = 0;
+    int components = 0;
+    std::vector<unsigned char> pixels;
+};
+
+// The image based lighting of the sky, baked on the CPU from the faces of the skybox:
+// - the irradiance as 9 spherical harmonics coefficients, already convolved with the cosine lobe
+//   (Ramamoorthi and Hanrahan 2001), so the shaders evaluate it with a few multiply adds out of a
+//   uniform block instead of sampling a blurred mip of the sky
+// - a cubemap whose mip i is the sky convolved with the GGX lobe of roughness i / (LEVELS - 1), with
+//   N = V = R like the split sum approximation (Karis 2013). The lobe is importance sampled and each
+//   sample reads the mip of the sky that matches its solid angle (filtered importance sampling), which
+//   keeps the noise away with a fixed number of samples.
+// The projection works on 4 texels at a time with SSE, the convolution runs a row of a face per job.
+// Both only depend on the faces and the constants below, so the result is written to a cache file keyed
+// by a hash of them and the next start loads it instead of baking.
+class EnvironmentBaker
+{
+public:
+    static const int SH_COUNT = 9;
+    static const int SIZE = 256;    // of mip 0 of the prefiltered cubemap
+    static const int LEVELS = 6;    // roughness 0, 0.2, ... 1, the shaders read mip roughness * (LEVELS - 1)
+    static const int SAMPLES = 128; // GGX samples per texel
+
+    // E(n) = sum of irradiance[i] * Y_i(n), Y_i the real spherical harmonics up to band 2
+    glm::vec3 irradiance[SH_COUNT];
+    // half float RGB, the 6 faces of each mip one after the other
+    std::vector<uint16_t> levels[LEVELS];
+    bool fromCache = false;
+    double milliseconds = 0.0; // baking or loading
+
+    static int LevelSize(int level) { return SIZE >> level; }
+
+    // bakes the faces, or loads them from cachePath when it has them. False if the faces are not a cubemap
+    bool Bake(const std::vector<CubemapFace> &faces, JobSystem &jobs, const std::string &cachePath)
+    {
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        if (faces.size() != 6)
+            return false;
+        for (const CubemapFace &face : faces)
+            if (face.size <= 0 || face.components < 3 || face.size != faces[0].size
+                || face.pixels.size() != (size_t)face.size * face.size * face.components)
+                return false;
+
+        uint64_t hash = hashFaces(faces);
+        fromCache = load(cachePath, hash);
+        if (!fromCache)
+        {
+            buildSource(faces, jobs);
+            projectIrradiance(jobs);
+            prefilter(jobs);
+            save(cachePath, hash);
+            source.clear();
+        }
+        milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        return true;
+    }
+
+    // direction through the center of texel (s, t) of a face of the given size, not normalized
+    static glm::vec3 TexelDirection(int face, int size, float s, float t)
+    {
+        float sc = 2.0f * (s + 0.5f) / (float)size - 1.0f;
+        float tc = 2.0f * (t + 0.5f) / (float)size - 1.0f;
+        const glm::vec3* axes = FACE_AXES[face];
+        return axes[0] + axes[1] * sc + axes[2] * tc;
+    }
+
+private:
+    // the cubemap layout of the GL spec: the direction of face i is major + sc * sAxis + tc * tAxis
+    static const glm::vec3 FACE_AXES[6][3];
+
+    // the sky in linear RGB floats, mip 0 at the size of the faces down to 1 texel
+    struct SourceLevel
+    {
+        int size;
+        std::vector<float> faces[6];
+    };
+    std::vector<SourceLevel> source;
+
+    // one GGX sample of a roughness, in the tangent space of N = V
+    struct LobeSample
+    {
+        glm::vec3 direction;
+        float weight; // N.L
+        float lod;    // mip of the sky with the solid angle of the sample
+    };
+
+    static float srgbToLinear(unsigned char value)
+    {
+        float c = value / 255.0f;
+        return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+
+    // FNV-1a of the faces and the settings, the key of the cache
+    static uint64_t hashFaces(const std::vector<CubemapFace> &faces)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        auto add = [&hash](const void* data, size_t size) {
+            const unsigned char* bytes = (const unsigned char*)data;
+            for (size_t i = 0; i < size; i++)
+                hash = (hash ^ bytes[i]) * 1099511628211ull;
+        };
+        int settings[] = { SIZE, LEVELS, SAMPLES, faces[0].size, faces[0].components };
+        add(settings, sizeof(settings));
+        for (const CubemapFace &face : faces)
+            add(face.pixels.data(), face.pixels.size());
+        return hash;
+    }
+
+    // decodes the faces to linear floats and box filters them down to 1 texel
+    void buildSource(const std::vector<CubemapFace> &faces, JobSystem &jobs)
+    {
+        float linear[256];
+        for (int i = 0; i < 256; i++)
+            linear[i] = srgbToLinear((unsigned char)i);
+
+        int size = faces[0].size;
+        source.clear();
+        source.push_back(SourceLevel());
+        source[0].size = size;
+        JobCounter decoded;
+        for (int f = 0; f < 6; f++)
+        {
+            jobs.Run("decode sky face", [this, &faces, &linear, f, size]() {
+                const CubemapFace &face = faces[f];
+                std::vector<float> &texels = source[0].faces[f];
+                texels.resize((size_t)size * size * 3);
+                for (size_t i = 0, count = (size_t)size * size; i < count; i++)
+                    for (int c = 0; c < 3; c++)
+                        texels[i * 3 + c] = linear[face.pixels[i * face.components + c]];
+            }, &decoded);
+        }
+        jobs.Wait(decoded);
+
+        while (size > 1)
+        {
+            const SourceLevel &parent = source.back();
+            SourceLevel level;
+            level.size = size / 2;
+            for (int f = 0; f < 6; f++)
+            {
+                level.faces[f].resize((size_t)level.size * level.size * 3);
+                for (int t = 0; t < level.size; t++)
+                    for (int s = 0; s < level.size; s++)
+                        for (int c = 0; c < 3; c++)
+                        {
+                            const std::vector<float> &p = parent.faces[f];
+                            size_t row0 = ((size_t)(2 * t) * size + 2 * s) * 3 + c, row1 = row0 + (size_t)size * 3;
+                            level.faces[f][((size_t)t * level.size + s) * 3 + c] = 0.25f * (p[row0] + p[row0 + 3] + p[row1] + p[row1 + 3]);
+                        }
+            }
+            source.push_back(level);
+            size = level.size;
+        }
+    }
+
+    // the 9 basis functions at a unit direction
+    static void shBasis(const glm::vec3 &d, float y[SH_COUNT])
+    {
+        y[0] = 0.282095f;
+        y[1] = 0.488603f * d.y;
+        y[2] = 0.488603f * d.z;
+        y[3] = 0.488603f * d.x;
+        y[4] = 1.092548f * d.x * d.y;
+        y[5] = 1.092548f * d.y * d.z;
+        y[6] = 0.315392f * (3.0f * d.z * d.z - 1.0f);
+        y[7] = 1.092548f * d.x * d.z;
+        y[8] = 0.546274f * (d.x * d.x - d.y * d.y);
+    }
+
+    // sum of Y_i * radiance * solid angle over the texels [begin, end) of row t of a face, into sums (27 values,
+    // coefficient major) and the solid angle into the last value
+    static void projectRow(int face, int size, int t, int begin, int end, const float* texels, float sums[SH_COUNT * 3 + 1])
+    {
+        float texelArea = (2.0f / size) * (2.0f / size);
+        for (int s = begin; s < end; s++)
+        {
+            glm::vec3 d = TexelDirection(face, size, (float)s, (float)t);
+            float lengthSquared = glm::dot(d, d);
+            float inverseLength = 1.0f / std::sqrt(lengthSquared);
+            // the solid angle of a texel is its area over the cube, seen at the distance and angle of its direction
+            float solidAngle = texelArea * inverseLength * inverseLength * inverseLength;
+            float y[SH_COUNT];
+            shBasis(d * inverseLength, y);
+            const float* rgb = texels + ((size_t)t * size + s) * 3;
+            for (int i = 0; i < SH_COUNT; i++)
+                for (int c = 0; c < 3; c++)
+                    sums[i * 3 + c] += y[i] * solidAngle * rgb[c];
+            sums[SH_COUNT * 3] += solidAngle;
+        }
+    }
+
+#ifdef ENVIRONMENT_BAKE_SSE
+    // projectRow() on 4 texels at a time, the tail is left to projectRow()
+    static int projectRowSSE(int face, int size, int t, const float* texels, float sums[SH_COUNT * 3 + 1])
+    {
+        const glm::vec3* axes = FACE_AXES[face];
+        float texelArea = (2.0f / size) * (2.0f / size);
+        float tc = 2.0f * (t + 0.5f) / (float)size - 1.0f;
+        // the row is a line in the plane of the face, only sc changes along it
+        __m128 baseX = _mm_set1_ps(axes[0].x + axes[2].x * tc), sX = _mm_set1_ps(axes[1].x);
+        __m128 baseY = _mm_set1_ps(axes[0].y + axes[2].y * tc), sY = _mm_set1_ps(axes[1].y);
+        __m128 baseZ = _mm_set1_ps(axes[0].z + axes[2].z * tc), sZ = _mm_set1_ps(axes[1].z);
+        __m128 area = _mm_set1_ps(texelArea), one = _mm_set1_ps(1.0f), three = _mm_set1_ps(3.0f);
+        __m128 acc[SH_COUNT * 3 + 1];
+        for (__m128 &a : acc)
+            a = _mm_setzero_ps();
+
+        int s = 0;
+        for (; s + 4 <= size; s += 4)
+        {
+            __m128 sc = _mm_set_ps(2.0f * (s + 3.5f) / size - 1.0f, 2.0f * (s + 2.5f) / size - 1.0f,
+                                   2.0f * (s + 1.5f) / size - 1.0f, 2.0f * (s + 0.5f) / size - 1.0f);
+            __m128 x = _mm_add_ps(baseX, _mm_mul_ps(sX, sc));
+            __m128 y = _mm_add_ps(baseY, _mm_mul_ps(sY, sc));
+            __m128 z = _mm_add_ps(baseZ, _mm_mul_ps(sZ, sc));
+            __m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+            __m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(lengthSquared));
+            __m128 solidAngle = _mm_mul_ps(area, _mm_mul_ps(inverseLength, _mm_mul_ps(inverseLength, inverseLength)));
+            x = _mm_mul_ps(x, inverseLength);
+            y = _mm_mul_ps(y, inverseLength);
+            z = _mm_mul_ps(z, inverseLength);
+
+            __m128 basis[SH_COUNT];
+            basis[0] = _mm_set1_ps(0.282095f);
+            basis[1] = _mm_mul_ps(_mm_set1_ps(0.488603f), y);
+            basis[2] = _mm_mul_ps(_mm_set1_ps(0.488603f), z);
+            basis[3] = _mm_mul_ps(_mm_set1_ps(0.488603f), x);
+            basis[4] = _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(x, y));
+            basis[5] = _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(y, z));
+            basis[6] = _mm_mul_ps(_mm_set1_ps(0.315392f), _mm_sub_ps(_mm_mul_ps(three, _mm_mul_ps(z, z)), one));
+            basis[7] = _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(x, z));
+            basis[8] = _mm_mul_ps(_mm_set1_ps(0.546274f), _mm_sub_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)));
+
+            // the texels are interleaved RGB, gathered into one register per channel
+            const float* rgb = texels + ((size_t)t * size + s) * 3;
+            __m128 channels[3];
+            for (int c = 0; c < 3; c++)
+                channels[c] = _mm_mul_ps(solidAngle, _mm_set_ps(rgb[9 + c], rgb[6 + c], rgb[3 + c], rgb[c]));
+            for (int i = 0; i < SH_COUNT; i++)
+                for (int c = 0; c < 3; c++)
+                    acc[i * 3 + c] = _mm_add_ps(acc[i * 3 + c], _mm_mul_ps(basis[i], channels[c]));
+            acc[SH_COUNT * 3] = _mm_add_ps(acc[SH_COUNT * 3], solidAngle);
+        }
+
+        for (int i = 0; i < SH_COUNT * 3 + 1; i++)
+        {
+            float lanes[4];
+            _mm_storeu_ps(lanes, acc[i]);
+            sums[i] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        }
+        return s;
+    }
+#endif
+
+    // the radiance projected on the basis, one face per job, then turned into irradiance
+    void projectIrradiance(JobSystem &jobs)
+    {
+        const SourceLevel &level = source[0];
+        int size = level.size;
+        double faceSums[6][SH_COUNT * 3 + 1];
+        JobCounter projected;
+        for (int f = 0; f < 6; f++)
+        {
+            jobs.Run("project sky face", [this, &faceSums, f, size]() {
+                const float* texels = source[0].faces[f].data();
+                for (double &sum : faceSums[f])
+                    sum = 0.0;
+                for (int t = 0; t < size; t++)
+                {
+                    // a row in floats, the face in doubles, so the millions of small terms do not get lost
+                    float sums[SH_COUNT * 3 + 1] = {};
+                    int begin = 0;
+#ifdef ENVIRONMENT_BAKE_SSE
+                    begin = projectRowSSE(f, size, t, texels, sums);
+#endif
+                    projectRow(f, size, t, begin, size, texels, sums);
+                    for (int i = 0; i < SH_COUNT * 3 + 1; i++)
+                        faceSums[f][i] += sums[i];
+                }
+            }, &projected);
+        }
+        jobs.Wait(projected);
+
+        double totals[SH_COUNT * 3 + 1] = {};
+        for (int f = 0; f < 6; f++)
+            for (int i = 0; i < SH_COUNT * 3 + 1; i++)
+                totals[i] += faceSums[f][i];
+
+        // the texel solid angles are approximate, they are scaled to add up to the sphere.
+        // then the convolution with the clamped cosine: pi for band 0, 2 pi / 3 for band 1, pi / 4 for band 2
+        const double pi = 3.14159265358979;
+        double normalization = 4.0 * pi / totals[SH_COUNT * 3];
+        const double band[SH_COUNT] = { pi, 2.0 * pi / 3.0, 2.0 * pi / 3.0, 2.0 * pi / 3.0, pi / 4.0, pi / 4.0, pi / 4.0, pi / 4.0, pi / 4.0 };
+        for (int i = 0; i < SH_COUNT; i++)
+            for (int c = 0; c < 3; c++)
+                irradiance[i][c] = (float)(totals[i * 3 + c] * normalization * band[i]);
+    }
+
+    static float radicalInverse(uint32_t bits)
+    {
+        bits = (bits << 16u) | (bits >> 16u);
+        bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+        bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+        bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+        bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+        return (float)bits * 2.3283064365386963e-10f;
+    }
+
+    // the GGX samples of a roughness on a Hammersley set, the same for every texel of the level
+    std::vector<LobeSample> lobeSamples(float roughness) const
+    {
+        const float pi = 3.14159265f;
+        float a = roughness * roughness;
+        float skyTexelSolidAngle = 4.0f * pi / (6.0f * source[0].size * source[0].size);
+        std::vector<LobeSample> samples;
+        for (int i = 0; i < SAMPLES; i++)
+        {
+            float u = (float)i / SAMPLES, v = radicalInverse((uint32_t)i);
+            float phi = 2.0f * pi * u;
+            float cosTheta = std::sqrt((1.0f - v) / (1.0f + (a * a - 1.0f) * v));
+            float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+            glm::vec3 h(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+            // reflected around h, with V = N = (0, 0, 1)
+            glm::vec3 l = h * (2.0f * h.z) - glm::vec3(0.0f, 0.0f, 1.0f);
+            if (l.z <= 0.0f)
+                continue;
+            // pdf of l is D(h) * (N.H) / (4 V.H) = D(h) / 4 here
+            float d = cosTheta * cosTheta * (a * a - 1.0f) + 1.0f;
+            float distribution = a * a / (pi * d * d);
+            float sampleSolidAngle = 1.0f / (SAMPLES * distribution / 4.0f + 1e-6f);
+            float lod = roughness == 0.0f ? 0.0f : std::max(0.5f * std::log2(sampleSolidAngle / skyTexelSolidAngle) + 1.0f, 0.0f);
+            samples.push_back({ l, l.z, lod });
+        }
+        return samples;
+    }
+
+    // bilinear lookup in a face of a source mip, clamped at the edges
+    static glm::vec3 bilinear(const SourceLevel &level, int face, float s, float t)
+    {
+        int size = level.size;
+        float x = s * size - 0.5f, y = t * size - 0.5f;
+        int x0 = (int)std::floor(x), y0 = (int)std::floor(y);
+        float fx = x - x0, fy = y - y0;
+        int xa = std::min(std::max(x0, 0), size - 1), xb = std::min(std::max(x0 + 1, 0), size - 1);
+        int ya = std::min(std::max(y0, 0), size - 1), yb = std::min(std::max(y0 + 1, 0), size - 1);
+        const float* texels = level.faces[face].data();
+        glm::vec3 result(0.0f);
+        const int xs[2] = { xa, xb }, ys[2] = { ya, yb };
+        const float wx[2] = { 1.0f - fx, fx }, wy[2] = { 1.0f - fy, fy };
+        for (int j = 0; j < 2; j++)
+            for (int i = 0; i < 2; i++)
+            {
+                const float* rgb = texels + ((size_t)ys[j] * size + xs[i]) * 3;
+                result += glm::vec3(rgb[0], rgb[1], rgb[2]) * (wx[i] * wy[j]);
+            }
+        return result;
+    }
+
+    // trilinear lookup of the sky in a direction
+    glm::vec3 sampleSky(const glm::vec3 &d, float lod) const
+    {
+        float ax = std::fabs(d.x), ay = std::fabs(d.y), az = std::fabs(d.z);
+        int face;
+        float major, sc, tc;
+        if (ax >= ay && ax >= az)
+        {
+            face = d.x > 0.0f ? 0 : 1;
+            major = ax;
+            sc = d.x > 0.0f ? -d.z : d.z;
+            tc = -d.y;
+        }
+        else if (ay >= az)
+        {
+            face = d.y > 0.0f ? 2 : 3;
+            major = ay;
+            sc = d.x;
+            tc = d.y > 0.0f ? d.z : -d.z;
+        }
+        else
+        {
+            face = d.z > 0.0f ? 4 : 5;
+            major = az;
+            sc = d.z > 0.0f ? d.x : -d.x;
+            tc = -d.y;
+        }
+        float s = 0.5f * (sc / major + 1.0f), t = 0.5f * (tc / major + 1.0f);
+
+        lod = std::min(lod, (float)(source.size() - 1));
+        int lower = (int)lod;
+        int upper = std::min(lower + 1, (int)source.size() - 1);
+        float blend = lod - lower;
+        glm::vec3 color = bilinear(source[lower], face, s, t);
+        if (blend > 0.0f && upper != lower)
+            color = color * (1.0f - blend) + bilinear(source[upper], face, s, t) * blend;
+        return color;
+    }
+
+    // every mip of the specular cubemap, one row of a face per job
+    void prefilter(JobSystem &jobs)
+    {
+        for (int level = 0; level < LEVELS; level++)
+        {
+            int size = LevelSize(level);
+            float roughness = (float)level / (LEVELS - 1);
+            std::vector<LobeSample> samples = lobeSamples(roughness);
+            // mip 0 is the mirror reflection, read at the mip of the sky closest to its texel size
+            float mirrorLod = std::max(std::log2((float)source[0].size / size), 0.0f);
+            levels[level].assign((size_t)size * size * 3 * 6, 0);
+
+            JobCounter filtered;
+            jobs.ParallelFor("prefilter sky", 6 * size, 4, [this, &samples, level, size, roughness, mirrorLod](int begin, int end) {
+                for (int row = begin; row < end; row++)
+                {
+                    int face = row / size, t = row % size;
+                    uint16_t* out = &levels[level][((size_t)face * size * size + (size_t)t * size) * 3];
+                    for (int s = 0; s < size; s++)
+                    {
+                        glm::vec3 n = glm::normalize(TexelDirection(face, size, (float)s, (float)t));
+                        glm::vec3 color(0.0f);
+                        if (roughness == 0.0f)
+                        {
+                            color = sampleSky(n, mirrorLod);
+                        }
+                        else
+                        {
+                            glm::vec3 up = std::fabs(n.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+                            glm::vec3 tangent = glm::normalize(glm::cross(up, n));
+                            glm::vec3 bitangent = glm::cross(n, tangent);
+                            float weight = 0.0f;
+                            for (const LobeSample &sample : samples)
+                            {
+                                glm::vec3 l = tangent * sample.direction.x + bitangent * sample.direction.y + n * sample.direction.z;
+                                color += sampleSky(l, sample.lod) * sample.weight;
+                                weight += sample.weight;
+                            }
+                            color /= std::max(weight, 1e-6f);
+                        }
+                        for (int c = 0; c < 3; c++)
+                            out[s * 3 + c] = glm::packHalf1x16(color[c]);
+                    }
+                }
+            }, &filtered);
+            jobs.Wait(filtered);
+        }
+    }
+
+    // cache file: magic, version, hash, the coefficients and the mips
+    static const uint32_t CACHE_MAGIC = 0x42564E45; // "ENVB"
+    static const uint32_t CACHE_VERSION = 1;
+
+    bool load(const std::string &path, uint64_t hash)
+    {
+        std::ifstream file(path, std::ios::binary);
+        uint32_t magic = 0, version = 0;
+        uint64_t fileHash = 0;
+        file.read((char*)&magic, sizeof(magic));
+        file.read((char*)&version, sizeof(version));
+        file.read((char*)&fileHash, sizeof(fileHash));
+        if (!file || magic != CACHE_MAGIC || version != CACHE_VERSION || fileHash != hash)
+            return false;
+        file.read((char*)irradiance, sizeof(irradiance));
+        for (int level = 0; level < LEVELS; level++)
+        {
+            int size = LevelSize(level);
+            levels[level].resize((size_t)size * size * 3 * 6);
+            file.read((char*)levels[level].data(), levels[level].size() * sizeof(uint16_t));
+        }
+        return (bool)file;
+    }
+
+    void save(const std::string &path, uint64_t hash) const
+    {
+        std::ofstream file(path, std::ios::binary);
+        uint32_t header[2] = { CACHE_MAGIC, CACHE_VERSION };
+        file.write((const char*)header, sizeof(header));
+        file.write((const char*)&hash, sizeof(hash));
+        file.write((const char*)irradiance, sizeof(irradiance));
+        for (int level = 0; level < LEVELS; level++)
+            file.write((const char*)levels[level].data(), levels[level].size() * sizeof(uint16_t));
+    }
+};
+
+const glm::vec3 EnvironmentBaker::FACE_AXES[6][3] = {
+    { glm::vec3( 1.0f,  0.0f,  0.0f), glm::vec3( 0.0f,  0.0f, -1.0f), glm::vec3(0.0f, -1.0f,  0.0f) }, // +X
+    { glm::vec3(-1.0f,  0.0f,  0.0f), glm::vec3( 0.0f,  0.0f,  1.0f), glm::vec3(0.0f, -1.0f,  0.0f) }, // -X
+    { glm::vec3( 0.0f,  1.0f,  0.0f), glm::vec3( 1.0f,  0.0f,  0.0f), glm::vec3(0.0f,  0.0f,  1.0f) }, // +Y
+    { glm::vec3( 0.0f, -1.0f,  0.0f), glm::vec3( 1.0f,  0.0f,  0.0f), glm::vec3(0.0f,  0.0f, -1.0f) }, // -Y
+    { glm::vec3( 0.0f,  0.0f,  1.0f), glm::vec3( 1.0f,  0.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f) }, // +Z
+    { glm::vec3( 0.0f,  0.0f, -1.0f), glm::vec3(-1.0f,  0.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f) }, // -Z
+};
+
+#endif
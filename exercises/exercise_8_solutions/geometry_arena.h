@@ -0,0 +1,306 @@
+#ifndef GEOMETRY_ARENA_H
+#define GEOMETRY_ARENA_H
+
+#include <glad/glad.h>
+
+#include "gl_state.h"
+
+#include <vector>
+
+// Shared vertex and index storage for every mesh with the same vertex format.
+// Meshes get a range of vertices and a range of indices from one big VBO and EBO, and all of them
+// are drawn through the same VAO with glDrawElementsBaseVertex, so switching meshes does not switch buffers.
+// Free ranges are kept in sorted lists and merged with their neighbours; when unloads leave the
+// storage too fragmented, the live ranges are packed again. The buffers grow when they are full.
+// Meshes keep a handle instead of offsets, since the offsets change when the arena is compacted.
+class GeometryArena
+{
+public:
+    struct Allocation
+    {
+        bool live;
+        int baseVertex, vertexCount;
+        int firstIndex, indexCount;
+    };
+
+    // counters, shown in the GUI
+    unsigned int grows = 0;
+    unsigned int compactions = 0;
+
+    // compact when the largest free block is less than this fraction of the free space
+    float compactThreshold = 0.5f;
+
+    // setupAttributes sets the vertex attribute pointers of the format, with the VBO bound
+    GeometryArena(GLsizei vertexStride, void (*setupAttributes)(), int initialVertices = 1 << 16, int initialIndices = 1 << 18)
+        : vertexStride(vertexStride), setupAttributes(setupAttributes),
+          vertexCapacity(initialVertices), indexCapacity(initialIndices)
+    {
+    }
+
+    // copies the vertices and indices into the arena. The indices are relative to the first vertex of the mesh.
+    // returns a handle to the allocation
+    int Allocate(const void* vertices, int vertexCount, const unsigned int* indices, int indexCount)
+    {
+        if (vao == 0)
+            create();
+
+        int baseVertex, firstIndex;
+        while (!allocateRange(freeVertices, vertexCount, baseVertex))
+            grow(vertexCapacity * 2, indexCapacity);
+        while (!allocateRange(freeIndices, indexCount, firstIndex))
+            grow(vertexCapacity, indexCapacity * 2);
+
+        glBindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)baseVertex * vertexStride, (GLsizeiptr)vertexCount * vertexStride, vertices);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, ebo);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)firstIndex * sizeof(unsigned int), (GLsizeiptr)indexCount * sizeof(unsigned int), indices);
+
+        Allocation allocation = { true, baseVertex, vertexCount, firstIndex, indexCount };
+        int handle;
+        if (!freeHandles.empty())
+        {
+            handle = freeHandles.back();
+            freeHandles.pop_back();
+            allocations[handle] = allocation;
+        }
+        else
+        {
+            handle = (int)allocations.size();
+            allocations.push_back(allocation);
+        }
+        return handle;
+    }
+
+    // returns the ranges to the free lists, compacting the arena if it got too fragmented
+    void Free(int handle)
+    {
+        Allocation &allocation = allocations[handle];
+        if (!allocation.live)
+            return;
+        freeRange(freeVertices, allocation.baseVertex, allocation.vertexCount);
+        freeRange(freeIndices, allocation.firstIndex, allocation.indexCount);
+        allocation.live = false;
+        freeHandles.push_back(handle);
+
+        if (Fragmentation() > compactThreshold)
+            Compact();
+    }
+
+    const Allocation& Get(int handle) const
+    {
+        return allocations[handle];
+    }
+
+    GLuint VAO() const
+    {
+        return vao;
+    }
+
+    // the VAO is only rebound when the previous draw came from another arena or object
+    void Draw(int handle, GLenum mode = GL_TRIANGLES)
+    {
+        const Allocation &allocation = allocations[handle];
+        glState.BindVertexArray(vao);
+        glDrawElementsBaseVertex(mode, allocation.indexCount, GL_UNSIGNED_INT,
+                                 (void*)(allocation.firstIndex * sizeof(unsigned int)), allocation.baseVertex);
+    }
+
+    // moves every live range to the start of the buffers, leaving a single free range at the end
+    void Compact()
+    {
+        if (vao == 0)
+            return;
+
+        GLuint newVbo, newEbo;
+        glGenBuffers(1, &newVbo);
+        glGenBuffers(1, &newEbo);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, newVbo);
+        glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)vertexCapacity * vertexStride, NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, newEbo);
+        glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)indexCapacity * sizeof(unsigned int), NULL, GL_STATIC_DRAW);
+
+        int nextVertex = 0, nextIndex = 0;
+        for (Allocation &allocation : allocations)
+        {
+            if (!allocation.live)
+                continue;
+            copyRange(vbo, newVbo, allocation.baseVertex, nextVertex, allocation.vertexCount, vertexStride);
+            copyRange(ebo, newEbo, allocation.firstIndex, nextIndex, allocation.indexCount, sizeof(unsigned int));
+            allocation.baseVertex = nextVertex;
+            allocation.firstIndex = nextIndex;
+            nextVertex += allocation.vertexCount;
+            nextIndex += allocation.indexCount;
+        }
+
+        replaceBuffers(newVbo, newEbo);
+        freeVertices.assign(1, { nextVertex, vertexCapacity - nextVertex });
+        freeIndices.assign(1, { nextIndex, indexCapacity - nextIndex });
+        compactions++;
+    }
+
+    // memory statistics
+    int VertexCapacity() const { return vertexCapacity; }
+    int IndexCapacity() const { return indexCapacity; }
+    int FreeVertices() const { return totalFree(freeVertices); }
+    int FreeIndices() const { return totalFree(freeIndices); }
+    int FreeRangeCount() const { return (int)(freeVertices.size() + freeIndices.size()); }
+    int LiveAllocations() const { return (int)(allocations.size() - freeHandles.size()); }
+    size_t BytesUsed() const
+    {
+        // the free lists are only seeded when the buffers are created
+        if (vao == 0)
+            return 0;
+        return (size_t)(vertexCapacity - FreeVertices()) * vertexStride + (size_t)(indexCapacity - FreeIndices()) * sizeof(unsigned int);
+    }
+    size_t BytesReserved() const
+    {
+        return vao == 0 ? 0 : (size_t)vertexCapacity * vertexStride + (size_t)indexCapacity * sizeof(unsigned int);
+    }
+
+    // 0 when all the free space is one block, close to 1 when it is split in many small ones.
+    // the worse of the vertex and the index storage
+    float Fragmentation() const
+    {
+        float vertexFragmentation = fragmentation(freeVertices);
+        float indexFragmentation = fragmentation(freeIndices);
+        return vertexFragmentation > indexFragmentation ? vertexFragmentation : indexFragmentation;
+    }
+
+private:
+    struct Range
+    {
+        int first, count;
+    };
+
+    GLsizei vertexStride;
+    void (*setupAttributes)();
+    int vertexCapacity, indexCapacity;
+    GLuint vao = 0, vbo = 0, ebo = 0;
+    std::vector<Range> freeVertices, freeIndices; // sorted by first
+    std::vector<Allocation> allocations;
+    std::vector<int> freeHandles;
+
+    void create()
+    {
+        glGenVertexArrays(1, &vao);
+        glGenBuffers(1, &vbo);
+        glGenBuffers(1, &ebo);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+        glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)vertexCapacity * vertexStride, NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, ebo);
+        glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)indexCapacity * sizeof(unsigned int), NULL, GL_STATIC_DRAW);
+        bindFormat();
+        freeVertices.assign(1, { 0, vertexCapacity });
+        freeIndices.assign(1, { 0, indexCapacity });
+    }
+
+    // points the VAO at the current buffers
+    void bindFormat()
+    {
+        glState.BindVertexArray(vao);
+        glState.BindBuffer(GL_ARRAY_BUFFER, vbo);
+        glState.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        setupAttributes();
+    }
+
+    // reallocates the buffers with a bigger capacity, keeping the contents where they are
+    void grow(int newVertexCapacity, int newIndexCapacity)
+    {
+        GLuint newVbo, newEbo;
+        glGenBuffers(1, &newVbo);
+        glGenBuffers(1, &newEbo);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, newVbo);
+        glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)newVertexCapacity * vertexStride, NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, newEbo);
+        glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)newIndexCapacity * sizeof(unsigned int), NULL, GL_STATIC_DRAW);
+        copyRange(vbo, newVbo, 0, 0, vertexCapacity, vertexStride);
+        copyRange(ebo, newEbo, 0, 0, indexCapacity, sizeof(unsigned int));
+        replaceBuffers(newVbo, newEbo);
+
+        freeRange(freeVertices, vertexCapacity, newVertexCapacity - vertexCapacity);
+        freeRange(freeIndices, indexCapacity, newIndexCapacity - indexCapacity);
+        vertexCapacity = newVertexCapacity;
+        indexCapacity = newIndexCapacity;
+        grows++;
+    }
+
+    void replaceBuffers(GLuint newVbo, GLuint newEbo)
+    {
+        glDeleteBuffers(1, &vbo);
+        glDeleteBuffers(1, &ebo);
+        vbo = newVbo;
+        ebo = newEbo;
+        // the deleted names may be handed out again, forget what the cache thinks is bound
+        glState.Invalidate();
+        bindFormat();
+    }
+
+    static void copyRange(GLuint from, GLuint to, int fromFirst, int toFirst, int count, GLsizei elementSize)
+    {
+        if (count <= 0)
+            return;
+        glBindBuffer(GL_COPY_READ_BUFFER, from);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, to);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (GLintptr)fromFirst * elementSize,
+                            (GLintptr)toFirst * elementSize, (GLsizeiptr)count * elementSize);
+    }
+
+    // first fit
+    static bool allocateRange(std::vector<Range> &freeList, int count, int &first)
+    {
+        for (int i = 0; i < (int)freeList.size(); i++)
+        {
+            if (freeList[i].count < count)
+                continue;
+            first = freeList[i].first;
+            freeList[i].first += count;
+            freeList[i].count -= count;
+            if (freeList[i].count == 0)
+                freeList.erase(freeList.begin() + i);
+            return true;
+        }
+        return false;
+    }
+
+    // inserts the range in order and merges it with the free ranges right before and after it
+    static void freeRange(std::vector<Range> &freeList, int first, int count)
+    {
+        if (count <= 0)
+            return;
+        int i = 0;
+        while (i < (int)freeList.size() && freeList[i].first < first)
+            i++;
+        freeList.insert(freeList.begin() + i, { first, count });
+        if (i + 1 < (int)freeList.size() && freeList[i].first + freeList[i].count == freeList[i + 1].first)
+        {
+            freeList[i].count += freeList[i + 1].count;
+            freeList.erase(freeList.begin() + i + 1);
+        }
+        if (i > 0 && freeList[i - 1].first + freeList[i - 1].count == freeList[i].first)
+        {
+            freeList[i - 1].count += freeList[i].count;
+            freeList.erase(freeList.begin() + i);
+        }
+    }
+
+    static int totalFree(const std::vector<Range> &freeList)
+    {
+        int total = 0;
+        for (const Range &range : freeList)
+            total += range.count;
+        return total;
+    }
+
+    static float fragmentation(const std::vector<Range> &freeList)
+    {
+        int total = 0, largest = 0;
+        for (const Range &range : freeList)
+        {
+            total += range.count;
+            largest = range.count > largest ? range.count : largest;
+        }
+        return total == 0 ? 0.0f : 1.0f - (float)largest / (float)total;
+    }
+};
+
+#endif
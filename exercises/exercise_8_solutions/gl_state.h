@@ -0,0 +1,322 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+
+#include <cstring>
+
+// Thin layer over the OpenGL state calls used by the renderer.
+// It remembers the bound program, vertex array, textures per unit, framebuffer, capabilities,
+// blend/depth functions, viewport and scissor, and drops calls that would not change anything.
+// Every call is counted as issued or elided, per category, so the savings can be shown per frame.
+// Code that changes this state without going through here must call Invalidate().
+class GLState
+{
+public:
+    enum Category
+    {
+        PROGRAM,
+        VERTEX_ARRAY,
+        TEXTURE,
+        ACTIVE_TEXTURE,
+        BUFFER,
+        FRAMEBUFFER,
+        CAPABILITY,
+        BLEND_FUNC,
+        DEPTH,
+        VIEWPORT,
+        CATEGORY_COUNT
+    };
+
+    static const char* CategoryName(int category)
+    {
+        static const char* names[CATEGORY_COUNT] = { "program", "vertex array", "texture", "active texture", "buffer", "framebuffer",
+                                                      "enable/disable", "blend func", "depth", "viewport/scissor" };
+        return names[category];
+    }
+
+    static const int MAX_TEXTURE_UNITS = 16;
+
+    // counters of the current frame and of the last finished frame
+    unsigned int issued[CATEGORY_COUNT];
+    unsigned int elided[CATEGORY_COUNT];
+    unsigned int lastIssued[CATEGORY_COUNT];
+    unsigned int lastElided[CATEGORY_COUNT];
+
+    GLState()
+    {
+        std::memset(issued, 0, sizeof(issued));
+        std::memset(elided, 0, sizeof(elided));
+        std::memset(lastIssued, 0, sizeof(lastIssued));
+        std::memset(lastElided, 0, sizeof(lastElided));
+        Invalidate();
+    }
+
+    // forget everything, the next call of each kind is always issued
+    void Invalidate()
+    {
+        program = UNKNOWN;
+        vertexArray = UNKNOWN;
+        activeUnit = UNKNOWN;
+        for (int i = 0; i < MAX_TEXTURE_UNITS; i++)
+            for (int t = 0; t < TARGET_COUNT; t++)
+                textures[i][t] = UNKNOWN;
+        arrayBuffer = UNKNOWN;
+        framebuffer = UNKNOWN;
+        for (int c = 0; c < CAP_COUNT; c++)
+            capabilities[c] = -1;
+        blendSrc = blendDst = UNKNOWN;
+        depthFunc = UNKNOWN;
+        depthMask = -1;
+        viewportValid = scissorValid = false;
+        instanceVao = instanceBuffer = UNKNOWN;
+        instanceOffset = 0;
+    }
+
+    // moves the counters of the frame that just finished to last*
+    void BeginFrame()
+    {
+        std::memcpy(lastIssued, issued, sizeof(issued));
+        std::memcpy(lastElided, elided, sizeof(elided));
+        std::memset(issued, 0, sizeof(issued));
+        std::memset(elided, 0, sizeof(elided));
+    }
+
+    unsigned int LastIssuedTotal() const { return sum(lastIssued); }
+    unsigned int LastElidedTotal() const { return sum(lastElided); }
+    unsigned int IssuedTotal() const { return sum(issued); }
+    unsigned int ElidedTotal() const { return sum(elided); }
+
+    void UseProgram(GLuint id)
+    {
+        if (changed(PROGRAM, program, id))
+            glUseProgram(id);
+    }
+
+    void BindVertexArray(GLuint id)
+    {
+        if (changed(VERTEX_ARRAY, vertexArray, id))
+            glBindVertexArray(id);
+    }
+
+    // binds the VAO and points its 4 attributes of an instance matrix, from the attribute index on, at the
+    // matrices of a buffer from an offset. The pointers are VAO state, they are only set again when the VAO,
+    // buffer or offset differ from the last call. Not counted, the VAO bind is
+    void InstanceMatrices(GLuint vao, GLuint attribute, GLuint buffer, GLintptr offset)
+    {
+        BindVertexArray(vao);
+        if (vao == instanceVao && buffer == instanceBuffer && offset == instanceOffset)
+            return;
+        BindBuffer(GL_ARRAY_BUFFER, buffer);
+        const GLsizei columnSize = 4 * sizeof(GLfloat);
+        for (GLuint i = 0; i < 4; i++)
+            glVertexAttribPointer(attribute + i, 4, GL_FLOAT, GL_FALSE, 4 * columnSize, (void*)(offset + i * columnSize));
+        instanceVao = vao;
+        instanceBuffer = buffer;
+        instanceOffset = offset;
+    }
+
+    // binds a texture to a unit, only switching the active unit when needed
+    void BindTexture(GLuint unit, GLenum target, GLuint id)
+    {
+        int t = targetIndex(target);
+        if (t < 0 || unit >= MAX_TEXTURE_UNITS)
+        {
+            activeTexture(unit);
+            count(TEXTURE, true);
+            glBindTexture(target, id);
+            return;
+        }
+        if (textures[unit][t] == id)
+        {
+            count(TEXTURE, false);
+            return;
+        }
+        activeTexture(unit);
+        textures[unit][t] = id;
+        count(TEXTURE, true);
+        glBindTexture(target, id);
+    }
+
+    // only GL_ARRAY_BUFFER is global state, the element buffer belongs to the vertex array
+    void BindBuffer(GLenum target, GLuint id)
+    {
+        if (target != GL_ARRAY_BUFFER)
+        {
+            count(BUFFER, true);
+            glBindBuffer(target, id);
+            return;
+        }
+        if (changed(BUFFER, arrayBuffer, id))
+            glBindBuffer(target, id);
+    }
+
+    void BindFramebuffer(GLuint id)
+    {
+        if (changed(FRAMEBUFFER, framebuffer, id))
+            glBindFramebuffer(GL_FRAMEBUFFER, id);
+    }
+
+    void SetEnabled(GLenum cap, bool enabled)
+    {
+        int c = capIndex(cap);
+        if (c >= 0 && capabilities[c] == (enabled ? 1 : 0))
+        {
+            count(CAPABILITY, false);
+            return;
+        }
+        if (c >= 0)
+            capabilities[c] = enabled ? 1 : 0;
+        count(CAPABILITY, true);
+        if (enabled)
+            glEnable(cap);
+        else
+            glDisable(cap);
+    }
+
+    void BlendFunc(GLenum src, GLenum dst)
+    {
+        if (blendSrc == src && blendDst == dst)
+        {
+            count(BLEND_FUNC, false);
+            return;
+        }
+        blendSrc = src;
+        blendDst = dst;
+        count(BLEND_FUNC, true);
+        glBlendFunc(src, dst);
+    }
+
+    void DepthFunc(GLenum func)
+    {
+        if (changed(DEPTH, depthFunc, func))
+            glDepthFunc(func);
+    }
+
+    void DepthMask(bool write)
+    {
+        if (depthMask == (write ? 1 : 0))
+        {
+            count(DEPTH, false);
+            return;
+        }
+        depthMask = write ? 1 : 0;
+        count(DEPTH, true);
+        glDepthMask(write ? GL_TRUE : GL_FALSE);
+    }
+
+    void Viewport(int x, int y, int width, int height)
+    {
+        if (setRect(viewportValid, viewport, x, y, width, height))
+            glViewport(x, y, width, height);
+    }
+
+    void Scissor(int x, int y, int width, int height)
+    {
+        if (setRect(scissorValid, scissor, x, y, width, height))
+            glScissor(x, y, width, height);
+    }
+
+    // current viewport, without a glGetIntegerv round trip once it is known
+    void GetViewport(int out[4])
+    {
+        if (!viewportValid)
+        {
+            glGetIntegerv(GL_VIEWPORT, viewport);
+            viewportValid = true;
+        }
+        std::memcpy(out, viewport, sizeof(viewport));
+    }
+
+private:
+    static const GLuint UNKNOWN = 0xFFFFFFFFu;
+    enum { TARGET_2D, TARGET_CUBE_MAP, TARGET_2D_ARRAY, TARGET_BUFFER, TARGET_COUNT };
+    enum { CAP_BLEND, CAP_DEPTH_TEST, CAP_SCISSOR_TEST, CAP_CULL_FACE, CAP_FRAMEBUFFER_SRGB, CAP_COUNT };
+
+    GLuint program, vertexArray, activeUnit;
+    GLuint textures[MAX_TEXTURE_UNITS][TARGET_COUNT];
+    GLuint arrayBuffer, framebuffer;
+    int capabilities[CAP_COUNT]; // -1 unknown, 0 disabled, 1 enabled
+    GLuint blendSrc, blendDst, depthFunc;
+    int depthMask;
+    bool viewportValid, scissorValid;
+    GLuint instanceVao, instanceBuffer; // source of the instance matrix attributes, see InstanceMatrices()
+    GLintptr instanceOffset;
+    int viewport[4], scissor[4];
+
+    static int targetIndex(GLenum target)
+    {
+        switch (target)
+        {
+            case GL_TEXTURE_2D: return TARGET_2D;
+            case GL_TEXTURE_CUBE_MAP: return TARGET_CUBE_MAP;
+            case GL_TEXTURE_2D_ARRAY: return TARGET_2D_ARRAY;
+            case GL_TEXTURE_BUFFER: return TARGET_BUFFER;
+            default: return -1;
+        }
+    }
+
+    static int capIndex(GLenum cap)
+    {
+        switch (cap)
+        {
+            case GL_BLEND: return CAP_BLEND;
+            case GL_DEPTH_TEST: return CAP_DEPTH_TEST;
+            case GL_SCISSOR_TEST: return CAP_SCISSOR_TEST;
+            case GL_CULL_FACE: return CAP_CULL_FACE;
+            case GL_FRAMEBUFFER_SRGB: return CAP_FRAMEBUFFER_SRGB;
+            default: return -1;
+        }
+    }
+
+    static unsigned int sum(const unsigned int* counters)
+    {
+        unsigned int total = 0;
+        for (int i = 0; i < CATEGORY_COUNT; i++)
+            total += counters[i];
+        return total;
+    }
+
+    void count(Category category, bool wasIssued)
+    {
+        if (wasIssued)
+            issued[category]++;
+        else
+            elided[category]++;
+    }
+
+    bool changed(Category category, GLuint &cached, GLuint value)
+    {
+        bool different = cached != value;
+        cached = value;
+        count(category, different);
+        return different;
+    }
+
+    void activeTexture(GLuint unit)
+    {
+        if (changed(ACTIVE_TEXTURE, activeUnit, unit))
+            glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    bool setRect(bool &valid, int rect[4], int x, int y, int width, int height)
+    {
+        if (valid && rect[0] == x && rect[1] == y && rect[2] == width && rect[3] == height)
+        {
+            count(VIEWPORT, false);
+            return false;
+        }
+        valid = true;
+        rect[0] = x;
+        rect[1] = y;
+        rect[2] = width;
+        rect[3] = height;
+        count(VIEWPORT, true);
+        return true;
+    }
+};
+
+// the renderer lives in a single translation unit, like the rest of these headers
+GLState glState;
+
+#endif
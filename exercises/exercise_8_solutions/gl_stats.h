@@ -0,0 +1,427 @@
+#ifndef GL_STATS_H
+#define GL_STATS_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+// Counts what a frame asks of the GL: draw calls, triangles, texture binds, uniform uploads, buffer bytes
+// and the other calls the renderer makes, by swapping glad's function pointers for counting wrappers.
+// Every call goes through, unlike GLState, which only sees the calls made through it.
+// The GPU side comes from a GL_PRIMITIVES_GENERATED and a GL_SAMPLES_PASSED query around the frame,
+// read back QUERY_LATENCY frames later without waiting.
+// Only built with the GL_CALL_STATS option (-DGL_CALL_STATS=ON), otherwise every member is an empty
+// inline function and the GL pointers are left alone.
+class GLStats
+{
+public:
+    enum Counter
+    {
+        DRAW_CALLS,
+        DRAWS,          // a multi-draw is one call with many draws
+        TRIANGLES,
+        TEXTURE_BINDS,
+        UNIFORM_UPLOADS,
+        PROGRAM_BINDS,
+        VERTEX_ARRAY_BINDS,
+        BUFFER_BINDS,
+        BUFFER_BYTES,   // uploaded, copied or mapped for writing
+        TEXTURE_UPLOADS,
+        FRAMEBUFFER_BINDS,
+        STATE_CHANGES,  // enable/disable, blend, depth, viewport and scissor
+        PRIMITIVES_GENERATED,
+        SAMPLES_PASSED,
+        COUNTER_COUNT
+    };
+
+    static const char* CounterName(int counter)
+    {
+        static const char* names[COUNTER_COUNT] = { "draw calls", "draws", "triangles", "texture binds", "uniform uploads",
+                                                    "program binds", "vertex array binds", "buffer binds", "buffer bytes",
+                                                    "texture uploads", "framebuffer binds", "state changes",
+                                                    "primitives generated", "samples passed" };
+        return names[counter];
+    }
+
+    static const int FRAME_HISTORY = 128;
+    static const int QUERY_LATENCY = 4;
+
+    // the counters of a finished frame, the query results arrive a few frames later
+    struct Frame
+    {
+        uint64_t index = 0;
+        uint64_t counters[COUNTER_COUNT] = {};
+        bool queried = false;
+    };
+
+#ifdef GL_CALL_STATS
+    static const bool ENABLED = true;
+
+    // replaces the glad pointers, call once after gladLoadGLLoader()
+    void Install()
+    {
+        if (installed)
+            return;
+        installed = true;
+        wrap(glad_glDrawArrays, real().DrawArrays, countDrawArrays);
+        wrap(glad_glDrawArraysInstanced, real().DrawArraysInstanced, countDrawArraysInstanced);
+        wrap(glad_glDrawElements, real().DrawElements, countDrawElements);
+        wrap(glad_glDrawElementsInstanced, real().DrawElementsInstanced, countDrawElementsInstanced);
+        wrap(glad_glDrawElementsBaseVertex, real().DrawElementsBaseVertex, countDrawElementsBaseVertex);
+        wrap(glad_glMultiDrawElementsBaseVertex, real().MultiDrawElementsBaseVertex, countMultiDrawElementsBaseVertex);
+        wrap(glad_glBindTexture, real().BindTexture, countBindTexture);
+        wrap(glad_glUniform1i, real().Uniform1i, countUniform1i);
+        wrap(glad_glUniform1f, real().Uniform1f, countUniform1f);
+        wrap(glad_glUniform2f, real().Uniform2f, countUniform2f);
+        wrap(glad_glUniform3f, real().Uniform3f, countUniform3f);
+        wrap(glad_glUniform4f, real().Uniform4f, countUniform4f);
+        wrap(glad_glUniform2fv, real().Uniform2fv, countUniform2fv);
+        wrap(glad_glUniform3fv, real().Uniform3fv, countUniform3fv);
+        wrap(glad_glUniform4fv, real().Uniform4fv, countUniform4fv);
+        wrap(glad_glUniformMatrix2fv, real().UniformMatrix2fv, countUniformMatrix2fv);
+        wrap(glad_glUniformMatrix3fv, real().UniformMatrix3fv, countUniformMatrix3fv);
+        wrap(glad_glUniformMatrix4fv, real().UniformMatrix4fv, countUniformMatrix4fv);
+        wrap(glad_glUseProgram, real().UseProgram, countUseProgram);
+        wrap(glad_glBindVertexArray, real().BindVertexArray, countBindVertexArray);
+        wrap(glad_glBindBuffer, real().BindBuffer, countBindBuffer);
+        wrap(glad_glBindBufferRange, real().BindBufferRange, countBindBufferRange);
+        wrap(glad_glBufferData, real().BufferData, countBufferData);
+        wrap(glad_glBufferSubData, real().BufferSubData, countBufferSubData);
+        wrap(glad_glCopyBufferSubData, real().CopyBufferSubData, countCopyBufferSubData);
+        wrap(glad_glMapBufferRange, real().MapBufferRange, countMapBufferRange);
+        wrap(glad_glTexImage2D, real().TexImage2D, countTexImage2D);
+        wrap(glad_glTexImage3D, real().TexImage3D, countTexImage3D);
+        wrap(glad_glBindFramebuffer, real().BindFramebuffer, countBindFramebuffer);
+        wrap(glad_glEnable, real().Enable, countEnable);
+        wrap(glad_glDisable, real().Disable, countDisable);
+        wrap(glad_glBlendFunc, real().BlendFunc, countBlendFunc);
+        wrap(glad_glDepthFunc, real().DepthFunc, countDepthFunc);
+        wrap(glad_glDepthMask, real().DepthMask, countDepthMask);
+        wrap(glad_glViewport, real().Viewport, countViewport);
+        wrap(glad_glScissor, real().Scissor, countScissor);
+    }
+
+    // starts the GPU queries of the frame and reads the ones that are ready
+    void BeginFrame()
+    {
+        collectQueries();
+        QuerySet &set = querySets[frameIndex % QUERY_LATENCY];
+        if (set.queries[0] == 0)
+            glGenQueries(2, set.queries);
+        set.frame = frameIndex;
+        set.pending = true;
+        glBeginQuery(GL_PRIMITIVES_GENERATED, set.queries[0]);
+        glBeginQuery(GL_SAMPLES_PASSED, set.queries[1]);
+    }
+
+    // ends the queries and moves the counters of the frame to the history
+    void EndFrame()
+    {
+        glEndQuery(GL_PRIMITIVES_GENERATED);
+        glEndQuery(GL_SAMPLES_PASSED);
+
+        Frame &frame = frames[frameIndex % FRAME_HISTORY];
+        frame.index = frameIndex;
+        std::memcpy(frame.counters, live(), sizeof(frame.counters));
+        frame.queried = false;
+        std::memset(live(), 0, sizeof(uint64_t) * COUNTER_COUNT);
+        frameIndex++;
+    }
+
+    // the newest finished frame, nullptr before the first one
+    const Frame* LastFrame() const
+    {
+        return frameIndex == 0 ? nullptr : &frames[(frameIndex - 1) % FRAME_HISTORY];
+    }
+
+    // frame i, or nullptr if it is not in the history
+    const Frame* FrameAt(uint64_t i) const
+    {
+        const Frame &frame = frames[i % FRAME_HISTORY];
+        return i < frameIndex && frame.index == i ? &frame : nullptr;
+    }
+
+    // the newest frame with its query results, nullptr if there is none yet
+    const Frame* LastQueriedFrame() const
+    {
+        for (uint64_t i = frameIndex; i > 0 && frameIndex - i < (uint64_t)FRAME_HISTORY; i--)
+        {
+            const Frame &frame = frames[(i - 1) % FRAME_HISTORY];
+            if (frame.index == i - 1 && frame.queried)
+                return &frame;
+        }
+        return nullptr;
+    }
+
+    // one line per frame of the history, oldest first, with a header. Returns false if the file cannot be written
+    bool WriteCsv(const std::string &path) const
+    {
+        std::ofstream file(path);
+        if (!file)
+            return false;
+        file << "frame";
+        for (int i = 0; i < COUNTER_COUNT; i++)
+            file << "," << CounterName(i);
+        file << "\n";
+        uint64_t first = frameIndex > (uint64_t)FRAME_HISTORY ? frameIndex - FRAME_HISTORY : 0;
+        for (uint64_t i = first; i < frameIndex; i++)
+        {
+            const Frame &frame = frames[i % FRAME_HISTORY];
+            file << frame.index;
+            for (int c = 0; c < COUNTER_COUNT; c++)
+            {
+                // the query results that have not arrived are left empty
+                file << ",";
+                if (frame.queried || (c != PRIMITIVES_GENERATED && c != SAMPLES_PASSED))
+                    file << frame.counters[c];
+            }
+            file << "\n";
+        }
+        return (bool)file;
+    }
+
+private:
+    struct QuerySet
+    {
+        GLuint queries[2] = { 0, 0 };
+        uint64_t frame = 0;
+        bool pending = false;
+    };
+
+    // the original entry points
+    struct RealFunctions
+    {
+        PFNGLDRAWARRAYSPROC DrawArrays;
+        PFNGLDRAWARRAYSINSTANCEDPROC DrawArraysInstanced;
+        PFNGLDRAWELEMENTSPROC DrawElements;
+        PFNGLDRAWELEMENTSINSTANCEDPROC DrawElementsInstanced;
+        PFNGLDRAWELEMENTSBASEVERTEXPROC DrawElementsBaseVertex;
+        PFNGLMULTIDRAWELEMENTSBASEVERTEXPROC MultiDrawElementsBaseVertex;
+        PFNGLBINDTEXTUREPROC BindTexture;
+        PFNGLUNIFORM1IPROC Uniform1i;
+        PFNGLUNIFORM1FPROC Uniform1f;
+        PFNGLUNIFORM2FPROC Uniform2f;
+        PFNGLUNIFORM3FPROC Uniform3f;
+        PFNGLUNIFORM4FPROC Uniform4f;
+        PFNGLUNIFORM2FVPROC Uniform2fv;
+        PFNGLUNIFORM3FVPROC Uniform3fv;
+        PFNGLUNIFORM4FVPROC Uniform4fv;
+        PFNGLUNIFORMMATRIX2FVPROC UniformMatrix2fv;
+        PFNGLUNIFORMMATRIX3FVPROC UniformMatrix3fv;
+        PFNGLUNIFORMMATRIX4FVPROC UniformMatrix4fv;
+        PFNGLUSEPROGRAMPROC UseProgram;
+        PFNGLBINDVERTEXARRAYPROC BindVertexArray;
+        PFNGLBINDBUFFERPROC BindBuffer;
+        PFNGLBINDBUFFERRANGEPROC BindBufferRange;
+        PFNGLBUFFERDATAPROC BufferData;
+        PFNGLBUFFERSUBDATAPROC BufferSubData;
+        PFNGLCOPYBUFFERSUBDATAPROC CopyBufferSubData;
+        PFNGLMAPBUFFERRANGEPROC MapBufferRange;
+        PFNGLTEXIMAGE2DPROC TexImage2D;
+        PFNGLTEXIMAGE3DPROC TexImage3D;
+        PFNGLBINDFRAMEBUFFERPROC BindFramebuffer;
+        PFNGLENABLEPROC Enable;
+        PFNGLDISABLEPROC Disable;
+        PFNGLBLENDFUNCPROC BlendFunc;
+        PFNGLDEPTHFUNCPROC DepthFunc;
+        PFNGLDEPTHMASKPROC DepthMask;
+        PFNGLVIEWPORTPROC Viewport;
+        PFNGLSCISSORPROC Scissor;
+    };
+
+    bool installed = false;
+    uint64_t frameIndex = 0;
+    Frame frames[FRAME_HISTORY];
+    QuerySet querySets[QUERY_LATENCY];
+
+    // the wrappers are plain functions, so the counters and the originals are shared by every GLStats
+    static RealFunctions& real()
+    {
+        static RealFunctions functions;
+        return functions;
+    }
+
+    static uint64_t* live()
+    {
+        static uint64_t counters[COUNTER_COUNT] = {};
+        return counters;
+    }
+
+    template <typename Function>
+    static void wrap(Function &gladPointer, Function &original, Function wrapper)
+    {
+        original = gladPointer;
+        gladPointer = wrapper;
+    }
+
+    // reads the queries of the older frames, oldest first, until one is not ready
+    void collectQueries()
+    {
+        for (uint64_t i = frameIndex >= (uint64_t)QUERY_LATENCY ? frameIndex - QUERY_LATENCY : 0; i < frameIndex; i++)
+        {
+            QuerySet &set = querySets[i % QUERY_LATENCY];
+            if (!set.pending || set.frame != i)
+                continue;
+            GLuint available = 0;
+            glGetQueryObjectuiv(set.queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+            // the slot is reused this frame, a result that is not ready by then is dropped
+            if (!available && i + QUERY_LATENCY > frameIndex)
+                return;
+            set.pending = false;
+            if (!available)
+                continue;
+
+            GLuint64 primitives = 0, samples = 0;
+            glGetQueryObjectui64v(set.queries[0], GL_QUERY_RESULT, &primitives);
+            glGetQueryObjectui64v(set.queries[1], GL_QUERY_RESULT, &samples);
+            Frame &frame = frames[i % FRAME_HISTORY];
+            if (frame.index != i)
+                continue;
+            frame.counters[PRIMITIVES_GENERATED] = primitives;
+            frame.counters[SAMPLES_PASSED] = samples;
+            frame.queried = true;
+        }
+    }
+
+    static uint64_t trianglesOf(GLenum mode, GLsizei count)
+    {
+        switch (mode)
+        {
+        case GL_TRIANGLES: return (uint64_t)(count / 3);
+        case GL_TRIANGLE_STRIP:
+        case GL_TRIANGLE_FAN: return count > 2 ? (uint64_t)(count - 2) : 0;
+        default: return 0;
+        }
+    }
+
+    static void countDraw(GLenum mode, GLsizei count, GLsizei instances)
+    {
+        live()[DRAWS]++;
+        live()[TRIANGLES] += trianglesOf(mode, count) * (uint64_t)instances;
+    }
+
+    static void APIENTRY countDrawArrays(GLenum mode, GLint first, GLsizei count)
+    {
+        live()[DRAW_CALLS]++;
+        countDraw(mode, count, 1);
+        real().DrawArrays(mode, first, count);
+    }
+    static void APIENTRY countDrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances)
+    {
+        live()[DRAW_CALLS]++;
+        countDraw(mode, count, instances);
+        real().DrawArraysInstanced(mode, first, count, instances);
+    }
+    static void APIENTRY countDrawElements(GLenum mode, GLsizei count, GLenum type, const void* indices)
+    {
+        live()[DRAW_CALLS]++;
+        countDraw(mode, count, 1);
+        real().DrawElements(mode, count, type, indices);
+    }
+    static void APIENTRY countDrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instances)
+    {
+        live()[DRAW_CALLS]++;
+        countDraw(mode, count, instances);
+        real().DrawElementsInstanced(mode, count, type, indices, instances);
+    }
+    static void APIENTRY countDrawElementsBaseVertex(GLenum mode, GLsizei count, GLenum type, const void* indices, GLint baseVertex)
+    {
+        live()[DRAW_CALLS]++;
+        countDraw(mode, count, 1);
+        real().DrawElementsBaseVertex(mode, count, type, indices, baseVertex);
+    }
+    static void APIENTRY countMultiDrawElementsBaseVertex(GLenum mode, const GLsizei* count, GLenum type, const void* const* indices,
+                                                          GLsizei drawCount, const GLint* baseVertex)
+    {
+        live()[DRAW_CALLS]++;
+        for (GLsizei i = 0; i < drawCount; i++)
+            countDraw(mode, count[i], 1);
+        real().MultiDrawElementsBaseVertex(mode, count, type, indices, drawCount, baseVertex);
+    }
+
+    static void APIENTRY countBindTexture(GLenum target, GLuint texture) { live()[TEXTURE_BINDS]++; real().BindTexture(target, texture); }
+
+    static void APIENTRY countUniform1i(GLint l, GLint x) { live()[UNIFORM_UPLOADS]++; real().Uniform1i(l, x); }
+    static void APIENTRY countUniform1f(GLint l, GLfloat x) { live()[UNIFORM_UPLOADS]++; real().Uniform1f(l, x); }
+    static void APIENTRY countUniform2f(GLint l, GLfloat x, GLfloat y) { live()[UNIFORM_UPLOADS]++; real().Uniform2f(l, x, y); }
+    static void APIENTRY countUniform3f(GLint l, GLfloat x, GLfloat y, GLfloat z) { live()[UNIFORM_UPLOADS]++; real().Uniform3f(l, x, y, z); }
+    static void APIENTRY countUniform4f(GLint l, GLfloat x, GLfloat y, GLfloat z, GLfloat w) { live()[UNIFORM_UPLOADS]++; real().Uniform4f(l, x, y, z, w); }
+    static void APIENTRY countUniform2fv(GLint l, GLsizei n, const GLfloat* v) { live()[UNIFORM_UPLOADS]++; real().Uniform2fv(l, n, v); }
+    static void APIENTRY countUniform3fv(GLint l, GLsizei n, const GLfloat* v) { live()[UNIFORM_UPLOADS]++; real().Uniform3fv(l, n, v); }
+    static void APIENTRY countUniform4fv(GLint l, GLsizei n, const GLfloat* v) { live()[UNIFORM_UPLOADS]++; real().Uniform4fv(l, n, v); }
+    static void APIENTRY countUniformMatrix2fv(GLint l, GLsizei n, GLboolean t, const GLfloat* v) { live()[UNIFORM_UPLOADS]++; real().UniformMatrix2fv(l, n, t, v); }
+    static void APIENTRY countUniformMatrix3fv(GLint l, GLsizei n, GLboolean t, const GLfloat* v) { live()[UNIFORM_UPLOADS]++; real().UniformMatrix3fv(l, n, t, v); }
+    static void APIENTRY countUniformMatrix4fv(GLint l, GLsizei n, GLboolean t, const GLfloat* v) { live()[UNIFORM_UPLOADS]++; real().UniformMatrix4fv(l, n, t, v); }
+
+    static void APIENTRY countUseProgram(GLuint program) { live()[PROGRAM_BINDS]++; real().UseProgram(program); }
+    static void APIENTRY countBindVertexArray(GLuint vao) { live()[VERTEX_ARRAY_BINDS]++; real().BindVertexArray(vao); }
+    static void APIENTRY countBindBuffer(GLenum target, GLuint buffer) { live()[BUFFER_BINDS]++; real().BindBuffer(target, buffer); }
+    static void APIENTRY countBindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+    {
+        live()[BUFFER_BINDS]++;
+        real().BindBufferRange(target, index, buffer, offset, size);
+    }
+
+    static void APIENTRY countBufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage)
+    {
+        // allocating without data uploads nothing
+        if (data)
+            live()[BUFFER_BYTES] += (uint64_t)size;
+        real().BufferData(target, size, data, usage);
+    }
+    static void APIENTRY countBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data)
+    {
+        live()[BUFFER_BYTES] += (uint64_t)size;
+        real().BufferSubData(target, offset, size, data);
+    }
+    static void APIENTRY countCopyBufferSubData(GLenum read, GLenum write, GLintptr readOffset, GLintptr writeOffset, GLsizeiptr size)
+    {
+        live()[BUFFER_BYTES] += (uint64_t)size;
+        real().CopyBufferSubData(read, write, readOffset, writeOffset, size);
+    }
+    static void* APIENTRY countMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access)
+    {
+        if (access & GL_MAP_WRITE_BIT)
+            live()[BUFFER_BYTES] += (uint64_t)length;
+        return real().MapBufferRange(target, offset, length, access);
+    }
+
+    static void APIENTRY countTexImage2D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border,
+                                         GLenum format, GLenum type, const void* pixels)
+    {
+        live()[TEXTURE_UPLOADS]++;
+        real().TexImage2D(target, level, internalFormat, width, height, border, format, type, pixels);
+    }
+    static void APIENTRY countTexImage3D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLsizei depth,
+                                         GLint border, GLenum format, GLenum type, const void* pixels)
+    {
+        live()[TEXTURE_UPLOADS]++;
+        real().TexImage3D(target, level, internalFormat, width, height, depth, border, format, type, pixels);
+    }
+
+    static void APIENTRY countBindFramebuffer(GLenum target, GLuint framebuffer) { live()[FRAMEBUFFER_BINDS]++; real().BindFramebuffer(target, framebuffer); }
+    static void APIENTRY countEnable(GLenum cap) { live()[STATE_CHANGES]++; real().Enable(cap); }
+    static void APIENTRY countDisable(GLenum cap) { live()[STATE_CHANGES]++; real().Disable(cap); }
+    static void APIENTRY countBlendFunc(GLenum source, GLenum destination) { live()[STATE_CHANGES]++; real().BlendFunc(source, destination); }
+    static void APIENTRY countDepthFunc(GLenum func) { live()[STATE_CHANGES]++; real().DepthFunc(func); }
+    static void APIENTRY countDepthMask(GLboolean mask) { live()[STATE_CHANGES]++; real().DepthMask(mask); }
+    static void APIENTRY countViewport(GLint x, GLint y, GLsizei width, GLsizei height) { live()[STATE_CHANGES]++; real().Viewport(x, y, width, height); }
+    static void APIENTRY countScissor(GLint x, GLint y, GLsizei width, GLsizei height) { live()[STATE_CHANGES]++; real().Scissor(x, y, width, height); }
+
+#else
+    static const bool ENABLED = false;
+
+    void Install() {}
+    void BeginFrame() {}
+    void EndFrame() {}
+    const Frame* LastFrame() const { return nullptr; }
+    const Frame* FrameAt(uint64_t) const { return nullptr; }
+    const Frame* LastQueriedFrame() const { return nullptr; }
+    bool WriteCsv(const std::string &) const { return false; }
+#endif
+};
+
+#endif
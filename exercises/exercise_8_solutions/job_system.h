@@ -0,0 +1,288 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobSystem;
+
+// Counts the unfinished jobs of a group. Jobs added with a counter as dependency are started
+// once it drops to zero, so add every job of the group before adding jobs that depend on it.
+class JobCounter
+{
+public:
+    JobCounter() : value(0) {}
+
+    bool Done() const
+    {
+        return value.load() == 0;
+    }
+
+private:
+    friend class JobSystem;
+    struct Continuation
+    {
+        const char* name;
+        std::function<void()> function;
+        JobCounter* signal;
+    };
+
+    std::atomic<int> value;
+    std::mutex mutex;
+    std::vector<Continuation> continuations;
+};
+
+// one job execution, for the profiler. Times are in microseconds since JobSystem::BeginFrame()
+struct JobEvent
+{
+    const char* name;
+    int thread;
+    double start, end;
+};
+
+// Runs jobs on a pool of worker threads. Every thread (the main thread is thread 0) has its own deque:
+// it pushes and pops its own jobs at the back, and when it runs out it steals from the front of
+// another thread's deque. Waiting on a counter from the main thread runs jobs instead of blocking.
+class JobSystem
+{
+public:
+    explicit JobSystem(int workerCount = -1)
+    {
+        if (workerCount < 0)
+        {
+            int hardwareThreads = (int)std::thread::hardware_concurrency();
+            workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+        }
+        queues = std::vector<Queue>(workerCount + 1);
+        threadEvents.resize(workerCount + 1);
+        frameStart = std::chrono::high_resolution_clock::now();
+        for (int i = 1; i <= workerCount; i++)
+            workers.emplace_back(&JobSystem::workerLoop, this, i);
+    }
+
+    ~JobSystem()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            quit = true;
+        }
+        wake.notify_all();
+        for (std::thread &worker : workers)
+            worker.join();
+    }
+
+    int ThreadCount() const
+    {
+        return (int)queues.size();
+    }
+
+    // index of the calling thread, 0 for the main thread
+    static int ThreadIndex()
+    {
+        return threadIndex();
+    }
+
+    // adds a job, signal (if given) is decremented when it finishes.
+    // if dependsOn is given the job only starts once that counter is zero
+    void Run(const char* name, std::function<void()> function, JobCounter* signal = nullptr, JobCounter* dependsOn = nullptr)
+    {
+        if (signal)
+            signal->value.fetch_add(1);
+        if (dependsOn)
+        {
+            std::lock_guard<std::mutex> lock(dependsOn->mutex);
+            if (dependsOn->value.load() != 0)
+            {
+                dependsOn->continuations.push_back({ name, function, signal });
+                return;
+            }
+        }
+        push({ name, function, signal });
+    }
+
+    // splits [0, count) in chunks of `grain` items, each chunk is a job calling function(begin, end)
+    void ParallelFor(const char* name, int count, int grain, std::function<void(int, int)> function,
+                     JobCounter* signal, JobCounter* dependsOn = nullptr)
+    {
+        if (grain < 1)
+            grain = 1;
+        for (int begin = 0; begin < count; begin += grain)
+        {
+            int end = begin + grain < count ? begin + grain : count;
+            Run(name, [function, begin, end]() { function(begin, end); }, signal, dependsOn);
+        }
+    }
+
+    // runs jobs on the calling thread until the counter reaches zero
+    void Wait(JobCounter &counter)
+    {
+        int self = threadIndex();
+        while (!counter.Done())
+        {
+            Job job;
+            if (pop(self, job) || steal(self, job))
+                execute(job, self);
+            else
+                std::this_thread::yield();
+        }
+        std::lock_guard<std::mutex> lock(counter.mutex);
+    }
+
+    // starts a new frame of job events, call when no jobs are running
+    void BeginFrame()
+    {
+        for (std::vector<JobEvent> &events : threadEvents)
+            events.clear();
+        frameStart = std::chrono::high_resolution_clock::now();
+    }
+
+    // the job system thread the caller runs on, 0 for the main thread and any thread that is not a worker
+    static int CurrentThread() { return threadIndex(); }
+
+    // when BeginFrame() was called, the job events are relative to it
+    std::chrono::high_resolution_clock::time_point FrameStart() const { return frameStart; }
+
+    // the jobs executed since BeginFrame(), call when no jobs are running
+    std::vector<JobEvent> CollectEvents()
+    {
+        std::vector<JobEvent> all;
+        for (const std::vector<JobEvent> &events : threadEvents)
+            all.insert(all.end(), events.begin(), events.end());
+        return all;
+    }
+
+    // counters, since the start
+    std::atomic<unsigned int> jobsExecuted{ 0 };
+    std::atomic<unsigned int> jobsStolen{ 0 };
+
+private:
+    struct Job
+    {
+        const char* name;
+        std::function<void()> function;
+        JobCounter* signal;
+    };
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    std::vector<Queue> queues;
+    std::vector<std::thread> workers;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::atomic<int> pending{ 0 };
+    bool quit = false;
+
+    std::vector<std::vector<JobEvent>> threadEvents; // per thread, so recording needs no lock
+    std::chrono::high_resolution_clock::time_point frameStart;
+
+    static int& threadIndex()
+    {
+        static thread_local int index = 0;
+        return index;
+    }
+
+    void push(Job job)
+    {
+        int self = threadIndex();
+        {
+            std::lock_guard<std::mutex> lock(queues[self].mutex);
+            queues[self].jobs.push_back(job);
+        }
+        pending.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        wake.notify_one();
+    }
+
+    bool pop(int self, Job &job)
+    {
+        std::lock_guard<std::mutex> lock(queues[self].mutex);
+        if (queues[self].jobs.empty())
+            return false;
+        job = queues[self].jobs.back();
+        queues[self].jobs.pop_back();
+        pending.fetch_sub(1);
+        return true;
+    }
+
+    bool steal(int self, Job &job)
+    {
+        int count = (int)queues.size();
+        for (int i = 1; i < count; i++)
+        {
+            Queue &victim = queues[(self + i) % count];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (victim.jobs.empty())
+                continue;
+            job = victim.jobs.front();
+            victim.jobs.pop_front();
+            pending.fetch_sub(1);
+            jobsStolen.fetch_add(1);
+            return true;
+        }
+        return false;
+    }
+
+    void execute(Job &job, int self)
+    {
+        double start = elapsedMicroseconds();
+        job.function();
+        double end = elapsedMicroseconds();
+        threadEvents[self].push_back({ job.name, self, start, end });
+        jobsExecuted.fetch_add(1);
+        if (job.signal)
+            finish(*job.signal);
+    }
+
+    // the last job of a group starts the jobs waiting for it. The counter is only touched while
+    // its mutex is held, and Wait() takes the mutex once it sees zero, so the counter can be
+    // destroyed as soon as Wait() returns
+    void finish(JobCounter &counter)
+    {
+        std::vector<JobCounter::Continuation> ready;
+        {
+            std::lock_guard<std::mutex> lock(counter.mutex);
+            if (counter.value.fetch_sub(1) == 1)
+                ready.swap(counter.continuations);
+        }
+        for (JobCounter::Continuation &continuation : ready)
+            push({ continuation.name, continuation.function, continuation.signal });
+    }
+
+    double elapsedMicroseconds()
+    {
+        std::chrono::duration<double, std::micro> elapsed = std::chrono::high_resolution_clock::now() - frameStart;
+        return elapsed.count();
+    }
+
+    void workerLoop(int index)
+    {
+        threadIndex() = index;
+        while (true)
+        {
+            Job job;
+            if (pop(index, job) || steal(index, job))
+            {
+                execute(job, index);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [this]() { return quit || pending.load() > 0; });
+            if (quit)
+                return;
+        }
+    }
+};
+
+#endif
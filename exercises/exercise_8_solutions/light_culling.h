@@ -0,0 +1,114 @@
+#ifndef LIGHT_CULLING_H
+#define LIGHT_CULLING_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cmath>
+
+// Screen space extent of a light sphere, used to restrict the additive pass of positional lights
+struct LightScreenBounds
+{
+    bool visible;        // false if the sphere is completely behind the camera or past the far plane
+    bool fullScreen;     // the sphere contains the camera or crosses the near plane, no useful rectangle
+    int x, y, width, height; // scissor rectangle in pixels
+    float viewDepthMin, viewDepthMax; // distance range covered along the view direction
+};
+
+// per light counters of the work skipped by the culling, shown in the GUI
+struct LightPassStats
+{
+    bool skipped = false;     // the whole pass was skipped (no intensity, not visible or nothing lit)
+    int pixels = 0;           // pixels inside the scissor rectangle
+    int pixelsSaved = 0;      // pixels outside of it
+    int instancesDrawn = 0;
+    int instancesCulled = 0;
+    int meshesDrawn = 0;      // static meshes whose bounds touch the light sphere
+    int meshesCulled = 0;
+    float viewDepthMin = 0.0f, viewDepthMax = 0.0f;
+};
+
+// frustum planes (xyz normal, w distance) of a view projection matrix, pointing inwards
+inline void FrustumPlanes(const glm::mat4 &m, glm::vec4 planes[6])
+{
+    glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+    planes[0] = row3 + row0;
+    planes[1] = row3 - row0;
+    planes[2] = row3 + row1;
+    planes[3] = row3 - row1;
+    planes[4] = row3 + row2;
+    planes[5] = row3 - row2;
+    for (int i = 0; i < 6; i++)
+        planes[i] /= glm::length(glm::vec3(planes[i]));
+}
+
+// false when the sphere is completely outside of one of the planes of FrustumPlanes()
+inline bool SphereInFrustum(const glm::vec4 planes[6], const glm::vec3 &center, float radius)
+{
+    for (int i = 0; i < 6; i++)
+        if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius)
+            return false;
+    return true;
+}
+
+// projects the bounding box of the sphere to find the pixels it can touch
+inline LightScreenBounds ComputeLightScreenBounds(const glm::vec3 &center, float radius, const glm::mat4 &view,
+                                                  const glm::mat4 &projection, float cameraNear, float cameraFar,
+                                                  int viewportWidth, int viewportHeight)
+{
+    LightScreenBounds bounds;
+    bounds.visible = true;
+    bounds.fullScreen = false;
+    bounds.x = 0;
+    bounds.y = 0;
+    bounds.width = viewportWidth;
+    bounds.height = viewportHeight;
+
+    // the view looks towards -z, so the distance along the view direction is -z
+    glm::vec3 viewCenter = glm::vec3(view * glm::vec4(center, 1.0f));
+    bounds.viewDepthMin = -viewCenter.z - radius;
+    bounds.viewDepthMax = -viewCenter.z + radius;
+    if (bounds.viewDepthMax < cameraNear || bounds.viewDepthMin > cameraFar)
+    {
+        bounds.visible = false;
+        return bounds;
+    }
+    if (bounds.viewDepthMin <= cameraNear)
+    {
+        // part of the sphere is behind the near plane, its projection is unbounded
+        bounds.fullScreen = true;
+        return bounds;
+    }
+
+    glm::vec2 ndcMin(1.0f), ndcMax(-1.0f);
+    for (int c = 0; c < 8; c++)
+    {
+        glm::vec3 corner = viewCenter + glm::vec3((c & 1) ? radius : -radius, (c & 2) ? radius : -radius, (c & 4) ? radius : -radius);
+        glm::vec4 clip = projection * glm::vec4(corner, 1.0f);
+        glm::vec2 ndc = glm::vec2(clip.x, clip.y) / clip.w;
+        ndcMin = glm::min(ndcMin, ndc);
+        ndcMax = glm::max(ndcMax, ndc);
+    }
+    ndcMin = glm::max(ndcMin, glm::vec2(-1.0f));
+    ndcMax = glm::min(ndcMax, glm::vec2(1.0f));
+    if (ndcMin.x >= ndcMax.x || ndcMin.y >= ndcMax.y)
+    {
+        bounds.visible = false;
+        return bounds;
+    }
+
+    int x0 = (int)std::floor((ndcMin.x * 0.5f + 0.5f) * (float)viewportWidth);
+    int y0 = (int)std::floor((ndcMin.y * 0.5f + 0.5f) * (float)viewportHeight);
+    int x1 = (int)std::ceil((ndcMax.x * 0.5f + 0.5f) * (float)viewportWidth);
+    int y1 = (int)std::ceil((ndcMax.y * 0.5f + 0.5f) * (float)viewportHeight);
+    bounds.x = x0;
+    bounds.y = y0;
+    bounds.width = x1 - x0;
+    bounds.height = y1 - y0;
+    return bounds;
+}
+
+#endif
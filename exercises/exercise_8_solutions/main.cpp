@@ -7,6 +7,29 @@
 #include "shader.h"
 #include "camera.h"
 #include "model.h"
+#include "shadow_cache.h"
+#include "shadow_cascades.h"
+#include "shadow_atlas.h"
+#include "light_culling.h"
+#include "gl_state.h"
+#include "render_queue.h"
+#include "static_batch.h"
+#include "stream_buffer.h"
+#include "job_system.h"
+#include "command_list.h"
+#include "scene_graph.h"
+#include "ecs.h"
+#include "components.h"
+#include "profiler.h"
+#include "gl_stats.h"
+#include "camera_path.h"
+#include "overdraw.h"
+#include "dynamic_resolution.h"
+#include "translucency.h"
+#include "environment_bake.h"
+#include "brdf_lut.h"
+#include "material_lod.h"
+#include "density_lod.h"
 
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
@@ -24,8 +47,12 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 // ---------------
 const unsigned int SCR_WIDTH = 1280;
 const unsigned int SCR_HEIGHT = 720;
+unsigned int screenWidth = SCR_WIDTH, screenHeight = SCR_HEIGHT; // of the framebuffer, for the aspect ratio
+unsigned int sceneFramebuffer = 0; // the color passes draw here, 0 is the window
+unsigned int colorFramebuffer = 0; // where the color passes of the current frame draw: sceneFramebuffer or a debug target
 
-const unsigned int SHADOW_WIDTH = 2048, SHADOW_HEIGHT = 2048;
+// resolution of each cascade of the directional light shadow map
+int shadowResolution = 2048;
 
 // global variables used for rendering
 // -----------------------------------
@@ -36,24 +63,8 @@ Shader* pbr_shading;
 Shader* leaf_shading;
 //-------
 Shader* shadowMap_shader;
-Model* carBodyModel;
-Model* carPaintModel;
-Model* carInteriorModel;
-Model* carLightModel;
-Model* carWindowsModel;
-Model* carWheelModel;
-Model* floorModel;
-GLuint carBodyTexture;
-GLuint carPaintTexture;
-GLuint carLightTexture;
-GLuint carWindowsTexture;
-GLuint carWheelTexture;
-GLuint floorTexture;
-// @phij
-unsigned int leaf_texture;
-unsigned int leaf_texture_normal;
-unsigned int leaf_texture_translusency;
-unsigned int leaf_texture_roughness;
+// @phij - textures of the leaves, every leaf entity has this material
+MaterialComponent leafMaterial;
 //------------
 Camera camera(glm::vec3(0.0f, 1.6f, 5.0f));
 
@@ -61,8 +72,27 @@ Shader* skyboxShader;
 unsigned int skyboxVAO; // skybox handle
 unsigned int cubemapTexture; // skybox texture handle
 
-unsigned int shadowMap, shadowMapFBO;
-glm::mat4 lightSpaceMatrix;
+// image based lighting of the sky, baked on the CPU when the sky is loaded (or read from the cache file)
+EnvironmentBaker environmentBaker;
+unsigned int environmentMap;   // GGX prefiltered sky, mip i has roughness i / 5, read by the lighting shaders on unit 5
+unsigned int environmentBlock; // uniform buffer of the irradiance coefficients, the Environment block of the lighting shaders
+const unsigned int ENVIRONMENT_BINDING = 0;
+const char* environmentCacheFile = "environment_cache.bin";
+// scale and bias of F0 for the specular of the sky, by N.V and roughness (split sum), on unit 13
+BrdfLut brdfLut;
+unsigned int brdfLutTexture;
+
+unsigned int shadowMap = 0, shadowMapFBO = 0; // depth texture array, one layer per cascade
+ShadowCascades shadowCascades;
+std::vector<ShadowCache> shadowCaches; // one per cascade
+bool shadowCaching = true; // when disabled, the shadow map is redrawn every frame
+
+// positional lights share one depth texture, each gets a tile sized by how much of the screen it covers
+const int SHADOW_ATLAS_SIZE = 4096;
+ShadowAtlas shadowAtlas(SHADOW_ATLAS_SIZE, 64, 1024);
+unsigned int shadowAtlasMap, shadowAtlasFBO;
+unsigned int frameIndex = 0;     // frames rendered so far, used to find the least recently updated tiles
+unsigned int casterVersion = 1;  // incremented when the shadow casters change
 
 // global variables used for control
 // ---------------------------------
@@ -77,8 +107,8 @@ float lightRotationSpeed = 1.0f;
 // -------------------------------
 struct Light
 {
-    Light(glm::vec3 position, glm::vec3 color, float intensity, float radius)
-        : position(position), color(color), intensity(intensity), radius(radius)
+    Light(glm::vec3 position, glm::vec3 color, float intensity, float radius, bool castShadows = true)
+        : position(position), color(color), intensity(intensity), radius(radius), castShadows(castShadows)
     {
     }
 
@@ -86,24 +116,13 @@ struct Light
     glm::vec3 color;
     float intensity;
     float radius;
+    bool castShadows; // directional lights use the shadow cascades, positional lights a tile in the shadow atlas
 };
 
 // structure to hold config info
 // -------------------------------
 struct Config
 {
-    Config() : lights()
-    {
-        // Adding lights
-        //lights.emplace_back(position, color, intensity, radius);
-
-        // light 1
-        lights.emplace_back(glm::vec3(-1.0f, 1.0f, -0.5f), glm::vec3(1.0f, 1.0f, 1.0f), 30.0f, 0.0f);
-
-        // light 2
-        lights.emplace_back(glm::vec3( 1.0f, 1.5f, 0.0f), glm::vec3(0.7f, 0.2f, 1.0f), 0.0f, 10.0f);
-    }
-
     // ambient light
     glm::vec3 ambientLightColor = {1.0f, 1.0f, 1.0f};
     float ambientLightIntensity = 0.25f;
@@ -117,27 +136,48 @@ struct Config
     float roughness = 0.5f;
     float metalness = 0.0f;
 
-    std::vector<Light> lights;
-
 } config;
 
+// everything in the scene is an entity: the leaves, the meshes of loaded models and the lights
+// ---------------------------------------------------------------------------------------------
+EntityStore scene;
+// the lights in the order they were added, light i is lightEntities[i]. The first one is the directional light
+std::vector<Entity> lightEntities;
+Light& sceneLight(int lightIndex);
+int lightCount();
+void addLight(const Light &light);
+void addPointLight();
+void removeLight();
+
 
 // function declarations
 // ---------------------
+class CommandList;
+void initScene();
+void renderFrame();
+glm::vec4 ambientUniform(glm::vec3 ambientLightColor);
 void setAmbientUniforms(glm::vec3 ambientLightColor);
-void setLightUniforms(Light &light);
+void recordLightUniforms(CommandList &commands, Light &light);
 void setupForwardAdditionalPass();
 void resetForwardAdditionalPass();
 void drawSkybox();
-void drawShadowMap();
-void drawObjects();
+void recordShadowMap(CommandList &commands, const int viewport[4]);
+void recordShadowCasters(CommandList &commands);
+void recordMainPass(CommandList &commands, const glm::mat4 &viewProjection, const int viewport[4]);
 void drawGui();
 unsigned int initSkyboxBuffers();
-unsigned int loadCubemap(vector<std::string> faces);
+unsigned int loadCubemap(vector<std::string> faces, vector<CubemapFace>* loaded = nullptr);
+void createEnvironment(const vector<CubemapFace> &faces);
 void createShadowMap();
-void setShadowUniforms();
+void recordShadowUniforms(CommandList &commands);
+void createShadowAtlas();
+void recordShadowAtlas(CommandList &commands, const int viewport[4]);
+void recordLightShadowUniforms(CommandList &commands, int lightIndex);
+void buildRenderQueue(const glm::mat4 &view);
+void drawStaticMesh(Mesh &mesh, const glm::mat4 &model);
+void useStaticModelDepth();
 // == PHIJ ==
-void drawQuad();
+void initQuadBuffers();
 unsigned int loadTexture(string name);
 unsigned int loadTextureNoAlpha(string name);
 unsigned int loadTextureRED(string name);
@@ -146,10 +186,121 @@ float epsilon = 1.0f;
 float c = 1.0f;
 float maxThickness = 5.0f;
 float minThickness = 0.1f;;
-glm::mat4 models[100];
+const int MAX_LEAF_INSTANCES = 100;
+glm::mat4 models[MAX_LEAF_INSTANCES];
 int instanceCount = 1;
+unsigned int quadVAO, quadVBO;
+// per-instance model matrices of the leaves: the ones the color passes draw, grouped by material tier,
+// then every leaf at SHADOW_CASTERS_OFFSET for the shadow caster pass
+unsigned int instanceVBO;
+const GLintptr SHADOW_CASTERS_OFFSET = sizeof(models);
+// leaf transforms that change every frame (the leaves culled for each light pass) are streamed through
+// this ring, 3 frames of 1 MB, so writing them never waits for the GPU to finish drawing the previous ones
+StreamBuffer streamBuffer(1 << 20);
+bool lightCulling = true; // scissor and instance culling of the additive light passes
+std::vector<LightPassStats> lightPassStats;
+// result of the culling job of each light, turned into the commands of its pass by recordLightPass()
+struct LightPassPlan
+{
+    bool lit = false;       // the pass is drawn: the light has energy and reaches the screen
+    int count = 0;          // leaves to draw
+    bool scissor = false;
+    int scissorRect[4];
+    std::vector<glm::mat4> visibleModels[MaterialLod::TIER_COUNT]; // by material tier
+    // static meshes the light reaches, drawn after the leaves
+    struct MeshDraw
+    {
+        Mesh* mesh;
+        glm::mat4 model;
+    };
+    std::vector<MeshDraw> visibleMeshes;
+    bool everyMesh = false; // the static batches can draw them
+};
+std::vector<LightPassPlan> lightPassPlans;
+void cullLight(int lightIndex, const glm::mat4 &view, const glm::mat4 &projection, const int viewport[4]);
+void cullStaticMeshes(const Light &light, bool reachesAll, LightPassPlan &plan, LightPassStats &stats);
+void drawStaticModels(const LightPassPlan &plan);
+void recordLightPass(CommandList &commands, int lightIndex);
+void recordStaticModelUniforms(CommandList &commands);
+
+// the update phase of each frame (animation, culling, render queue) runs as jobs on these threads,
+// the main thread joins in and then issues every GL call on its own
+JobSystem jobSystem;
+std::vector<JobEvent> frameJobEvents; // jobs of the last frame, for the profiler
+
+// CPU and GPU timings of the last frames, shown as a timeline in the GUI and exported as a Chrome trace
+Profiler profiler;
+const char* traceFile = "frame_trace.json";
+void drawTimeline(const ProfileFrame &frame);
+
+// every GL call of the frame counted by category, only when built with GL_CALL_STATS
+GLStats glStats;
+const char* glStatsFile = "gl_stats.csv";
+
+// overdraw view: the color passes count the fragments of every pixel instead of shading them, shown as a heatmap
+OverdrawCounter overdraw;
+bool overdrawView = false;
+float overdrawScale = 8.0f; // fragments per pixel shown in red
+Shader* overdraw_shading;   // replaces the lighting shader, same vertex shader
+Shader* overdraw_skybox;    // replaces the skybox shader
+
+// the scene is drawn at a lower resolution when the GPU takes longer than the target, then scaled up to the screen
+DynamicResolution dynamicResolution;
+
+// the back-lit light of the leaves is shaded at a reduced resolution and upsampled by the leaf shader
+TranslucencyTarget translucency;
+Shader* translucency_shading;
+const int MAX_TRANSLUCENCY_LIGHTS = 16; // lights of the reduced pass, see translucency.frag. The others shade their own
+bool translucencyReduced = false;       // for the current frame, the leaf shader and not the overdraw view
+CommandList translucencyCommands;
+void recordTranslucencyPass(CommandList &commands, const glm::mat4 &viewProjection, const int viewport[4]);
+void recordTranslucencyUniforms(CommandList &commands, const int viewport[4]);
+// GPU time of the passes that shade the leaves: the reduced translucency pass, the main pass and the light passes
+double leafShadingMilliseconds(const ProfileFrame &frame);
+
+// the leaves are shaded with a cheaper material the smaller they are on screen, one instanced draw per tier
+MaterialLod materialLod;
+// and thinned out with the distance, the shadow casters keep every leaf
+DensityLod densityLod;
+float lodRoughness = 0.5f, lodTranslucency = 0.5f; // means over the opaque part of the leaf textures, for the cheaper tiers
+// the draws of the main pass, one list per tier so that each one is timed on its own
+CommandList leafTierCommands[MaterialLod::TIER_COUNT];
+const char* mainPassTierNames[MaterialLod::TIER_COUNT] = { "main pass near", "main pass mid", "main pass far" };
+void assignLeafLod(const glm::mat4 &view, const glm::mat4 &projection, const int viewport[4]);
+void measureLeafMaterial();
+
+// R starts and stops recording the camera and the second light, the headless benchmark plays the path back
+CameraPath recordedPath;
+bool recordingPath = false;
+float recordingTime = 0.0f;
+const char* cameraPathFile = "camera_path.csv";
+
+// the shadow, main and additive light passes are recorded by jobs into these lists, one list per job,
+// and replayed in order on the GL thread
+CommandList shadowMapCommands, shadowAtlasCommands, mainPassCommands;
+std::vector<CommandList> lightPassCommands; // one per light, the first light is drawn by the main pass
+
+// draws of the frame, sorted by pass, program, textures and depth before they are submitted
+RenderQueue renderQueue;
+
+// every transform of the scene: the leaves are the children of one root node, models add their node hierarchy
+SceneGraph sceneGraph;
+std::vector<SceneGraph::Range> changedNodes; // nodes whose world matrix changed this frame
+int leafRootNode = -1, firstLeafNode = -1;  // leaf i is node firstLeafNode + i
+glm::vec3 leafClusterPosition(0.0f);
+bool leafSway = false;
+void updateSceneGraph();
+void uploadSceneTransforms();
+
+// static models and the scene node of their root, drawn with one multi-draw per material when staticBatching is on
+std::vector<Model*> staticModels;
+std::vector<int> staticRoots;
+void addStaticModel(Model* model, const glm::mat4 &placement);
+StaticBatcher staticBatcher;
+bool staticBatching = true;
 // ==========
 
+#ifndef EXERCISE8_NO_MAIN
 int main()
 {
     // glfw: initialize and configure
@@ -177,6 +328,9 @@ int main()
     glfwSetCursorPosCallback(window, cursor_input_callback);
     glfwSetKeyCallback(window, key_input_callback);
     glfwSetScrollCallback(window, scroll_callback);
+    // the framebuffer can be larger than the window (high DPI screens), the callback only runs on changes
+    int framebufferWidth, framebufferHeight;
+    glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
 
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
@@ -187,50 +341,11 @@ int main()
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    glStats.Install();
+    framebuffer_size_callback(window, framebufferWidth, framebufferHeight);
 
-    // load the shaders and the 3D models
-    // ----------------------------------
-    phong_shading = new Shader("shaders/common_shading.vert", "shaders/phong_shading.frag");
-    pbr_shading = new Shader("shaders/common_shading.vert", "shaders/pbr_shading.frag");
-    leaf_shading = new Shader("shaders/common_shading.vert", "shaders/leaf_shading.frag");
-
-    shader = leaf_shading;
-
-
-    // - @PHIJ Texture Loading
-    leaf_texture = loadTexture("leaf05_basecolor_transparent.png"); // loads the texture
-    leaf_texture_normal = loadTexture("leaf05_normal.png");
-    leaf_texture_translusency = loadTextureRED("leaf05_translucency.png");
-    leaf_texture_roughness = loadTextureNoAlpha("leaf05_roughnessR.png");
-
-    // init skybox
-    vector<std::string> faces
-    {
-            "skybox/right.tga",
-            "skybox/left.tga",
-            "skybox/top.tga",
-            "skybox/bottom.tga",
-            "skybox/front.tga",
-            "skybox/back.tga"
-    };
-    cubemapTexture = loadCubemap(faces);
-    skyboxVAO = initSkyboxBuffers();
-    skyboxShader = new Shader("shaders/skybox.vert", "shaders/skybox.frag");
-
-    createShadowMap();
-    shadowMap_shader = new Shader("shaders/shadowmap.vert", "shaders/shadowmap.frag");
-
-    GenerateOffsets(); // @PHIJ - Generate the offsets and apply the values to the uniform.
+    initScene();
 
-
-    // set up the z-buffer
-    // -------------------
-    glDepthRange(-1,1); // make the NDC a right handed coordinate system, with the camera pointing towards -z
-    glEnable(GL_DEPTH_TEST); // turn on z-buffer depth test
-    glDepthFunc(GL_LESS); // draws fragments that are closer to the screen in NDC
-    
-    glEnable(GL_FRAMEBUFFER_SRGB);
-    
     // Dear IMGUI init
     // ---------------
     IMGUI_CHECKVERSION();
@@ -250,56 +365,24 @@ int main()
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-        glm::mat4 view = camera.GetViewMatrix();
-        glm::mat4 viewProjection = projection * view;
-
         processInput(window);
-
-        // Rotate light 2
-        if (lightRotationSpeed > 0.0f)
-        {   
-            glm::vec4 rotatedLight = glm::rotate(glm::mat4(1.0f), lightRotationSpeed * deltaTime, glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(config.lights[1].position, 1.0f);
-            config.lights[1].position = glm::vec3(rotatedLight.x, rotatedLight.y, rotatedLight.z);
-        }
-
-        glClearColor(0.3f, 0.3f, 0.3f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-
-        drawSkybox();
-
-        drawShadowMap();
-
-        shader->use();
-        
-        // First light + ambient
-        setAmbientUniforms(config.ambientLightColor * config.ambientLightIntensity);
-        setLightUniforms(config.lights[0]);
-        setShadowUniforms();
-
-        // @PHIJ - set epsilonC float to some constant,
-        // KEEP IN MIND: This is the result of Epsilon * C in Beers law.
-        shader->setFloat("epsilonC", epsilon * c);
-        shader->setFloat("minThickness", minThickness);
-        shader->setFloat("maxThickness", maxThickness);
-
-        drawObjects();
-        
-        // Additional additive lights
-        setupForwardAdditionalPass();
-        for (int i = 1; i < config.lights.size(); ++i)
+        if (recordingPath)
         {
-            setLightUniforms(config.lights[i]);
-            drawObjects();
+            recordingTime += deltaTime;
+            recordedPath.Add({ recordingTime, camera.Position, camera.Yaw, camera.Pitch, camera.Zoom, sceneLight(1).position });
         }
-        resetForwardAdditionalPass();
+        renderFrame();
 
         if (isPaused) {
+            GpuScope timer(profiler, "gui");
             drawGui();
         }
+        glStats.EndFrame();
 
-        glfwSwapBuffers(window);
+        {
+            ProfileScope swapping(profiler, "swap buffers");
+            glfwSwapBuffers(window);
+        }
         glfwPollEvents();
     }
 
@@ -312,12 +395,15 @@ int main()
     delete pbr_shading;
     delete shadowMap_shader;
     delete leaf_shading;
+    delete overdraw_shading;
+    delete overdraw_skybox;
 
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
     glfwTerminate();
     return 0;
 }
+#endif
 
 void drawGui(){
 
@@ -332,19 +418,21 @@ void drawGui(){
         ImGui::Text("Ambient light: ");
         ImGui::ColorEdit3("ambient light color", (float*)&config.ambientLightColor);
         ImGui::SliderFloat("ambient light intensity", &config.ambientLightIntensity, 0.0f, 1.0f);
+        ImGui::Text("sky lighting %s in %.1f ms, BRDF table in %.1f ms", environmentBaker.fromCache ? "loaded" : "baked",
+                    environmentBaker.milliseconds, brdfLut.milliseconds);
         ImGui::Separator();
         
         ImGui::Text("Light 1: ");
-        ImGui::DragFloat3("light 1 direction", (float*)&config.lights[0].position, .1f, -20, 20);
-        ImGui::ColorEdit3("light 1 color", (float*)&config.lights[0].color);
-        ImGui::SliderFloat("light 1 intensity", &config.lights[0].intensity, 0.0f, 50.0f);
+        ImGui::DragFloat3("light 1 direction", (float*)&sceneLight(0).position, .1f, -20, 20);
+        ImGui::ColorEdit3("light 1 color", (float*)&sceneLight(0).color);
+        ImGui::SliderFloat("light 1 intensity", &sceneLight(0).intensity, 0.0f, 50.0f);
         ImGui::Separator();
 
         ImGui::Text("Light 2: ");
-        ImGui::DragFloat3("light 2 position", (float*)&config.lights[1].position, .1f, -20, 20);
-        ImGui::ColorEdit3("light 2 color", (float*)&config.lights[1].color);
-        ImGui::SliderFloat("light 2 intensity", &config.lights[1].intensity, 0.0f, 50.0f);
-        ImGui::SliderFloat("light 2 radius", &config.lights[1].radius, 0.01f, 50.0f);
+        ImGui::DragFloat3("light 2 position", (float*)&sceneLight(1).position, .1f, -20, 20);
+        ImGui::ColorEdit3("light 2 color", (float*)&sceneLight(1).color);
+        ImGui::SliderFloat("light 2 intensity", &sceneLight(1).intensity, 0.0f, 50.0f);
+        ImGui::SliderFloat("light 2 radius", &sceneLight(1).radius, 0.01f, 50.0f);
         ImGui::SliderFloat("light 2 speed", &lightRotationSpeed, 0.0f, 2.0f);
         ImGui::Separator();
 
@@ -354,7 +442,9 @@ void drawGui(){
         ImGui::Separator();
         
         ImGui::Text("Instancing");
-        ImGui::SliderInt("instance Count", &instanceCount, 1, 100);
+        // the leaves drawn are the shadow casters of the atlas tiles
+        if (ImGui::SliderInt("instance Count", &instanceCount, 1, MAX_LEAF_INSTANCES))
+            casterVersion++;
         ImGui::Separator();
         
         
@@ -363,22 +453,324 @@ void drawGui(){
         ImGui::SliderFloat("Min", &minThickness, 0.01f, 10.0f);
         ImGui::Separator();
 
+        ImGui::Text("Translucency");
+        {
+            static const char* rates[] = { "full", "half", "quarter" };
+            int rate = translucency.divisor >= 4 ? 2 : translucency.divisor - 1;
+            if (ImGui::Combo("back-lit resolution", &rate, rates, 3))
+                translucency.divisor = rate == 2 ? 4 : rate + 1;
+            ImGui::SliderFloat("depth tolerance", &translucency.depthTolerance, 0.005f, 0.5f);
+            if (const ProfileFrame* frame = profiler.LatestResolvedFrame())
+                ImGui::Text("leaf shading %.3f ms GPU, %.3f ms of it in the reduced pass", leafShadingMilliseconds(*frame),
+                            frame->GpuTime("translucency") / 1000.0);
+        }
+        ImGui::Separator();
+
+        ImGui::Text("Material LOD");
+        ImGui::Checkbox("simplify the small leaves", &materialLod.enabled);
+        ImGui::SliderFloat("mid tier below (px)", &materialLod.midPixels, 1.0f, 256.0f);
+        ImGui::SliderFloat("far tier below (px)", &materialLod.farPixels, 1.0f, 128.0f);
+        {
+            const ProfileFrame* frame = profiler.LatestResolvedFrame();
+            for (int tier = 0; tier < MaterialLod::TIER_COUNT; tier++)
+                ImGui::Text("%s: %d leaves, %.3f ms GPU in the main pass", MaterialLod::TierName(tier), materialLod.count[tier],
+                            frame ? frame->GpuTime(mainPassTierNames[tier]) / 1000.0 : 0.0);
+        }
+        ImGui::Separator();
+
+        ImGui::Text("Density LOD");
+        ImGui::Checkbox("thin out the far leaves", &densityLod.enabled);
+        ImGui::SliderFloat("full density closer than", &densityLod.startDistance, 1.0f, 100.0f);
+        ImGui::SliderFloat("min density", &densityLod.minDensity, 0.01f, 1.0f);
+        ImGui::SliderFloat("fade band", &densityLod.fadeBand, 0.01f, 0.5f);
+        ImGui::Text("%d of %d leaves drawn, %d of them fading", densityLod.drawn, instanceCount, densityLod.fading);
+        ImGui::Separator();
+
+        ImGui::Text("Shadow cascades");
+        bool recreateShadowMap = ImGui::SliderInt("cascade count", &shadowCascades.count, 1, MAX_SHADOW_CASCADES);
+        static const char* resolutions[] = { "512", "1024", "2048", "4096" };
+        int resolutionIndex = shadowResolution >= 4096 ? 3 : shadowResolution >= 2048 ? 2 : shadowResolution >= 1024 ? 1 : 0;
+        if (ImGui::Combo("cascade resolution", &resolutionIndex, resolutions, 4))
+        {
+            shadowResolution = 512 << resolutionIndex;
+            recreateShadowMap = true;
+        }
+        if (recreateShadowMap)
+            createShadowMap();
+        ImGui::SliderFloat("split lambda", &shadowCascades.splitLambda, 0.0f, 1.0f);
+        ImGui::SliderFloat("shadow distance", &shadowCascades.shadowDistance, 1.0f, 100.0f);
+        ImGui::Separator();
+
+        ImGui::Text("Shadow atlas");
+        ImGui::SliderInt("tile updates per frame", &shadowAtlas.updatesPerFrame, 1, 32);
+        ImGui::Text("%d tiles updated, %d over budget, %.1f%% of the atlas in use", shadowAtlas.tilesUpdated, shadowAtlas.tilesPending,
+                    100.0f * (float)shadowAtlas.AllocatedTexels() / (float)(SHADOW_ATLAS_SIZE * SHADOW_ATLAS_SIZE));
+        if (ImGui::Button("add shadowed point light"))
+            addPointLight();
+        ImGui::SameLine();
+        if (ImGui::Button("remove") && lightCount() > 2)
+            removeLight();
+        ImGui::Text("%d lights", lightCount());
+        ImGui::Separator();
+
+        ImGui::Text("Light culling");
+        ImGui::Checkbox("scissor and cull light passes", &lightCulling);
+        for (int i = 1; i < (int)lightPassStats.size(); i++)
+        {
+            LightPassStats &stats = lightPassStats[i];
+            if (stats.skipped)
+                ImGui::Text("light %d: pass skipped", i + 1);
+            else
+                ImGui::Text("light %d: %d pixels saved, %d/%d leaves and %d/%d meshes drawn, depth %.1f to %.1f", i + 1, stats.pixelsSaved,
+                            stats.instancesDrawn, stats.instancesDrawn + stats.instancesCulled, stats.meshesDrawn,
+                            stats.meshesDrawn + stats.meshesCulled, stats.viewDepthMin, stats.viewDepthMax);
+        }
+        ImGui::Separator();
+
+        ImGui::Text("Shadow map cache");
+        ImGui::Checkbox("cache shadow map", &shadowCaching);
+        for (unsigned int i = 0; i < shadowCaches.size(); i++)
+        {
+            ShadowCache &cache = shadowCaches[i];
+            ImGui::Text("cascade %u: reused %u, region updates %u, full updates %u", i, cache.framesReused, cache.framesRegionUpdate, cache.framesFullUpdate);
+        }
+        if (ImGui::Button("reset counters"))
+            for (ShadowCache &cache : shadowCaches)
+                cache.ResetCounters();
+        ImGui::Separator();
+
+        ImGui::Text("Render queue");
+        ImGui::Text("%d draws, %d program switches, %d material switches", renderQueue.draws, renderQueue.programSwitches, renderQueue.materialSwitches);
+        ImGui::Separator();
+
+        ImGui::Text("Geometry arena");
+        ImGui::Text("%d meshes, %.2f of %.2f MB used, %d free ranges, fragmentation %.2f", meshArena.LiveAllocations(),
+                    (float)meshArena.BytesUsed() / (1024.0f * 1024.0f), (float)meshArena.BytesReserved() / (1024.0f * 1024.0f),
+                    meshArena.FreeRangeCount(), meshArena.Fragmentation());
+        ImGui::Text("%u grows, %u compactions, %u VAO binds (%u elided) last frame", meshArena.grows, meshArena.compactions,
+                    glState.lastIssued[GLState::VERTEX_ARRAY], glState.lastElided[GLState::VERTEX_ARRAY]);
+        ImGui::Separator();
+
+        ImGui::Text("Scene graph");
+        ImGui::DragFloat3("leaf cluster position", (float*)&leafClusterPosition, 0.1f, -20, 20);
+        ImGui::Checkbox("sway leaves", &leafSway);
+        ImGui::Text("%d nodes, %d updated in %d subtrees last frame", sceneGraph.Size(), sceneGraph.nodesUpdated, sceneGraph.subtreesUpdated);
+        ImGui::Separator();
+
+        ImGui::Text("Entities");
+        ImGui::Text("%d entities in %d archetypes", scene.EntityCount(), scene.ArchetypeCount());
+        for (int i = 0; i < scene.ArchetypeCount(); i++)
+        {
+            const EntityStore::Archetype &archetype = scene.GetArchetype(i);
+            ImGui::Text("  archetype %08x: %d entities, %d chunks of %d", archetype.Mask(), archetype.EntityCount(),
+                        archetype.ChunkCount(), archetype.ChunkCapacity());
+        }
+        ImGui::Separator();
+
+        ImGui::Text("Static batching");
+        ImGui::Checkbox("multi-draw static models", &staticBatching);
+        ImGui::Text("%d models, %d meshes in %d draw calls", (int)staticModels.size(), staticBatcher.meshCount,
+                    staticBatching ? staticBatcher.batchCount : staticBatcher.meshCount);
+        ImGui::Separator();
+
+        ImGui::Text("Stream buffer");
+        ImGui::Text("%.1f KB in %d uploads last frame, %d did not fit", (float)streamBuffer.bytesStreamed / 1024.0f,
+                    streamBuffer.allocations, streamBuffer.overflows);
+        ImGui::Text("%u waits for the GPU, %.2f ms in total", streamBuffer.waits, streamBuffer.waitMilliseconds);
+        ImGui::Separator();
+
+        ImGui::Text("Jobs");
+        ImGui::Text("%d threads, %u jobs run, %u stolen", jobSystem.ThreadCount(), jobSystem.jobsExecuted.load(), jobSystem.jobsStolen.load());
+        for (const JobEvent &event : frameJobEvents)
+            ImGui::Text("  thread %d: %s, %.0f to %.0f us", event.thread, event.name, event.start, event.end);
+        ImGui::Separator();
+
+        ImGui::Text("Command lists");
+        {
+            std::vector<const CommandList*> lists = { &shadowMapCommands, &shadowAtlasCommands, &translucencyCommands, &mainPassCommands };
+            for (const CommandList &tierCommands : leafTierCommands)
+                lists.push_back(&tierCommands);
+            for (int i = 1; i < (int)lightPassCommands.size(); i++)
+                lists.push_back(&lightPassCommands[i]);
+            int commandCount = 0;
+            size_t recordedBytes = 0, reservedBytes = 0;
+            for (const CommandList* list : lists)
+            {
+                commandCount += list->CommandCount();
+                recordedBytes += list->Size();
+                reservedBytes += list->Capacity();
+            }
+            ImGui::Text("%d lists, %d commands, %.1f KB recorded (%.1f KB reserved) last frame", (int)lists.size(), commandCount,
+                        (float)recordedBytes / 1024.0f, (float)reservedBytes / 1024.0f);
+        }
+        ImGui::Separator();
+
+        ImGui::Text("Profiler");
+        ImGui::Checkbox("record timings", &profiler.recording);
+        {
+            // oldest to newest, in milliseconds
+            float cpuTimes[Profiler::FRAME_HISTORY] = {}, gpuTimes[Profiler::FRAME_HISTORY] = {};
+            for (int i = 0; i < Profiler::FRAME_HISTORY; i++)
+            {
+                uint64_t frameNumber = profiler.CurrentFrame() + i;
+                const ProfileFrame* frame = frameNumber >= (uint64_t)Profiler::FRAME_HISTORY ? profiler.Frame(frameNumber - Profiler::FRAME_HISTORY) : nullptr;
+                if (frame && frame->index > 0)
+                {
+                    cpuTimes[i] = (float)frame->cpuDuration / 1000.0f;
+                    gpuTimes[i] = (float)frame->gpuDuration / 1000.0f;
+                }
+            }
+            ImGui::PlotLines("CPU ms", cpuTimes, Profiler::FRAME_HISTORY, 0, nullptr, 0.0f, 33.3f, ImVec2(0, 40));
+            ImGui::PlotLines("GPU ms", gpuTimes, Profiler::FRAME_HISTORY, 0, nullptr, 0.0f, 33.3f, ImVec2(0, 40));
+        }
+        if (const ProfileFrame* frame = profiler.LatestResolvedFrame())
+        {
+            ImGui::Text("frame %llu: %.2f ms CPU, %.2f ms GPU", (unsigned long long)frame->index, frame->cpuDuration / 1000.0,
+                        frame->gpuDuration / 1000.0);
+            drawTimeline(*frame);
+        }
+        ImGui::Text("%u GPU results dropped", profiler.gpuResultsDropped);
+        if (ImGui::Button("export Chrome trace"))
+        {
+            if (profiler.WriteChromeTrace(traceFile))
+                std::cout << "wrote the last " << Profiler::FRAME_HISTORY << " frames to " << traceFile << std::endl;
+            else
+                std::cout << "could not write " << traceFile << std::endl;
+        }
+        ImGui::Separator();
+
+        ImGui::Text("Dynamic resolution");
+        ImGui::Checkbox("scale the resolution to the GPU time", &dynamicResolution.enabled);
+        ImGui::SliderFloat("target GPU ms", &dynamicResolution.targetMilliseconds, 2.0f, 50.0f);
+        ImGui::SliderFloat("min scale", &dynamicResolution.minScale, 0.25f, 1.0f);
+        ImGui::SliderFloat("sharpness", &dynamicResolution.sharpness, 0.0f, 1.0f);
+        if (dynamicResolution.enabled)
+            ImGui::Text("drawn at %d x %d (%.0f%%), GPU %.2f ms, %.2f ms of it at any size", dynamicResolution.Width(), dynamicResolution.Height(),
+                        dynamicResolution.Scale() * 100.0f, dynamicResolution.MeasuredMilliseconds(), dynamicResolution.FixedMilliseconds());
+        ImGui::Separator();
+
+        ImGui::Text("Overdraw");
+        ImGui::Checkbox("show fragments per pixel", &overdrawView);
+        ImGui::SliderFloat("fragments shown in red", &overdrawScale, 2.0f, 64.0f);
+        if (const OverdrawStats* stats = overdraw.LastStats())
+        {
+            ImGui::Text("frame %llu: min %.0f, average %.2f, max %.0f fragments per pixel", (unsigned long long)stats->frame,
+                        stats->min, stats->average, stats->max);
+            // share of the pixels, bin i is shaded i times
+            float bins[OverdrawStats::HISTOGRAM_BINS];
+            for (int i = 0; i < OverdrawStats::HISTOGRAM_BINS; i++)
+                bins[i] = (float)stats->histogram[i] / (float)(stats->width * stats->height);
+            ImGui::PlotHistogram("pixels", bins, OverdrawStats::HISTOGRAM_BINS, 0, "0 to 15+ fragments", 0.0f, 1.0f, ImVec2(0, 60));
+            ImGui::Text("%llu fragments, %u readbacks dropped", (unsigned long long)stats->fragments, overdraw.readbacksDropped);
+        }
+        ImGui::Separator();
+
+        ImGui::Text("GL calls");
+        if (!GLStats::ENABLED)
+        {
+            ImGui::Text("build with -DGL_CALL_STATS=ON to count the GL calls");
+        }
+        else
+        {
+            if (const GLStats::Frame* frame = glStats.LastFrame())
+            {
+                for (int i = 0; i < GLStats::PRIMITIVES_GENERATED; i++)
+                    ImGui::Text("  %s: %llu", GLStats::CounterName(i), (unsigned long long)frame->counters[i]);
+            }
+            if (const GLStats::Frame* frame = glStats.LastQueriedFrame())
+            {
+                ImGui::Text("  %s: %llu, %s: %llu (frame %llu)", GLStats::CounterName(GLStats::PRIMITIVES_GENERATED),
+                            (unsigned long long)frame->counters[GLStats::PRIMITIVES_GENERATED], GLStats::CounterName(GLStats::SAMPLES_PASSED),
+                            (unsigned long long)frame->counters[GLStats::SAMPLES_PASSED], (unsigned long long)frame->index);
+            }
+            if (ImGui::Button("dump GL call counts"))
+            {
+                if (glStats.WriteCsv(glStatsFile))
+                    std::cout << "wrote the GL call counts of the last " << GLStats::FRAME_HISTORY << " frames to " << glStatsFile << std::endl;
+                else
+                    std::cout << "could not write " << glStatsFile << std::endl;
+            }
+        }
+        ImGui::Separator();
+
+        ImGui::Text("GL state");
+        ImGui::Text("%u calls issued, %u redundant calls elided last frame", glState.LastIssuedTotal(), glState.LastElidedTotal());
+        for (int i = 0; i < GLState::CATEGORY_COUNT; i++)
+            ImGui::Text("  %s: %u issued, %u elided", GLState::CategoryName(i), glState.lastIssued[i], glState.lastElided[i]);
+        ImGui::Separator();
+
         ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
         ImGui::End();
     }
 
     ImGui::Render();
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    // the ImGui backend changes GL state behind our back
+    glState.Invalidate();
 
 }
 
+// one row per track, the GPU on top and then the job system threads, over the length of the frame.
+// hovering a scope shows its name and duration
+void drawTimeline(const ProfileFrame &frame)
+{
+    const float rowHeight = 18.0f;
+    int rows = 1 + jobSystem.ThreadCount();
+    double length = std::max(frame.cpuDuration, frame.gpuDuration);
+    for (const ProfileEvent &event : frame.events)
+        length = std::max(length, event.end);
+    if (length <= 0.0)
+        return;
+
+    ImDrawList* drawList = ImGui::GetWindowDrawList();
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    float width = std::max(ImGui::GetContentRegionAvail().x, 100.0f);
+    float scale = width / (float)length;
+    drawList->AddRectFilled(origin, ImVec2(origin.x + width, origin.y + rows * rowHeight), IM_COL32(30, 30, 30, 255));
+
+    for (const ProfileEvent &event : frame.events)
+    {
+        int row = event.track == Profiler::GPU_TRACK ? 0 : 1 + event.track;
+        if (row >= rows)
+            continue;
+        ImVec2 min(origin.x + (float)event.start * scale, origin.y + row * rowHeight + 1.0f);
+        ImVec2 max(origin.x + std::max((float)event.end * scale, (float)event.start * scale + 1.0f), min.y + rowHeight - 2.0f);
+
+        // the same scope gets the same color every frame
+        size_t hash = std::hash<std::string>()(event.name);
+        ImU32 color = IM_COL32(80 + hash % 150, 80 + (hash >> 8) % 150, 80 + (hash >> 16) % 150, 255);
+        drawList->AddRectFilled(min, max, color);
+        if (max.x - min.x > 40.0f)
+        {
+            drawList->PushClipRect(min, max, true);
+            drawList->AddText(ImVec2(min.x + 2.0f, min.y), IM_COL32(0, 0, 0, 255), event.name);
+            drawList->PopClipRect();
+        }
+        if (ImGui::IsMouseHoveringRect(min, max))
+            ImGui::SetTooltip("%s: %.3f ms (%s)", event.name, (event.end - event.start) / 1000.0,
+                              event.track == Profiler::GPU_TRACK ? "GPU" : "CPU");
+    }
+    ImGui::Dummy(ImVec2(width, rows * rowHeight));
+    ImGui::Text("%.2f ms, top row GPU, then threads 0 to %d", length / 1000.0, rows - 2);
+}
+
+double leafShadingMilliseconds(const ProfileFrame &frame)
+{
+    return (frame.GpuTime("translucency") + frame.GpuTime("main pass") + frame.GpuTime("light pass")) / 1000.0;
+}
+
+glm::vec4 ambientUniform(glm::vec3 ambientLightColor)
+{
+    return glm::vec4(ambientLightColor, glm::length(ambientLightColor) > 0.0f ? 1.0f : 0.0f);
+}
+
 void setAmbientUniforms(glm::vec3 ambientLightColor)
 {
     // ambient uniforms
-    shader->setVec4("ambientLightColor", glm::vec4(ambientLightColor, glm::length(ambientLightColor) > 0.0f ? 1.0f : 0.0f));
+    shader->setVec4("ambientLightColor", ambientUniform(ambientLightColor));
 }
 
-void setLightUniforms(Light& light)
+void recordLightUniforms(CommandList &commands, Light& light)
 {
     glm::vec3 lightEnergy = light.color * light.intensity;
 
@@ -389,9 +781,9 @@ void setLightUniforms(Light& light)
     }
 
     // light uniforms
-    shader->setVec3("lightPosition", light.position);
-    shader->setVec3("lightColor", lightEnergy);
-    shader->setFloat("lightRadius", light.radius);
+    commands.SetVec3(shader->location("lightPosition"), light.position);
+    commands.SetVec3(shader->location("lightColor"), lightEnergy);
+    commands.SetFloat(shader->location("lightRadius"), light.radius);
 }
 
 void setupForwardAdditionalPass()
@@ -400,15 +792,14 @@ void setupForwardAdditionalPass()
     setAmbientUniforms(glm::vec3(0.0f));
 
     // Enable additive blending
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_ONE, GL_ONE);
+    glState.SetEnabled(GL_BLEND, true);
+    glState.BlendFunc(GL_ONE, GL_ONE);
 
     // Set depth test to GL_EQUAL (only the fragments that match the depth buffer are rendered)
-    glDepthFunc(GL_EQUAL);
+    glState.DepthFunc(GL_EQUAL);
 
     // Disable shadowmap
-    glActiveTexture(GL_TEXTURE5);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    glState.BindTexture(5, GL_TEXTURE_2D, 0);
 }
 
 void resetForwardAdditionalPass()
@@ -417,19 +808,20 @@ void resetForwardAdditionalPass()
     setAmbientUniforms(config.ambientLightColor * config.ambientLightIntensity);
 
     //Disable blend and restore default blend function
-    glDisable(GL_BLEND);
-    glBlendFunc(GL_ONE, GL_ZERO);
+    glState.SetEnabled(GL_BLEND, false);
+    glState.BlendFunc(GL_ONE, GL_ZERO);
 
     // Restore default depth test
-    glDepthFunc(GL_LESS);
+    glState.DepthFunc(GL_LESS);
 }
 
 unsigned int loadTextureNoAlpha(string name)
 {
+    ProfileScope loading(profiler, "load texture");
     unsigned int id = -1;
     // taken directly from: https://learnopengl.com/Getting-started/Textures
     glGenTextures(1, &id);
-    glBindTexture(GL_TEXTURE_2D, id);
+    glState.BindTexture(0, GL_TEXTURE_2D, id);
     // set the texture wrapping/filtering options (on the currently bound texture object)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -455,10 +847,11 @@ unsigned int loadTextureNoAlpha(string name)
 
 unsigned int loadTexture(string name)
 {
+    ProfileScope loading(profiler, "load texture");
     unsigned int id = -1;
 // taken directly from: https://learnopengl.com/Getting-started/Textures
     glGenTextures(1, &id);
-    glBindTexture(GL_TEXTURE_2D, id);
+    glState.BindTexture(0, GL_TEXTURE_2D, id);
     // set the texture wrapping/filtering options (on the currently bound texture object)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -484,10 +877,11 @@ unsigned int loadTexture(string name)
 
 unsigned int loadTextureRED(string name)
 {
+    ProfileScope loading(profiler, "load texture");
     unsigned int id = -1;
     // taken directly from: https://learnopengl.com/Getting-started/Textures
     glGenTextures(1, &id);
-    glBindTexture(GL_TEXTURE_2D, id);
+    glState.BindTexture(0, GL_TEXTURE_2D, id);
     // set the texture wrapping/filtering options (on the currently bound texture object)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -509,44 +903,91 @@ unsigned int loadTextureRED(string name)
 
     return id;
 }
+
+// mean roughness and translucency over the opaque part of the leaf, the constants of the cheaper material tiers.
+// read back from a small mip of the textures, weighted by the alpha of the albedo
+void measureLeafMaterial()
+{
+    auto readMip = [](GLuint texture, int &width, int &height) {
+        glState.BindTexture(0, GL_TEXTURE_2D, texture);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+        int level = 0;
+        while (width > 64 || height > 64)
+        {
+            width = std::max(width / 2, 1);
+            height = std::max(height / 2, 1);
+            level++;
+        }
+        std::vector<float> texels((size_t)width * height * 4);
+        if (!texels.empty())
+            glGetTexImage(GL_TEXTURE_2D, level, GL_RGBA, GL_FLOAT, &texels[0]);
+        return texels;
+    };
+    int alphaWidth, alphaHeight, roughnessWidth, roughnessHeight, translucencyWidth, translucencyHeight;
+    std::vector<float> albedo = readMip(leafMaterial.diffuse, alphaWidth, alphaHeight);
+    std::vector<float> roughness = readMip(leafMaterial.roughness, roughnessWidth, roughnessHeight);
+    std::vector<float> translucencyMap = readMip(leafMaterial.translucency, translucencyWidth, translucencyHeight);
+
+    // the mean of the red channel, alpha weighted when the mips line up
+    auto mean = [&albedo, alphaWidth, alphaHeight](const std::vector<float> &texels, int width, int height, float fallback) {
+        bool weighted = width == alphaWidth && height == alphaHeight;
+        double sum = 0.0, weights = 0.0;
+        for (size_t i = 0; i < texels.size(); i += 4)
+        {
+            double weight = weighted ? albedo[i + 3] : 1.0;
+            sum += texels[i] * weight;
+            weights += weight;
+        }
+        return weights > 0.0 ? (float)(sum / weights) : fallback;
+    };
+    // the shader takes one minus the red channel of the roughness texture
+    lodRoughness = 1.0f - mean(roughness, roughnessWidth, roughnessHeight, 0.5f);
+    lodTranslucency = mean(translucencyMap, translucencyWidth, translucencyHeight, 0.5f);
+}
 // PHIJ - Inspired from Excercise 9
-void drawQuad() 
-{
-    // Vertex Array/buffer Object identification init
-    static unsigned int quadVAO = 0, quadVBO;
-    if (quadVAO == 0) { // ensures that the vertex arrays are only generated once, and kept in the buffer for future use.
-
-        // Setup positions and Texture Coordiantes (Packed as 3 verticies, and 2 texture coords. strips of 5)
-        float quadVerticies[] = {
-                //pos   pos   pos | txtC  txtC | norm norm norm |  tangent (3) 
-                -1.0f, -1.0f, 0.0f, 0.0f, 0.0f, -0.25f, -0.25f, 1.0f, 1.0f, 0.0f, 0.0f,
-                -1.0f,  1.0f, 0.0f, 0.0f, 1.0f, -0.25f, 0.25f, 1.0f, 1.0f, 0.0f, 0.0f,
-                1.0f, -1.0f, 0.0f, 1.0f, 0.0f, 0.25f, -0.25f, 1.0f, 1.0f, 0.0f, 0.0f,
-                1.0f,  1.0f, 0.0f, 1.0f, 1.0f, 0.25f, 0.25f, 1.0f, 1.0f, 0.0f, 0.0f
-        };
-        
-        // Setup Plane Vertex Array Object
-        glGenVertexArrays(1, &quadVAO); // Generates a vertex array with an associated id
-        glGenBuffers(1, &quadVBO); // generates a buffer object with an associated ID
-        glBindVertexArray(quadVAO); // Binds Vertex Array, so we may work on it
-        glBindBuffer(GL_ARRAY_BUFFER, quadVBO); // Binds the buffer so we may work on it.
-        glBufferData(GL_ARRAY_BUFFER, sizeof(quadVerticies), &quadVerticies, GL_STATIC_DRAW); // sets the verticies into the buffer object that is currently bound.
-        
-        // pbr/common_shading (vertex) attribute array pointers.
-        glEnableVertexAttribArray(0); // - vertex
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float), (void*)0); // creates a pointer in memory to read data in the buffer. techiang it how to navigate inidvidual pieces.
-        glEnableVertexAttribArray(1); // - normal
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float) , (void*)(5 * sizeof(float))); // ?
-        glEnableVertexAttribArray(2); // - texture coords
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 11 * sizeof(float), (void*)(3 * sizeof(float)));
-        glEnableVertexAttribArray(3); // - tangent
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float), (void*)(8 * sizeof(float))); // ?
+void initQuadBuffers()
+{
+    // Setup positions and Texture Coordiantes (Packed as 3 verticies, and 2 texture coords. strips of 5)
+    float quadVerticies[] = {
+            //pos   pos   pos | txtC  txtC | norm norm norm |  tangent (3) 
+            -1.0f, -1.0f, 0.0f, 0.0f, 0.0f, -0.25f, -0.25f, 1.0f, 1.0f, 0.0f, 0.0f,
+            -1.0f,  1.0f, 0.0f, 0.0f, 1.0f, -0.25f, 0.25f, 1.0f, 1.0f, 0.0f, 0.0f,
+            1.0f, -1.0f, 0.0f, 1.0f, 0.0f, 0.25f, -0.25f, 1.0f, 1.0f, 0.0f, 0.0f,
+            1.0f,  1.0f, 0.0f, 1.0f, 1.0f, 0.25f, 0.25f, 1.0f, 1.0f, 0.0f, 0.0f
+    };
     
+    // Setup Plane Vertex Array Object
+    glGenVertexArrays(1, &quadVAO); // Generates a vertex array with an associated id
+    glGenBuffers(1, &quadVBO); // generates a buffer object with an associated ID
+    glState.BindVertexArray(quadVAO); // Binds Vertex Array, so we may work on it
+    glState.BindBuffer(GL_ARRAY_BUFFER, quadVBO); // Binds the buffer so we may work on it.
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quadVerticies), &quadVerticies, GL_STATIC_DRAW); // sets the verticies into the buffer object that is currently bound.
+    
+    // pbr/common_shading (vertex) attribute array pointers.
+    glEnableVertexAttribArray(0); // - vertex
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float), (void*)0); // creates a pointer in memory to read data in the buffer. techiang it how to navigate inidvidual pieces.
+    glEnableVertexAttribArray(1); // - normal
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float) , (void*)(5 * sizeof(float))); // ?
+    glEnableVertexAttribArray(2); // - texture coords
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 11 * sizeof(float), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(3); // - tangent
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float), (void*)(8 * sizeof(float))); // ?
+
+    // per-instance model matrix, a mat4 attribute takes 4 consecutive locations (one per column).
+    // locations 5 to 8, since 4 is the bitangent in the mesh layout. The command lists re-point them
+    // at the instances of each draw
+    glGenBuffers(1, &instanceVBO);
+    glState.BindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, 2 * sizeof(models), NULL, GL_DYNAMIC_DRAW);
+    for (int i = 0; i < 4; i++)
+    {
+        glEnableVertexAttribArray(5 + i);
+        glVertexAttribPointer(5 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(i * sizeof(glm::vec4)));
+        glVertexAttribDivisor(5 + i, 1); // advance once per instance, not per vertex
     }
-    // bind the vertex array... again?
-    glBindVertexArray(quadVAO);
-    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, instanceCount); // draw verticies in the vertex array as a triangle strip (memory effecient)
-    glBindVertexArray(0); // unbinds active VAO. presumably to avoid memory overflow.
+
+    glState.BindVertexArray(0);
 }
 
 // init the VAO of the skybox
@@ -604,8 +1045,8 @@ unsigned int initSkyboxBuffers() {
     glGenVertexArrays(1, &skyboxVAO);
     glGenBuffers(1, &skyboxVBO);
 
-    glBindVertexArray(skyboxVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
+    glState.BindVertexArray(skyboxVAO);
+    glState.BindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
 
     glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
     glEnableVertexAttribArray(0);
@@ -622,12 +1063,14 @@ unsigned int initSkyboxBuffers() {
 // -Y (bottom)
 // +Z (front)
 // -Z (back)
+// the decoded faces are copied to loaded when it is given
 // -------------------------------------------------------
-unsigned int loadCubemap(vector<std::string> faces)
+unsigned int loadCubemap(vector<std::string> faces, vector<CubemapFace>* loaded)
 {
+    ProfileScope loading(profiler, "load cubemap");
     unsigned int textureID;
     glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+    glState.BindTexture(0, GL_TEXTURE_CUBE_MAP, textureID);
 
     int width, height, nrComponents;
     for (unsigned int i = 0; i < faces.size(); i++)
@@ -636,6 +1079,14 @@ unsigned int loadCubemap(vector<std::string> faces)
         if (data)
         {
             glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_SRGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+            if (loaded)
+            {
+                CubemapFace face;
+                face.size = width;
+                face.components = nrComponents;
+                face.pixels.assign(data, data + (size_t)width * height * nrComponents);
+                loaded->push_back(std::move(face));
+            }
             stbi_image_free(data);
         }
         else
@@ -652,162 +1103,746 @@ unsigned int loadCubemap(vector<std::string> faces)
 
     glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
 
-    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
-
     return textureID;
 }
 
+// bakes the irradiance and the prefiltered sky from the faces of the skybox, integrates the BRDF table, and uploads them
+void createEnvironment(const vector<CubemapFace> &faces)
+{
+    {
+        ProfileScope baking(profiler, "bake environment");
+        if (!environmentBaker.Bake(faces, jobSystem, environmentCacheFile))
+            std::cout << "ERROR::ENVIRONMENT:: the skybox faces are not a cubemap, the sky lighting is black" << std::endl;
+    }
+
+    glGenTextures(1, &environmentMap);
+    glState.BindTexture(0, GL_TEXTURE_CUBE_MAP, environmentMap);
+    for (int level = 0; level < EnvironmentBaker::LEVELS; level++)
+    {
+        int size = EnvironmentBaker::LevelSize(level);
+        const std::vector<uint16_t> &texels = environmentBaker.levels[level];
+        for (int face = 0; face < 6; face++)
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGB16F, size, size, 0, GL_RGB, GL_HALF_FLOAT,
+                         texels.empty() ? nullptr : &texels[(size_t)face * size * size * 3]);
+    }
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, EnvironmentBaker::LEVELS - 1);
+    // the rough mips are a few texels wide, filtering across the faces hides their edges
+    glState.SetEnabled(GL_TEXTURE_CUBE_MAP_SEAMLESS, true);
+
+    // std140, a vec3 array is padded to vec4
+    glm::vec4 coefficients[EnvironmentBaker::SH_COUNT];
+    for (int i = 0; i < EnvironmentBaker::SH_COUNT; i++)
+        coefficients[i] = glm::vec4(environmentBaker.irradiance[i], 0.0f);
+    glGenBuffers(1, &environmentBlock);
+    glState.BindBuffer(GL_UNIFORM_BUFFER, environmentBlock);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(coefficients), coefficients, GL_STATIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, ENVIRONMENT_BINDING, environmentBlock);
+
+    {
+        ProfileScope integrating(profiler, "integrate brdf");
+        brdfLut.Generate(jobSystem);
+    }
+    glGenTextures(1, &brdfLutTexture);
+    glState.BindTexture(0, GL_TEXTURE_2D, brdfLutTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, BrdfLut::SIZE, BrdfLut::SIZE, 0, GL_RG, GL_HALF_FLOAT, brdfLut.texels.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
 void drawSkybox()
 {
     // render skybox
-    glDepthFunc(GL_LEQUAL);  // change depth function so depth test passes when values are equal to depth buffer's content
+    glState.DepthFunc(GL_LEQUAL);  // change depth function so depth test passes when values are equal to depth buffer's content
     skyboxShader->use();
-    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)screenWidth / (float)screenHeight, 0.1f, 100.0f);
     glm::mat4 view = camera.GetViewMatrix();
     skyboxShader->setMat4("projection", projection);
     skyboxShader->setMat4("view", view);
     skyboxShader->setInt("skybox", 0);
 
     // skybox cube
-    glBindVertexArray(skyboxVAO);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+    glState.BindVertexArray(skyboxVAO);
+    glState.BindTexture(0, GL_TEXTURE_CUBE_MAP, cubemapTexture);
     glDrawArrays(GL_TRIANGLES, 0, 36);
-    glBindVertexArray(0);
-    glDepthFunc(GL_LESS); // set depth function back to default
+    glState.DepthFunc(GL_LESS); // set depth function back to default
 }
 
 void createShadowMap()
 {
-    // create depth texture
+    // called again when the cascade count or resolution changes in the GUI
+    if (shadowMap != 0)
+    {
+        glDeleteTextures(1, &shadowMap);
+        glDeleteFramebuffers(1, &shadowMapFBO);
+        // deleting unbinds them, and the new names may reuse the old ones
+        glState.Invalidate();
+    }
+
+    // create depth texture array, one layer per cascade
     glGenTextures(1, &shadowMap);
-    glBindTexture(GL_TEXTURE_2D, shadowMap);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); // if you replace GL_LINEAR with GL_NEAREST you will see pixelation in the borders of the shadow
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR); // if you replace GL_LINEAR with GL_NEAREST you will see pixelation in the borders of the shadow
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    glState.BindTexture(0, GL_TEXTURE_2D_ARRAY, shadowMap);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT, shadowResolution, shadowResolution, shadowCascades.count, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR); // if you replace GL_LINEAR with GL_NEAREST you will see pixelation in the borders of the shadow
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR); // if you replace GL_LINEAR with GL_NEAREST you will see pixelation in the borders of the shadow
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
     float borderColor[] = { 1.0, 1.0, 1.0, 1.0 };
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
 
-    // attach depth texture as FBO's depth buffer
+    // the FBO has no color buffer, the depth attachment is switched to each layer when drawing
     glGenFramebuffers(1, &shadowMapFBO);
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, shadowMap, 0);
+    glState.BindFramebuffer(shadowMapFBO);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadowMap, 0, 0);
     glDrawBuffer(GL_NONE);
     glReadBuffer(GL_NONE);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glState.BindFramebuffer(0);
+
+    // the cached contents are gone with the old texture
+    shadowCaches.clear();
+    for (int i = 0; i < shadowCascades.count; i++)
+        shadowCaches.emplace_back(shadowResolution, shadowResolution);
 }
 
-void drawShadowMap()
+void recordShadowMap(CommandList &commands, const int viewport[4])
 {
-    Shader* currShader = shader;
-    shader = shadowMap_shader;
-
-    // setup depth shader
-    shader->use();
-
-    // We use an ortographic projection since it is a directional light.
-    // left, right, bottom, top, near and far values define the 3D volume relative to
-    // the light position and direction that will be rendered to produce the depth texture.
-    // Geometry outside of this range will not be considered when computing shadows.
-    float near_plane = 1.0f;
-    float shadowMapSize = 6.0f;
-    float shadowMapDepthRange = 10.0f;
-    float half = shadowMapSize / 2.0f;
-    glm::mat4 lightProjection = glm::ortho(-half, half, -half, half, near_plane, near_plane + shadowMapDepthRange);
-    glm::mat4 lightView = glm::lookAt(glm::normalize(config.lights[0].position) * shadowMapDepthRange * 0.5f, glm::vec3(0.0f), glm::vec3(0.0, 1.0, 0.0));
-    lightSpaceMatrix = lightProjection * lightView;
-    shader->setMat4("lightSpaceMatrix", lightSpaceMatrix);
+    // We use one ortographic projection per cascade since it is a directional light.
+    // Each cascade covers a slice of the camera frustum, so shadow map texels are spent
+    // where the camera is looking. Geometry outside of these volumes will not cast shadows.
+    glm::mat4 view = camera.GetViewMatrix();
+    shadowCascades.Update(view, glm::radians(camera.Zoom), (float)screenWidth / (float)screenHeight, 0.1f, 100.0f,
+                          sceneLight(0).position, shadowResolution);
+    commands.Reset();
 
     // setup framebuffer size
-    int viewport[4];
-    glGetIntegerv(GL_VIEWPORT, viewport);
-
-    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+    commands.Viewport(0, 0, shadowResolution, shadowResolution);
 
     // bind our depth texture to the frame buffer
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
+    commands.BindFramebuffer(shadowMapFBO);
 
-    // clear the depth texture/depth buffer
-    glClear(GL_DEPTH_BUFFER_BIT);
+    for (int i = 0; i < shadowCascades.count; i++)
+    {
+        // skip the cascade if its volume and the casters are the same as when it was last rendered.
+        // the leaf quad spans [-1, 1] in x and y, that is the local bounds of every caster
+        ShadowCache &cache = shadowCaches[i];
+        if (!shadowCaching)
+            cache.Invalidate();
+        ShadowCache::Update update = cache.Check(shadowCascades.lightSpaceMatrices[i], models, instanceCount, glm::vec3(-1.0f, -1.0f, 0.0f), glm::vec3(1.0f, 1.0f, 0.0f));
+        if (update == ShadowCache::UPDATE_NONE)
+            continue;
+
+        commands.FramebufferDepthLayer(shadowMap, i);
+
+        commands.UseProgram(shadowMap_shader->ID);
+        commands.SetMat4(shadowMap_shader->location("lightSpaceMatrix"), shadowCascades.lightSpaceMatrices[i]);
+
+        // only some casters changed, restrict the clear and the draw to the texels they cover
+        if (update == ShadowCache::UPDATE_REGION)
+        {
+            commands.SetEnabled(GL_SCISSOR_TEST, true);
+            commands.Scissor(cache.dirtyRect[0], cache.dirtyRect[1], cache.dirtyRect[2], cache.dirtyRect[3]);
+        }
 
-    // draw scene from the light's perspective into the depth texture
-    drawObjects();
+        // clear the depth texture/depth buffer
+        commands.Clear(GL_DEPTH_BUFFER_BIT);
+
+        // draw scene from the light's perspective into the depth texture
+        recordShadowCasters(commands);
+
+        commands.SetEnabled(GL_SCISSOR_TEST, false);
+    }
 
     // unbind the depth texture from the frame buffer, now we can render to the screen (frame buffer) again
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    commands.BindFramebuffer(colorFramebuffer);
 
-    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    commands.Viewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+void createShadowAtlas()
+{
+    glGenTextures(1, &shadowAtlasMap);
+    glState.BindTexture(0, GL_TEXTURE_2D, shadowAtlasMap);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_ATLAS_SIZE, SHADOW_ATLAS_SIZE, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // the shaders clamp the coordinates to the tile of each light, so the edge mode does not matter
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-    shader = currShader;
+    glGenFramebuffers(1, &shadowAtlasFBO);
+    glState.BindFramebuffer(shadowAtlasFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, shadowAtlasMap, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glState.BindFramebuffer(0);
 }
 
-void setShadowUniforms()
+void recordShadowAtlas(CommandList &commands, const int viewport[4])
 {
-    // shadow uniforms
-    shader->setMat4("lightSpaceMatrix", lightSpaceMatrix);
-    shader->setInt("shadowMap", 6);
-    glActiveTexture(GL_TEXTURE6);
-    glBindTexture(GL_TEXTURE_2D, shadowMap);
+    // bounding sphere of the casters, the light frustums are aimed at it
+    glm::vec3 casterMin(1e9f), casterMax(-1e9f);
+    for (int i = 0; i < instanceCount; i++)
+    {
+        glm::vec3 origin = glm::vec3(models[i][3]);
+        float extent = glm::length(glm::vec3(models[i][0])) + glm::length(glm::vec3(models[i][1]));
+        casterMin = glm::min(casterMin, origin - glm::vec3(extent));
+        casterMax = glm::max(casterMax, origin + glm::vec3(extent));
+    }
+    glm::vec3 casterCenter = (casterMin + casterMax) * 0.5f;
+    float casterRadius = glm::length(casterMax - casterMin) * 0.5f;
+
+    float tanHalfFov = std::tan(glm::radians(camera.Zoom) * 0.5f);
+    for (int i = 0; i < lightCount(); i++)
+    {
+        Light &light = sceneLight(i);
+        bool positional = light.radius > 0.0f;
+
+        // importance is the fraction of the screen height covered by the light sphere,
+        // lights that cannot light anything do not get a tile
+        float importance = 0.0f;
+        if (positional && light.castShadows && light.intensity > 0.0f)
+        {
+            float distance = glm::distance(camera.Position, light.position);
+            importance = distance <= light.radius ? 1.0f : glm::min(1.0f, light.radius / (distance * tanHalfFov));
+        }
+
+        // perspective frustum from the light towards the casters, up to the light radius
+        glm::mat4 lightSpaceMatrix(1.0f);
+        if (importance > 0.0f)
+        {
+            glm::vec3 toCasters = casterCenter - light.position;
+            float distance = glm::length(toCasters);
+            glm::vec3 dir = distance > 0.001f ? toCasters / distance : glm::vec3(0.0f, -1.0f, 0.0f);
+            float fov = distance > casterRadius ? 2.0f * std::asin(casterRadius / distance) : glm::radians(120.0f);
+            fov = glm::min(fov, glm::radians(120.0f));
+            glm::vec3 up = std::fabs(dir.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+            lightSpaceMatrix = glm::perspective(fov, 1.0f, 0.05f, light.radius) * glm::lookAt(light.position, light.position + dir, up);
+        }
+        shadowAtlas.Request(i, importance, lightSpaceMatrix, casterVersion);
+    }
+
+    commands.Reset();
+    std::vector<int> updates = shadowAtlas.CollectUpdates();
+    if (updates.empty())
+        return;
+
+    commands.BindFramebuffer(shadowAtlasFBO);
+    commands.SetEnabled(GL_SCISSOR_TEST, true);
+    commands.UseProgram(shadowMap_shader->ID);
+
+    // each tile is rendered through the same framebuffer, the viewport places it in the atlas
+    // and the scissor keeps the clear from touching the other tiles
+    for (int lightIndex : updates)
+    {
+        const ShadowAtlas::Slot* slot = shadowAtlas.GetSlot(lightIndex);
+        commands.Viewport(slot->tile.x, slot->tile.y, slot->tile.size, slot->tile.size);
+        commands.Scissor(slot->tile.x, slot->tile.y, slot->tile.size, slot->tile.size);
+        commands.Clear(GL_DEPTH_BUFFER_BIT);
+
+        commands.SetMat4(shadowMap_shader->location("lightSpaceMatrix"), slot->pendingMatrix);
+        recordShadowCasters(commands);
+
+        // the tile is drawn when the list is replayed later this frame
+        shadowAtlas.MarkUpdated(lightIndex, frameIndex);
+    }
+
+    commands.SetEnabled(GL_SCISSOR_TEST, false);
+    commands.BindFramebuffer(colorFramebuffer);
+    commands.Viewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+void recordLightShadowUniforms(CommandList &commands, int lightIndex)
+{
+    // atlas tile of the light, the matrix is the one the tile was last rendered with
+    bool hasShadow = shadowAtlas.HasShadow(lightIndex);
+    commands.SetInt(shader->location("lightHasShadow"), hasShadow ? 1 : 0);
+    if (hasShadow)
+    {
+        commands.SetMat4(shader->location("lightShadowMatrix"), shadowAtlas.GetSlot(lightIndex)->matrix);
+        commands.SetVec4(shader->location("shadowAtlasRect"), shadowAtlas.GetUVRect(lightIndex));
+    }
+    commands.SetInt(shader->location("shadowAtlas"), 9);
+    commands.BindTexture(9, GL_TEXTURE_2D, shadowAtlasMap);
+}
+
+void recordShadowCasters(CommandList &commands)
+{
+    // Depth only pass: the leaves read the same instance buffer as the color pass, and only the
+    // opacity texture is bound, to discard the transparent parts of the quad.
+    // No camera, light or material state is needed here. Every leaf casts, the density LOD is the
+    // one of the camera and would make the cached shadows depend on it
+    commands.SetEnabled(GL_DEPTH_TEST, true);
+    commands.DepthFunc(GL_LESS);
+
+    commands.BindTexture(0, GL_TEXTURE_2D, leafMaterial.opacity);
+
+    commands.DrawArraysInstanced(quadVAO, GL_TRIANGLE_STRIP, 4, instanceCount, instanceVBO, SHADOW_CASTERS_OFFSET);
+}
+
+void recordShadowUniforms(CommandList &commands)
+{
+    // shadow uniforms, the shaders pick the cascade from the view distance of the fragment
+    for (int i = 0; i < shadowCascades.count; i++)
+    {
+        commands.SetMat4(shader->location("lightSpaceMatrices[" + std::to_string(i) + "]"), shadowCascades.lightSpaceMatrices[i]);
+        commands.SetFloat(shader->location("cascadeSplits[" + std::to_string(i) + "]"), shadowCascades.splitFar[i]);
+    }
+    commands.SetInt(shader->location("cascadeCount"), shadowCascades.count);
+    commands.SetVec3(shader->location("camForward"), camera.Front);
+    commands.SetInt(shader->location("shadowMap"), 6);
+    commands.BindTexture(6, GL_TEXTURE_2D_ARRAY, shadowMap);
     //shader->setFloat("shadowBias", config.shadowBias * 0.01f);
 }
 
-void drawObjects()
+void addLeafMaterial(RenderItem &item)
 {
+    // Only leaf shader takes these
+    item.AddTexture(1, GL_TEXTURE_2D, leafMaterial.diffuse);
+    item.AddTexture(2, GL_TEXTURE_2D, leafMaterial.normal);
+    item.AddTexture(5, GL_TEXTURE_CUBE_MAP, environmentMap);
+    item.AddTexture(7, GL_TEXTURE_2D, leafMaterial.translucency);
+    item.AddTexture(8, GL_TEXTURE_2D, leafMaterial.roughness);
+    item.AddTexture(13, GL_TEXTURE_2D, brdfLutTexture);
+}
+
+void buildRenderQueue(const glm::mat4 &view)
+{
+    renderQueue.Clear();
+
+    // the skybox stays in front of everything else: the leaf pass runs without the depth test,
+    // so anything drawn after it would cover the leaves
+    RenderItem &sky = renderQueue.Add(RenderQueue::MakeKey(PASS_BACKGROUND, skyboxShader->ID, cubemapTexture, 0));
+    sky.shader = skyboxShader;
+    sky.AddTexture(0, GL_TEXTURE_CUBE_MAP, cubemapTexture);
+    sky.draw = []() { GpuScope timer(profiler, "skybox"); drawSkybox(); };
+
+    // the leaves are one instanced draw, sorted by the center of the instances
+    glm::vec3 leafCenter(0.0f);
+    scene.ForEach<BoundsComponent, InstanceComponent>([&leafCenter](int count, BoundsComponent* bounds, InstanceComponent* instances) {
+        for (int i = 0; i < count; i++)
+            if (instances[i].instance < instanceCount)
+                leafCenter += bounds[i].center;
+    });
+    leafCenter /= (float)instanceCount;
+    uint32_t leafDepth = RenderQueue::QuantizeDepth(-(view * glm::vec4(leafCenter, 1.0f)).z, 0.1f, 100.0f);
+
+    // First light + ambient
+    RenderItem &leaves = renderQueue.Add(RenderQueue::MakeKey(PASS_OPAQUE, shader->ID, leafMaterial.diffuse, leafDepth));
+    leaves.shader = shader;
+    addLeafMaterial(leaves);
+    leaves.draw = []() {
+        // the leaves are drawn without the depth test, the static models drawn before them turn it on
+        glState.SetEnabled(GL_DEPTH_TEST, false);
+        // the draw of each material tier in its own scope, the uniforms were set by the pass
+        for (int tier = 0; tier < MaterialLod::TIER_COUNT; tier++)
+        {
+            GpuScope timer(profiler, mainPassTierNames[tier]);
+            leafTierCommands[tier].Replay(streamBuffer);
+        }
+    };
+
+    // static models, grouped by material in a few multi-draws, or one draw per mesh
+    if (staticBatching && !staticModels.empty())
+    {
+        // material 0 sorts first in the pass, after the begin hook has set the uniforms of the frame
+        RenderItem &batches = renderQueue.Add(RenderQueue::MakeKey(PASS_OPAQUE, shader->ID, 0, 0));
+        batches.shader = shader;
+        batches.draw = []() { GpuScope timer(profiler, "static batches"); useStaticModelDepth(); staticBatcher.Draw(shader); };
+    }
+    else
+    {
+        // one item per mesh entity, grouped by diffuse texture and sorted by the distance to the camera
+        scene.ForEach<TransformComponent, BoundsComponent, MeshComponent, MaterialComponent>(
+            [&view](int count, TransformComponent* transforms, BoundsComponent* bounds, MeshComponent* meshes, MaterialComponent* materials) {
+                for (int i = 0; i < count; i++)
+                {
+                    float viewDepth = -(view * glm::vec4(bounds[i].center, 1.0f)).z;
+                    RenderItem &item = renderQueue.Add(RenderQueue::MakeKey(PASS_OPAQUE, shader->ID, materials[i].diffuse,
+                                                                            RenderQueue::QuantizeDepth(viewDepth, 0.1f, 100.0f)));
+                    item.shader = shader;
+                    Mesh* mesh = &meshes[i].model->meshes[meshes[i].mesh];
+                    glm::mat4 model = transforms[i].world;
+                    item.draw = [mesh, model]() { useStaticModelDepth(); drawStaticMesh(*mesh, model); };
+                }
+            });
+    }
+
+    // Additional additive lights, restricted to the pixels and leaves each light can reach.
+    // they share the same key, the sort is stable so they keep the light order
+    for (int i = 1; i < lightCount(); ++i)
+    {
+        RenderItem &lit = renderQueue.Add(RenderQueue::MakeKey(PASS_ADDITIVE, shader->ID, leafMaterial.diffuse, leafDepth));
+        lit.shader = shader;
+        addLeafMaterial(lit);
+        const char* passName = profiler.Name("light pass " + std::to_string(i));
+        lit.draw = [i, passName]() {
+            GpuScope timer(profiler, passName);
+            if (!lightPassPlans[i].lit)
+                return;
+            lightPassCommands[i].Replay(streamBuffer);
+            drawStaticModels(lightPassPlans[i]);
+        };
+    }
+}
+
+// one mesh of a static model, at its world matrix
+void drawStaticMesh(Mesh &mesh, const glm::mat4 &model)
+{
+    // the arena VAO has no instance attributes, so the constant value of the
+    // instanceModel attribute (locations 5 to 8) is used for every vertex
+    for (int c = 0; c < 4; c++)
+        glVertexAttrib4fv(5 + c, &model[c][0]);
+    mesh.Draw(*shader);
+}
+
+// the depth state of the static models in the opaque pass. Unlike the leaves they are solid, and are drawn
+// with the depth test and depth writes
+void useStaticModelDepth()
+{
+    glState.SetEnabled(GL_DEPTH_TEST, true);
+    glState.DepthFunc(GL_LESS);
+    glState.DepthMask(true);
+}
+
+// the static meshes a light reaches, in its additive pass: the batches when it reaches all of them, else each
+// mesh. The opaque pass sorts the meshes as items of the queue instead
+void drawStaticModels(const LightPassPlan &plan)
+{
+    // the depth function is GL_EQUAL in the additive pass, the leaves of the light were drawn without the test
+    if (!plan.visibleMeshes.empty())
+        glState.SetEnabled(GL_DEPTH_TEST, true);
+    if (plan.everyMesh && staticBatching && !staticModels.empty())
+    {
+        staticBatcher.Draw(shader);
+        return;
+    }
+    for (const LightPassPlan::MeshDraw &draw : plan.visibleMeshes)
+        drawStaticMesh(*draw.mesh, draw.model);
+}
+
+// the static meshes whose bounding sphere touches the light sphere, all of them for a light that reaches everything
+void cullStaticMeshes(const Light &light, bool reachesAll, LightPassPlan &plan, LightPassStats &stats)
+{
+    plan.visibleMeshes.clear();
+    int meshCount = 0;
+    scene.ForEach<TransformComponent, BoundsComponent, MeshComponent>(
+        [&light, reachesAll, &plan, &meshCount](int count, TransformComponent* transforms, BoundsComponent* bounds, MeshComponent* meshes) {
+            for (int i = 0; i < count; i++)
+            {
+                glm::vec3 offset = bounds[i].center - light.position;
+                float reach = light.radius + bounds[i].radius;
+                if (reachesAll || glm::dot(offset, offset) <= reach * reach)
+                    plan.visibleMeshes.push_back({ &meshes[i].model->meshes[meshes[i].mesh], transforms[i].world });
+            }
+            meshCount += count;
+        });
+    plan.everyMesh = (int)plan.visibleMeshes.size() == meshCount;
+    stats.meshesDrawn = (int)plan.visibleMeshes.size();
+    stats.meshesCulled = meshCount - stats.meshesDrawn;
+}
+
+// decides how the pass of a light is drawn, without any GL calls so it can run in a job
+void cullLight(int lightIndex, const glm::mat4 &view, const glm::mat4 &projection, const int viewport[4])
+{
+    Light &light = sceneLight(lightIndex);
+    LightPassStats &stats = lightPassStats[lightIndex];
+    LightPassPlan &plan = lightPassPlans[lightIndex];
+    stats = LightPassStats();
+    plan.lit = false;
+    plan.count = 0;
+    plan.scissor = false;
+
+    int screenPixels = viewport[2] * viewport[3];
+
+    // a light without energy adds nothing
+    if (light.intensity <= 0.0f || glm::dot(light.color, light.color) <= 0.0f)
+    {
+        stats.skipped = true;
+        stats.pixelsSaved = screenPixels;
+        stats.instancesCulled = instanceCount;
+        return;
+    }
+
+    // directional lights reach everything
+    if (!lightCulling || light.radius <= 0.0f)
+    {
+        stats.pixels = screenPixels;
+        stats.instancesDrawn = materialLod.Drawn();
+        stats.instancesCulled = instanceCount - materialLod.Drawn();
+        cullStaticMeshes(light, true, plan, stats);
+        plan.lit = true;
+        plan.count = materialLod.Drawn();
+        return;
+    }
+
+    // GetAttenuation() is zero past the radius, so nothing outside of the sphere gets any light.
+    // core OpenGL 3.3 has no depth bounds test, the depth range is used to reject the pass instead
+    LightScreenBounds bounds = ComputeLightScreenBounds(light.position, light.radius, view, projection, 0.1f, 100.0f, viewport[2], viewport[3]);
+    stats.viewDepthMin = bounds.viewDepthMin;
+    stats.viewDepthMax = bounds.viewDepthMax;
+    for (std::vector<glm::mat4> &tierModels : plan.visibleModels)
+        tierModels.clear();
+    int count = 0;
+    plan.visibleMeshes.clear();
+    if (bounds.visible)
+    {
+        // culling system: the leaves drawn whose bounding sphere, grown by the density LOD, touches the
+        // light sphere, by tier in instance order
+        scene.ForEach<BoundsComponent, InstanceComponent>([&light, &plan, &count](int entities, BoundsComponent* spheres, InstanceComponent* instances) {
+            for (int i = 0; i < entities; i++)
+            {
+                int instance = instances[i].instance;
+                int tier = instance < instanceCount ? materialLod.TierOf(instance) : MaterialLod::TIER_DROPPED;
+                if (tier == MaterialLod::TIER_DROPPED)
+                    continue;
+                glm::vec3 offset = spheres[i].center - light.position;
+                float reach = light.radius + spheres[i].radius * densityLod.ScaleOf(instance);
+                if (glm::dot(offset, offset) <= reach * reach)
+                {
+                    plan.visibleModels[tier].push_back(materialLod.ModelOf(instance));
+                    count++;
+                }
+            }
+        });
+        cullStaticMeshes(light, false, plan, stats);
+    }
+    if (!bounds.visible || (count == 0 && plan.visibleMeshes.empty()))
+    {
+        stats.skipped = true;
+        stats.pixelsSaved = screenPixels;
+        stats.instancesCulled = instanceCount;
+        return;
+    }
+
+    if (bounds.fullScreen)
+    {
+        stats.pixels = screenPixels;
+    }
+    else
+    {
+        plan.scissor = true;
+        plan.scissorRect[0] = viewport[0] + bounds.x;
+        plan.scissorRect[1] = viewport[1] + bounds.y;
+        plan.scissorRect[2] = bounds.width;
+        plan.scissorRect[3] = bounds.height;
+        stats.pixels = bounds.width * bounds.height;
+    }
+    stats.pixelsSaved = screenPixels - stats.pixels;
+    stats.instancesDrawn = count;
+    stats.instancesCulled = instanceCount - count;
+    plan.lit = true;
+    plan.count = count;
+}
+
+// records the pass of a light from the result of cullLight(): the scissor and the leaves the light reaches.
+// The static models are drawn after it by the render queue, with the light uniforms it leaves set
+void recordLightPass(CommandList &commands, int lightIndex)
+{
+    commands.Reset();
+    LightPassPlan &plan = lightPassPlans[lightIndex];
+    if (!plan.lit)
+        return;
+
+    // the leaves without the depth test like in the main pass, the static models of the last light turned it on
+    commands.SetEnabled(GL_DEPTH_TEST, false);
+    commands.SetEnabled(GL_SCISSOR_TEST, plan.scissor);
+    if (plan.scissor)
+        commands.Scissor(plan.scissorRect[0], plan.scissorRect[1], plan.scissorRect[2], plan.scissorRect[3]);
+
+    // the back-lit light of the first lights was added by the main pass
+    commands.SetInt(shader->location("translucencyMode"), translucencyReduced && lightIndex < MAX_TRANSLUCENCY_LIGHTS ? 2 : 0);
+    recordLightUniforms(commands, sceneLight(lightIndex));
+    recordLightShadowUniforms(commands, lightIndex);
+
+    // one draw per material tier. The leaves that survived are streamed, if the ring is full this frame
+    // every leaf of the tier is drawn instead
+    bool everyLeaf = plan.count == materialLod.Drawn();
+    for (int tier = 0; tier < MaterialLod::TIER_COUNT; tier++)
+    {
+        const std::vector<glm::mat4> &tierModels = plan.visibleModels[tier];
+        GLintptr tierOffset = materialLod.first[tier] * sizeof(glm::mat4);
+        if (everyLeaf ? materialLod.count[tier] == 0 : tierModels.empty())
+            continue;
+        commands.SetInt(shader->location("materialTier"), tier);
+        if (everyLeaf)
+            commands.DrawArraysInstanced(quadVAO, GL_TRIANGLE_STRIP, 4, materialLod.count[tier], instanceVBO, tierOffset);
+        else
+            commands.DrawArraysInstancedStreamed(quadVAO, GL_TRIANGLE_STRIP, 4, &tierModels[0], (int)tierModels.size(), instanceVBO,
+                                                 materialLod.count[tier], tierOffset);
+    }
+    recordStaticModelUniforms(commands);
+}
+
+// the reduced resolution pass of the back-lit light of the leaves, every light at once, see translucency.h
+void recordTranslucencyPass(CommandList &commands, const glm::mat4 &viewProjection, const int viewport[4])
+{
+    commands.Reset();
+    if (!translucencyReduced)
+        return;
+
+    commands.BindFramebuffer(translucency.Framebuffer());
+    commands.Viewport(0, 0, translucency.ReducedSize(viewport[2]), translucency.ReducedSize(viewport[3]));
+    commands.SetEnabled(GL_SCISSOR_TEST, false);
+    // the leaves that are not drawn over a pixel have no guide, the upsampling ignores them
+    commands.ClearColorBuffer(0, glm::vec4(0.0f));
+    commands.ClearColorBuffer(1, glm::vec4(0.0f));
+    // no depth test and no blending like the main pass, so the last leaf drawn over a pixel is the one in both
+    commands.SetEnabled(GL_DEPTH_TEST, false);
+    commands.SetEnabled(GL_BLEND, false);
+
+    commands.UseProgram(translucency_shading->ID);
+    commands.SetVec3(translucency_shading->location("camPosition"), camera.Position);
+    commands.SetMat4(translucency_shading->location("viewProjection"), viewProjection);
+    commands.SetFloat(translucency_shading->location("epsilonC"), epsilon * c);
+    commands.SetFloat(translucency_shading->location("minThickness"), minThickness);
+    commands.SetFloat(translucency_shading->location("maxThickness"), maxThickness);
+    commands.SetInt(translucency_shading->location("texture_diffuse1"), 1);
+    commands.SetInt(translucency_shading->location("texture_normal1"), 2);
+    commands.SetInt(translucency_shading->location("texture_translucency1"), 7);
+    commands.BindTexture(1, GL_TEXTURE_2D, leafMaterial.diffuse);
+    commands.BindTexture(2, GL_TEXTURE_2D, leafMaterial.normal);
+    commands.BindTexture(7, GL_TEXTURE_2D, leafMaterial.translucency);
+
+    int count = std::min(lightCount(), MAX_TRANSLUCENCY_LIGHTS);
+    commands.SetInt(translucency_shading->location("lightCount"), count);
+    for (int i = 0; i < count; i++)
+    {
+        Light &light = sceneLight(i);
+        std::string index = "[" + std::to_string(i) + "]";
+        commands.SetVec3(translucency_shading->location("lightPositions" + index), light.position);
+        commands.SetVec3(translucency_shading->location("lightColors" + index), light.color * light.intensity);
+        commands.SetFloat(translucency_shading->location("lightRadii" + index), light.radius);
+    }
+
+    commands.DrawArraysInstanced(quadVAO, GL_TRIANGLE_STRIP, 4, materialLod.Drawn(), instanceVBO, 0);
+
+    commands.BindFramebuffer(colorFramebuffer);
+    commands.Viewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+// the reduced pass as the leaf shader reads it, in the pixels of the color passes
+void recordTranslucencyUniforms(CommandList &commands, const int viewport[4])
+{
+    int width = translucency.ReducedSize(viewport[2]), height = translucency.ReducedSize(viewport[3]);
+    commands.SetInt(shader->location("translucencyLight"), 11);
+    commands.SetInt(shader->location("translucencyGuide"), 12);
+    commands.BindTexture(11, GL_TEXTURE_2D, translucency.LightTexture());
+    commands.BindTexture(12, GL_TEXTURE_2D, translucency.GuideTexture());
+    commands.SetVec2(shader->location("translucencyScale"), glm::vec2((float)width / viewport[2], (float)height / viewport[3]));
+    commands.SetVec2(shader->location("translucencySize"), glm::vec2((float)width, (float)height));
+    commands.SetFloat(shader->location("translucencyDepthTolerance"), translucency.depthTolerance);
+}
+
+// the uniforms of the leaf shader for the frame, then the first light + ambient draw of every leaf
+void recordMainPass(CommandList &commands, const glm::mat4 &viewProjection, const int viewport[4])
+{
+    commands.Reset();
+
     // the typical transformation uniforms are already set for you, these are:
     // projection (perspective projection matrix)
     // view (to map world space coordinates to the camera space, so the camera position becomes the origin)
     // model (for each model part we draw) <-- @PHIJ -- omitted for this project --
+    commands.UseProgram(shader->ID); // applies current shader.
+
+    // uniforms shared by every draw of the leaf shader this frame, the additive passes keep them
+    commands.SetVec4(shader->location("ambientLightColor"), ambientUniform(config.ambientLightColor * config.ambientLightIntensity));
+    recordShadowUniforms(commands);
+
+    // @PHIJ - set epsilonC float to some constant,
+    // KEEP IN MIND: This is the result of Epsilon * C in Beers law.
+    commands.SetFloat(shader->location("epsilonC"), epsilon * c);
+    commands.SetFloat(shader->location("minThickness"), minThickness);
+    commands.SetFloat(shader->location("maxThickness"), maxThickness);
+    if (translucencyReduced)
+        recordTranslucencyUniforms(commands, viewport);
+    // the leaf draws set their own, the static models may come first
+    recordStaticModelUniforms(commands);
 
-    // camera parameters
-    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-    glm::mat4 view = camera.GetViewMatrix();
-    glm::mat4 viewProjection = projection * view;
-    
     // camera position
-    shader->setVec3("camPosition", camera.Position);
+    commands.SetVec3(shader->location("camPosition"), camera.Position);
     // set viewProjection matrix uniform
-    shader->setMat4("viewProjection", viewProjection);
+    commands.SetMat4(shader->location("viewProjection"), viewProjection);
 
-    // set up skybox texture
-    shader->setInt("skybox", 5);
-    glActiveTexture(GL_TEXTURE5);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+    // set up the prefiltered sky and the BRDF table, bound by the render queue
+    commands.SetInt(shader->location("skybox"), 5);
+    commands.SetInt(shader->location("brdfLut"), 13);
 
     // @PHIJ -- Draw Quad --
-    shader->use(); // applies current shader.
-    
-    shader->setMat4("model", glm::mat4(1)); // Sets the identity matrix to model (?)
-    shader->setMat4("viewProjection", viewProjection); // applies the view projection matrix.
-
-    glEnable(GL_DEPTH_TEST); 
+    commands.SetMat4(shader->location("model"), glm::mat4(1)); // Sets the identity matrix to model (?)
 
     //-- Alpha blending (OGL stuff)
     //glEnable(GL_BLEND);
     //glBlendFunc(GL_SRC_ALPHA, GL_DST_ALPHA);
     //glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-    glDisable(GL_DEPTH_TEST);
+    // the depth test is set by each item of the pass: off for the leaves, on for the static models
 
-    //-- Textre binding to shader uniforms. (Only leaf shader takes these)
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, leaf_texture);
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, leaf_texture_normal);
-    glActiveTexture(GL_TEXTURE7);
-    glBindTexture(GL_TEXTURE_2D, leaf_texture_translusency);
-    glActiveTexture(GL_TEXTURE8);
-    glBindTexture(GL_TEXTURE_2D, leaf_texture_roughness);
+    //-- Textre binding to shader uniforms. The textures are bound by the render queue, see addLeafMaterial()
+    commands.SetInt(shader->location("texture_diffuse1"), 1);
+    commands.SetInt(shader->location("texture_normal1"), 2);
+    commands.SetInt(shader->location("texture_translucency1"), 7);
+    commands.SetInt(shader->location("texture_roughness1"), 8);
 
-    
-    shader->setInt("texture_diffuse1", 1);
-    shader->setInt("texture_normal1", 2);
-    shader->setInt("texture_translucency1", 7);
-    shader->setInt("texture_roughness1", 8);
+    // constants of the cheaper material tiers
+    commands.SetFloat(shader->location("lodRoughness"), lodRoughness);
+    commands.SetFloat(shader->location("lodTranslucency"), lodTranslucency);
 
-    drawQuad(); // draws the quad.
+    // First light
+    recordLightUniforms(commands, sceneLight(0));
+    recordLightShadowUniforms(commands, 0);
 
+    // draws the quads, one range of the instance buffer per material tier. The back-lit light of every light
+    // of the reduced pass is added once, by these draws
+    for (int tier = 0; tier < MaterialLod::TIER_COUNT; tier++)
+    {
+        CommandList &draws = leafTierCommands[tier];
+        draws.Reset();
+        draws.SetInt(shader->location("translucencyMode"), translucencyReduced ? 1 : 0);
+        draws.SetInt(shader->location("materialTier"), tier);
+        draws.DrawArraysInstanced(quadVAO, GL_TRIANGLE_STRIP, 4, materialLod.count[tier], instanceVBO, materialLod.first[tier] * sizeof(glm::mat4));
+    }
+    recordStaticModelUniforms(leafTierCommands[MaterialLod::TIER_COUNT - 1]);
+}
+
+// the leaf uniforms as the static models are drawn: one material tier and the back-lit light shaded in place
+void recordStaticModelUniforms(CommandList &commands)
+{
+    commands.SetInt(shader->location("materialTier"), 0);
+    commands.SetInt(shader->location("translucencyMode"), 0);
+}
+
+// the active leaves thinned out with the distance, the tier of the ones left from their size on screen,
+// and those grouped by tier for the instance buffer
+void assignLeafLod(const glm::mat4 &view, const glm::mat4 &projection, const int viewport[4])
+{
+    static std::vector<uint8_t> tiers;
+    static std::vector<glm::mat4> drawnModels;
+    tiers.assign(instanceCount, (uint8_t)MaterialLod::TIER_DROPPED);
+    drawnModels.resize(instanceCount);
+    densityLod.drawn = densityLod.fading = 0;
+    float pixelsPerUnit = projection[1][1] * (float)viewport[3] * 0.5f;
+    scene.ForEach<BoundsComponent, InstanceComponent>([&view, pixelsPerUnit](int count, BoundsComponent* bounds, InstanceComponent* instances) {
+        for (int i = 0; i < count; i++)
+        {
+            int instance = instances[i].instance;
+            if (instance >= instanceCount)
+                continue;
+            glm::mat4 &drawn = drawnModels[instance];
+            if (!densityLod.Thin(instance, models[instance], glm::distance(camera.Position, bounds[i].center), drawn))
+                continue;
+            densityLod.drawn++;
+            densityLod.fading += drawn[0][3] > 0.0f ? 1 : 0;
+            float viewDepth = -(view * glm::vec4(bounds[i].center, 1.0f)).z;
+            tiers[instance] = (uint8_t)materialLod.Select(bounds[i].radius * densityLod.ScaleOf(instance), viewDepth, pixelsPerUnit);
+        }
+    });
+    materialLod.Group(tiers, drawnModels.data(), instanceCount);
 }
 
 void GenerateOffsets() {
@@ -815,7 +1850,7 @@ void GenerateOffsets() {
     float rLow = 0.6f;  
     float rHigh = 1.6f;
  
-    for (int i = 0; i < 100; i++) {
+    for (int i = 0; i < MAX_LEAF_INSTANCES; i++) {
         
         
         glm::mat4 baseMatrix = glm::mat4(1.0);
@@ -839,17 +1874,395 @@ void GenerateOffsets() {
         models[index++] = baseMatrix;
         
     }   
+    densityLod.Scatter(MAX_LEAF_INSTANCES);
     
-    // send array to uniform in common_shading.vert
-    shader->use(); // we can do this with any shader, seeing as they are all bound to the common_shading vertex shader.
-    for (unsigned int i = 0; i < 100; i++)
+    // the leaves are nodes under one root, so the whole cluster can be moved at once.
+    // models[] gets their world matrices from updateSceneGraph()
+    if (leafRootNode < 0)
+    {
+        leafRootNode = sceneGraph.AddNode(SceneGraph::NO_PARENT, glm::mat4(1.0f));
+        for (int i = 0; i < MAX_LEAF_INSTANCES; i++)
+        {
+            int node = sceneGraph.AddNode(leafRootNode, models[i]);
+            if (i == 0)
+                firstLeafNode = node;
+
+            // one entity per leaf, the bounds are the sphere around the unit quad
+            BoundsComponent bounds = { glm::vec3(0.0f), std::sqrt(2.0f), glm::vec3(0.0f), 0.0f };
+            UpdateWorldBounds(bounds, models[i]);
+            scene.Create(TransformComponent{ node, models[i] }, bounds, leafMaterial, InstanceComponent{ i });
+        }
+    }
+    else
+    {
+        for (int i = 0; i < MAX_LEAF_INSTANCES; i++)
+            sceneGraph.SetLocal(firstLeafNode + i, models[i]);
+    }
+}
+
+// moves the leaf cluster, propagates the changed transforms to the entities and copies the leaves that
+// moved into models[]. CPU only, runs as a job
+void updateSceneGraph()
+{
+    static glm::vec3 placedPosition(0.0f);
+    static float swayTime = 0.0f;
+    if (leafSway || leafClusterPosition != placedPosition)
+    {
+        swayTime = leafSway ? swayTime + deltaTime : 0.0f;
+        glm::mat4 placement = glm::translate(glm::mat4(1.0f), leafClusterPosition);
+        placement = glm::rotate(placement, 0.1f * std::sin(1.5f * swayTime), glm::vec3(0.0f, 0.0f, 1.0f));
+        sceneGraph.SetLocal(leafRootNode, placement);
+        placedPosition = leafClusterPosition;
+    }
+
+    sceneGraph.UpdateWorld();
+    sceneGraph.TakeChangedRanges(changedNodes);
+
+    if (changedNodes.empty())
+        return;
+
+    // transform system: world matrix and bounds of every entity, chunk by chunk
+    scene.ForEach<TransformComponent, BoundsComponent>([](int count, TransformComponent* transforms, BoundsComponent* bounds) {
+        for (int i = 0; i < count; i++)
+        {
+            transforms[i].world = sceneGraph.World(transforms[i].node);
+            UpdateWorldBounds(bounds[i], transforms[i].world);
+        }
+    });
+
+    bool leavesMoved = false;
+    for (const SceneGraph::Range &range : changedNodes)
+        leavesMoved = leavesMoved || (range.begin < firstLeafNode + MAX_LEAF_INSTANCES && range.end > firstLeafNode);
+    if (!leavesMoved)
+        return;
+    scene.ForEach<TransformComponent, InstanceComponent>([](int count, TransformComponent* transforms, InstanceComponent* instances) {
+        for (int i = 0; i < count; i++)
+            models[instances[i].instance] = transforms[i].world;
+    });
+    casterVersion++;
+}
+
+// uploads the world matrices that changed this frame: the leaves to the instance buffer, read by
+// common_shading.vert and shadowmap.vert, and the static models to the transforms of the batches.
+// The leaves drawn by the color passes are uploaded again when they moved, changed tier or were
+// thinned out differently, the shadow casters when they moved
+void uploadSceneTransforms()
+{
+    for (const SceneGraph::Range &range : changedNodes)
     {
-        //shader->setVec2((("offSets[" + std::to_string(i) + "]")), offsets[i]);
-        shader->setMat4((("models[" + std::to_string(i) + "]")), models[i]);
+        int begin = std::max(range.begin, firstLeafNode) - firstLeafNode;
+        int end = std::min(range.end, firstLeafNode + MAX_LEAF_INSTANCES) - firstLeafNode;
+        if (begin >= end)
+            continue;
+        glState.BindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferSubData(GL_ARRAY_BUFFER, SHADOW_CASTERS_OFFSET + begin * sizeof(glm::mat4), (end - begin) * sizeof(glm::mat4), &models[begin]);
+    }
+    if (materialLod.changed && !materialLod.models.empty())
+    {
+        glState.BindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, materialLod.models.size() * sizeof(glm::mat4), &materialLod.models[0]);
+        materialLod.changed = false;
+    }
+    if (!changedNodes.empty() && staticBatching && !staticModels.empty())
+        staticBatcher.UpdateTransforms(sceneGraph);
+}
 
+// adds the nodes of the model to the scene graph and one entity per mesh
+void addStaticModel(Model* model, const glm::mat4 &placement)
+{
+    int root = model->AddToScene(sceneGraph, SceneGraph::NO_PARENT, placement);
+    staticModels.push_back(model);
+    staticRoots.push_back(root);
+    for (int i = 0; i < (int)model->meshes.size(); i++)
+    {
+        const Mesh &mesh = model->meshes[i];
+        int node = root + model->meshNodes[i];
+        BoundsComponent bounds = { mesh.boundsCenter, mesh.boundsRadius, glm::vec3(0.0f), 0.0f };
+        UpdateWorldBounds(bounds, sceneGraph.World(node));
+        MaterialComponent material = {};
+        material.diffuse = mesh.textures.empty() ? 0 : mesh.textures[0].id;
+        scene.Create(TransformComponent{ node, sceneGraph.World(node) }, bounds, MeshComponent{ model, i }, material);
     }
 }
 
+Light& sceneLight(int lightIndex)
+{
+    return *scene.Get<Light>(lightEntities[lightIndex]);
+}
+
+int lightCount()
+{
+    return (int)lightEntities.size();
+}
+
+void addLight(const Light &light)
+{
+    lightEntities.push_back(scene.Create(light));
+}
+
+// a point light placed and colored by how many lights there are already
+void addPointLight()
+{
+    float angle = (float)lightCount() * 2.4f;
+    glm::vec3 position(std::cos(angle) * 4.0f, 1.0f + (float)(lightCount() % 3), std::sin(angle) * 4.0f + 4.0f);
+    glm::vec3 color(0.5f + 0.5f * std::cos(angle), 0.5f + 0.5f * std::sin(angle), 0.7f);
+    addLight(Light(position, color, 5.0f, 6.0f));
+}
+
+void removeLight()
+{
+    // the last light goes, its atlas tile with it
+    shadowAtlas.Release(lightCount() - 1);
+    scene.Destroy(lightEntities.back());
+    lightEntities.pop_back();
+}
+
+// loads the shaders and textures, creates the lights, the leaves and the shadow maps.
+// needs a current GL context
+void initScene()
+{
+    // load the shaders and the 3D models
+    // ----------------------------------
+    {
+        ProfileScope loading(profiler, "load shaders");
+        phong_shading = new Shader("shaders/common_shading.vert", "shaders/phong_shading.frag");
+        pbr_shading = new Shader("shaders/common_shading.vert", "shaders/pbr_shading.frag");
+        leaf_shading = new Shader("shaders/common_shading.vert", "shaders/leaf_shading.frag");
+        overdraw_shading = new Shader("shaders/common_shading.vert", "shaders/overdraw.frag");
+        overdraw_skybox = new Shader("shaders/skybox.vert", "shaders/overdraw.frag");
+        translucency_shading = new Shader("shaders/common_shading.vert", "shaders/translucency.frag");
+    }
+
+    shader = leaf_shading;
+
+    // Adding lights
+    //addLight(Light(position, color, intensity, radius));
+
+    // light 1
+    addLight(Light(glm::vec3(-1.0f, 1.0f, -0.5f), glm::vec3(1.0f, 1.0f, 1.0f), 30.0f, 0.0f));
+
+    // light 2
+    addLight(Light(glm::vec3( 1.0f, 1.5f, 0.0f), glm::vec3(0.7f, 0.2f, 1.0f), 0.0f, 10.0f));
+
+    // keep the buffer texture of the static batches away from the units of the material textures
+    for (Shader* lighting : { phong_shading, pbr_shading, leaf_shading, overdraw_shading })
+    {
+        lighting->use();
+        lighting->setInt("objectTransforms", StaticBatcher::TRANSFORM_UNIT);
+        // the irradiance of the sky, the shaders without it (phong, overdraw) have no block
+        GLuint environmentIndex = glGetUniformBlockIndex(lighting->ID, "Environment");
+        if (environmentIndex != GL_INVALID_INDEX)
+            glUniformBlockBinding(lighting->ID, environmentIndex, ENVIRONMENT_BINDING);
+    }
+
+
+    // - @PHIJ Texture Loading
+    leafMaterial.diffuse = loadTexture("leaf05_basecolor_transparent.png"); // loads the texture
+    leafMaterial.normal = loadTexture("leaf05_normal.png");
+    leafMaterial.translucency = loadTextureRED("leaf05_translucency.png");
+    leafMaterial.roughness = loadTextureNoAlpha("leaf05_roughnessR.png");
+    leafMaterial.opacity = loadTextureRED("leaf05_opacity.png");
+    measureLeafMaterial();
+
+    // init skybox
+    vector<std::string> faces
+    {
+            "skybox/right.tga",
+            "skybox/left.tga",
+            "skybox/top.tga",
+            "skybox/bottom.tga",
+            "skybox/front.tga",
+            "skybox/back.tga"
+    };
+    vector<CubemapFace> skyFaces;
+    cubemapTexture = loadCubemap(faces, &skyFaces);
+    createEnvironment(skyFaces);
+    skyboxVAO = initSkyboxBuffers();
+    skyboxShader = new Shader("shaders/skybox.vert", "shaders/skybox.frag");
+
+    createShadowMap();
+    shadowMap_shader = new Shader("shaders/shadowmap.vert", "shaders/shadowmap.frag");
+    shadowMap_shader->use();
+    shadowMap_shader->setInt("opacityTexture", 0);
+    createShadowAtlas();
+
+    initQuadBuffers();
+    GenerateOffsets(); // @PHIJ - Generate the offsets, they are uploaded to the instance buffer in the first frame.
+
+    // First light + ambient. The recorded main pass sets the uniforms and state of the frame before any draw
+    // of the pass, whichever comes first in the sort
+    renderQueue.SetPassState(PASS_OPAQUE, []() { shader->use(); mainPassCommands.Replay(streamBuffer); }, nullptr);
+    // additional lights are blended on top of the first pass
+    renderQueue.SetPassState(PASS_ADDITIVE,
+        []() { shader->use(); setupForwardAdditionalPass(); },
+        []() { glState.SetEnabled(GL_SCISSOR_TEST, false); shader->use(); resetForwardAdditionalPass(); });
+
+
+    // set up the z-buffer
+    // -------------------
+    glDepthRange(-1,1); // make the NDC a right handed coordinate system, with the camera pointing towards -z
+    glState.SetEnabled(GL_DEPTH_TEST, true); // turn on z-buffer depth test
+    glState.DepthFunc(GL_LESS); // draws fragments that are closer to the screen in NDC
+
+    glState.SetEnabled(GL_FRAMEBUFFER_SRGB, true);
+}
+
+// updates and draws one frame into sceneFramebuffer, from the camera. The caller draws the GUI, ends the
+// frame of glStats and presents the image. The viewport is the whole screen when it returns
+void renderFrame()
+{
+    profiler.BeginFrame();
+    glStats.BeginFrame();
+
+    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)screenWidth / (float)screenHeight, 0.1f, 100.0f);
+    glm::mat4 view = camera.GetViewMatrix();
+    glm::mat4 viewProjection = projection * view;
+
+    glState.BeginFrame();
+
+    // the overdraw view records and draws the same passes with the counting shaders
+    Shader* lightingShader = shader;
+    Shader* backgroundShader = skyboxShader;
+    if (overdrawView)
+    {
+        overdraw.Resize(screenWidth, screenHeight);
+        shader = overdraw_shading;
+        skyboxShader = overdraw_skybox;
+    }
+
+    // the overdraw view counts the fragments at the full resolution, and its GPU times would mislead the scaling
+    bool scaled = dynamicResolution.enabled && !overdrawView;
+    int renderWidth = (int)screenWidth, renderHeight = (int)screenHeight;
+    if (scaled)
+    {
+        dynamicResolution.Update(profiler);
+        dynamicResolution.Resize(screenWidth, screenHeight);
+        renderWidth = dynamicResolution.Width();
+        renderHeight = dynamicResolution.Height();
+    }
+    colorFramebuffer = overdrawView ? overdraw.Framebuffer() : scaled ? dynamicResolution.Framebuffer() : sceneFramebuffer;
+    // the passes, the light scissors and the shadow passes (that restore it) all follow this viewport
+    glState.Viewport(0, 0, renderWidth, renderHeight);
+
+    // the reduced pass only has the terms of the leaf shader, the overdraw view has its own shader
+    translucencyReduced = translucency.Reduced() && shader == leaf_shading;
+    if (translucencyReduced)
+        translucency.Resize(screenWidth, screenHeight);
+
+    // update phase: jobs that only touch CPU data, the render phase below waits for all of them
+    // --------------------------------------------------------------------------------------
+    jobSystem.BeginFrame();
+    int viewport[4];
+    glState.GetViewport(viewport);
+    lightPassStats.resize(lightCount());
+    lightPassPlans.resize(lightCount());
+    lightPassCommands.resize(lightCount());
+    frameIndex++;
+    if (staticBatching && !staticModels.empty() && (staticBatcher.meshCount == 0 || staticBatcher.NeedsRebuild()))
+        staticBatcher.Build(staticModels, staticRoots, sceneGraph);
+
+    JobCounter animated, shadowed, recorded, queued, sorted;
+
+    // Rotate light 2
+    jobSystem.Run("animate lights", []() {
+        if (lightRotationSpeed > 0.0f)
+        {   
+            glm::vec4 rotatedLight = glm::rotate(glm::mat4(1.0f), lightRotationSpeed * deltaTime, glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(sceneLight(1).position, 1.0f);
+            sceneLight(1).position = glm::vec3(rotatedLight.x, rotatedLight.y, rotatedLight.z);
+        }
+    }, &animated);
+
+    // world matrices of the nodes that moved, copied into the leaf transforms
+    jobSystem.Run("update scene graph", []() { updateSceneGraph(); }, &animated);
+
+    // shadow passes, they wait for the leaves and lights to be in place
+    jobSystem.Run("record shadow map", [&viewport]() { recordShadowMap(shadowMapCommands, viewport); }, &shadowed, &animated);
+    jobSystem.Run("record shadow atlas", [&viewport]() { recordShadowAtlas(shadowAtlasCommands, viewport); }, &shadowed, &animated);
+
+    // the leaves thinned out and grouped by material tier, the color passes draw one range of them per tier
+    jobSystem.Run("assign leaf lod", [&view, &projection, &viewport]() { assignLeafLod(view, projection, viewport); },
+                  &shadowed, &animated);
+
+    // the color passes read the light space matrices of the shadow passes and the tiers.
+    // each additional light culls the leaves and pixels it reaches and records its own pass
+    jobSystem.Run("record translucency pass", [&viewProjection, &viewport]() { recordTranslucencyPass(translucencyCommands, viewProjection, viewport); },
+                  &recorded, &shadowed);
+    jobSystem.Run("record main pass", [&viewProjection, &viewport]() { recordMainPass(mainPassCommands, viewProjection, viewport); }, &recorded, &shadowed);
+    jobSystem.ParallelFor("record light passes", lightCount() - 1, 1, [&view, &projection, &viewport](int begin, int end) {
+        for (int i = begin; i < end; i++)
+        {
+            cullLight(i + 1, view, projection, viewport);
+            recordLightPass(lightPassCommands[i + 1], i + 1);
+        }
+    }, &recorded, &shadowed);
+
+    // sort keys of the frame's draws
+    jobSystem.Run("build render queue", [&view]() { buildRenderQueue(view); }, &queued, &animated);
+    jobSystem.Run("sort render queue", []() { renderQueue.Sort(); }, &sorted, &queued);
+
+    {
+        ProfileScope waiting(profiler, "wait for jobs");
+        jobSystem.Wait(recorded);
+        jobSystem.Wait(sorted);
+    }
+    frameJobEvents = jobSystem.CollectEvents();
+    profiler.AddJobEvents(jobSystem, frameJobEvents);
+
+    // render phase: GL calls only
+    // ---------------------------
+    {
+        ProfileScope rendering(profiler, "render phase");
+        uploadSceneTransforms();
+
+        if (overdrawView)
+        {
+            overdraw.Begin();
+        }
+        else
+        {
+            glState.BindFramebuffer(colorFramebuffer);
+            glClearColor(0.3f, 0.3f, 0.3f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        }
+
+        streamBuffer.BeginFrame();
+        {
+            GpuScope timer(profiler, "shadow map");
+            shadowMapCommands.Replay(streamBuffer);
+        }
+        {
+            GpuScope timer(profiler, "shadow atlas");
+            shadowAtlasCommands.Replay(streamBuffer);
+        }
+        if (translucencyReduced)
+        {
+            GpuScope timer(profiler, "translucency");
+            translucencyCommands.Replay(streamBuffer);
+        }
+
+        // skybox, first light + ambient, then the additive lights, the leaf draws replay the recorded passes
+        renderQueue.Submit();
+        streamBuffer.EndFrame();
+
+        if (overdrawView)
+        {
+            GpuScope timer(profiler, "overdraw heatmap");
+            overdraw.End(frameIndex);
+            glState.BindFramebuffer(sceneFramebuffer);
+            overdraw.DrawHeatmap(overdrawScale);
+        }
+        if (scaled)
+        {
+            GpuScope timer(profiler, "upscale");
+            glState.BindFramebuffer(sceneFramebuffer);
+            glState.Viewport(0, 0, screenWidth, screenHeight);
+            dynamicResolution.Upscale();
+        }
+    }
+    shader = lightingShader;
+    skyboxShader = backgroundShader;
+}
+
 void processInput(GLFWwindow *window) {
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
@@ -900,6 +2313,21 @@ void key_input_callback(GLFWwindow* window, int button, int other, int action, i
         glfwSetInputMode(window, GLFW_CURSOR, isPaused ? GLFW_CURSOR_NORMAL : GLFW_CURSOR_DISABLED);
     }
 
+    // records the camera path
+    if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS){
+        recordingPath = !recordingPath;
+        if (recordingPath)
+        {
+            recordedPath.keys.clear();
+            recordingTime = 0.0f;
+            std::cout << "recording the camera path" << std::endl;
+        }
+        else if (recordedPath.Save(cameraPathFile))
+            std::cout << "wrote " << recordedPath.keys.size() << " camera keys to " << cameraPathFile << std::endl;
+        else
+            std::cout << "could not write " << cameraPathFile << std::endl;
+    }
+
 }
 
 // glfw: whenever the mouse scroll wheel scrolls, this callback is called
@@ -914,5 +2342,10 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
     // make sure the viewport matches the new window dimensions; note that width and
     // height will be significantly larger than specified on retina displays.
-    glViewport(0, 0, width, height);
+    glState.Viewport(0, 0, width, height);
+    if (width > 0 && height > 0)
+    {
+        screenWidth = width;
+        screenHeight = height;
+    }
 }
\ No newline at end of file
@@ -0,0 +1,120 @@
+#ifndef MATERIAL_LOD_H
+#define MATERIAL_LOD_H
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Material level of detail of the leaves: a leaf a few pixels wide cannot show its normal map or the
+// texture of its roughness and thickness, so the leaves are shaded with a cheaper path of leaf_shading.frag
+// the smaller they get on screen:
+//   near  the full material
+//   mid   the face normal and the mean roughness of the leaf, no normal or roughness fetch
+//   far   also the mean thickness and the irradiance instead of the reflection, no translucency or sky fetch
+// The tier of a leaf comes from the projected diameter of its bounding sphere. Every frame the leaves drawn
+// are grouped by tier, in instance order within a tier, and the instance buffer holds them in that order,
+// so each tier is one instanced draw of a range of it. The grouped matrices are only uploaded again when
+// they changed.
+class MaterialLod
+{
+public:
+    enum Tier { TIER_NEAR, TIER_MID, TIER_FAR, TIER_COUNT, TIER_DROPPED = 255 }; // dropped leaves are not drawn
+
+    bool enabled = true;
+    // projected diameters, in pixels, under which a leaf moves to the mid and the far tier
+    float midPixels = 48.0f;
+    float farPixels = 16.0f;
+    // only the leaves of this tier are simplified and the others drawn at near, to measure the error of one tier.
+    // -1 simplifies every tier
+    int isolatedTier = -1;
+
+    // the result of the last Group(): the leaves drawn in tier order, and the range of each tier
+    std::vector<glm::mat4> models;
+    int first[TIER_COUNT] = {};
+    int count[TIER_COUNT] = {};
+    bool changed = true; // models is not what the instance buffer holds
+
+    static const char* TierName(int tier)
+    {
+        static const char* names[TIER_COUNT] = { "near", "mid", "far" };
+        return names[tier];
+    }
+
+    // tier of a bounding sphere of the given radius, viewDepth in front of the camera.
+    // pixelsPerUnit is the size on screen of one unit at a distance of 1, projection[1][1] * viewport height / 2
+    int Select(float radius, float viewDepth, float pixelsPerUnit) const
+    {
+        if (!enabled)
+            return TIER_NEAR;
+        int tier = TIER_NEAR;
+        // a leaf the camera is inside of or behind is not small
+        if (viewDepth > radius)
+        {
+            float pixels = 2.0f * radius * pixelsPerUnit / viewDepth;
+            tier = pixels < farPixels ? TIER_FAR : pixels < midPixels ? TIER_MID : TIER_NEAR;
+        }
+        if (isolatedTier >= 0 && tier != isolatedTier)
+            tier = TIER_NEAR;
+        return tier;
+    }
+
+    // groups the first instanceCount leaves, tiers[i] being the tier of instance i and instanceModels[i]
+    // the matrix it is drawn with
+    void Group(const std::vector<uint8_t> &tiers, const glm::mat4* instanceModels, int instanceCount)
+    {
+        instanceTiers = tiers;
+
+        for (int tier = 0; tier < TIER_COUNT; tier++)
+            count[tier] = 0;
+        for (int i = 0; i < instanceCount; i++)
+            if (tiers[i] != TIER_DROPPED)
+                count[tiers[i]]++;
+        int next[TIER_COUNT];
+        int drawn = 0;
+        for (int tier = 0; tier < TIER_COUNT; tier++)
+        {
+            first[tier] = next[tier] = drawn;
+            drawn += count[tier];
+        }
+        grouped.resize(drawn);
+        slots.assign(instanceCount, -1);
+        for (int i = 0; i < instanceCount; i++)
+        {
+            if (tiers[i] == TIER_DROPPED)
+                continue;
+            slots[i] = next[tiers[i]]++;
+            grouped[slots[i]] = instanceModels[i];
+        }
+        if (grouped != models)
+        {
+            models.swap(grouped);
+            changed = true;
+        }
+    }
+
+    // leaves drawn in the last Group()
+    int Drawn() const
+    {
+        return (int)models.size();
+    }
+
+    // the tier of an instance in the last Group()
+    int TierOf(int instance) const
+    {
+        return instance < (int)instanceTiers.size() ? (int)instanceTiers[instance] : (int)TIER_NEAR;
+    }
+
+    // the matrix an instance is drawn with, it must not be dropped
+    const glm::mat4 &ModelOf(int instance) const
+    {
+        return models[slots[instance]];
+    }
+
+private:
+    std::vector<uint8_t> instanceTiers;
+    std::vector<int> slots; // index in models of every instance, -1 when dropped
+    std::vector<glm::mat4> grouped;
+};
+
+#endif
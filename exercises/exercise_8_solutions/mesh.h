@@ -7,6 +7,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <shader.h>
+#include "geometry_arena.h"
 
 #include <string>
 #include <fstream>
@@ -34,13 +35,39 @@ struct Texture {
     string path;
 };
 
+// sets the vertex attribute pointers for the Vertex layout, with the vertex buffer bound
+inline void setupVertexAttributes()
+{
+    // vertex Positions
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+    // vertex normals
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+    // vertex texture coords
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+    // vertex tangent
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+    // vertex bitangent
+    glEnableVertexAttribArray(4);
+    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+}
+
+// every mesh is stored in this arena, so all of them share one VAO, VBO and EBO
+GeometryArena meshArena(sizeof(Vertex), setupVertexAttributes);
+
 class Mesh {
 public:
     /*  Mesh Data  */
     vector<Vertex> vertices;
     vector<unsigned int> indices;
     vector<Texture> textures;
-    unsigned int VAO;
+    unsigned int VAO;         // shared by all meshes, see meshArena
+    int arenaHandle = -1;     // vertex and index ranges in meshArena
+    glm::vec3 boundsCenter; // center of the bounding box, used for depth sorting
+    float boundsRadius;     // of the sphere around boundsCenter that holds every vertex, used for culling
 
     /*  Functions  */
     // constructor
@@ -50,21 +77,38 @@ public:
         this->indices = indices;
         this->textures = textures;
 
+        glm::vec3 boundsMin(1e9f), boundsMax(-1e9f);
+        for (const Vertex &vertex : vertices)
+        {
+            boundsMin = glm::min(boundsMin, vertex.Position);
+            boundsMax = glm::max(boundsMax, vertex.Position);
+        }
+        boundsCenter = vertices.empty() ? glm::vec3(0.0f) : (boundsMin + boundsMax) * 0.5f;
+        boundsRadius = vertices.empty() ? 0.0f : glm::length(boundsMax - boundsMin) * 0.5f;
+
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
         setupMesh();
     }
 
     // render the mesh
-    void Draw(Shader shader)
+    void Draw(const Shader &shader)
+    {
+        BindTextures(shader);
+
+        // draw mesh
+        // all meshes share the arena VAO, so consecutive meshes do not rebind anything
+        meshArena.Draw(arenaHandle);
+    }
+
+    // bind appropriate textures, also used by the static batches that draw this mesh's material
+    void BindTextures(const Shader &shader)
     {
-        // bind appropriate textures
         unsigned int diffuseNr  = 1;
         unsigned int specularNr = 1;
         unsigned int normalNr   = 1;
         unsigned int ambientNr   = 1;
         for(unsigned int i = 0; i < textures.size(); i++)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
             // retrieve texture number (the N in diffuse_textureN)
             string number;
             string name = textures[i].type;
@@ -78,62 +122,31 @@ public:
                 number = std::to_string(ambientNr++); // transfer unsigned int to stream
 
             // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+            glUniform1i(shader.location(name + number), i);
+            // and finally bind the texture, the active unit is only switched if the binding changes
+            glState.BindTexture(i, GL_TEXTURE_2D, textures[i].id);
         }
+    }
 
-        // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, (int)indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+    // gives the vertex and index ranges back to the arena. Copies of the mesh share them,
+    // so only one of them should be released
+    void Release()
+    {
+        if (arenaHandle >= 0)
+            meshArena.Free(arenaHandle);
+        arenaHandle = -1;
     }
 
 private:
-    /*  Render data  */
-    unsigned int VBO, EBO;
-
     /*  Functions    */
-    // initializes all the buffer objects/arrays
+    // copies the vertices and indices into the shared arena
     void setupMesh()
     {
-        // create buffers/arrays
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
-
-        glBindVertexArray(VAO);
-        // load data into vertex buffers
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
         // A great thing about structs is that their memory layout is sequential for all its items.
         // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
         // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-
-        // set the vertex attribute pointers
-        // vertex Positions
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        // vertex normals
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-        // vertex texture coords
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-        // vertex tangent
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-        // vertex bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
-
-        glBindVertexArray(0);
+        arenaHandle = meshArena.Allocate(&vertices[0], (int)vertices.size(), &indices[0], (int)indices.size());
+        VAO = meshArena.VAO();
     }
 };
 #endif
\ No newline at end of file
@@ -5,6 +5,7 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 #include <assimp/Importer.hpp>
@@ -13,6 +14,7 @@
 
 #include <mesh.h>
 #include <shader.h>
+#include "scene_graph.h"
 
 #include <string>
 #include <fstream>
@@ -30,6 +32,15 @@ public:
     /*  Model Data */
     vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
     vector<Mesh> meshes;
+    // the node hierarchy of the file in depth first order, with the node of each mesh.
+    // AddToScene() copies it into a SceneGraph, where node i of the model becomes node root + i
+    struct Node
+    {
+        int parent; // -1 for the root
+        glm::mat4 transform;
+    };
+    vector<Node> nodes;
+    vector<int> meshNodes;
     string directory;
     bool gammaCorrection;
 
@@ -41,59 +52,36 @@ public:
     }
 
     // draws the model, and thus all its meshes
-    void Draw(Shader shader)
+    void Draw(const Shader &shader)
     {
         for(unsigned int i = 0; i < meshes.size(); i++)
             meshes[i].Draw(shader);
     }
 
-private:
-    /*  Functions   */
-    // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-    void loadModel(string const &path)
+    // frees the geometry of every mesh, the arena reuses the space for the next models
+    void Unload()
     {
-        // read file via ASSIMP
-        Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
-        // check for errors
-        if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
-        {
-            cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
-            return;
-        }
-        // retrieve the directory path of the filepath
-        directory = path.substr(0, path.find_last_of('/'));
-
-        // process ASSIMP's root node recursively
-        processNode(scene->mRootNode, scene);
+        for(unsigned int i = 0; i < meshes.size(); i++)
+            meshes[i].Release();
+        meshes.clear();
+        meshNodes.clear();
     }
 
-    // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-    void processNode(aiNode *node, const aiScene *scene)
+    // adds the nodes of the model under parent (or as a new root), the root is placed with the given transform.
+    // returns the scene node of the model root
+    int AddToScene(SceneGraph &graph, int parent, const glm::mat4 &placement)
     {
-        // process each mesh located at the current node
-        for(unsigned int i = 0; i < node->mNumMeshes; i++)
-        {
-            // the node object only contains indices to index the actual objects in the scene.
-            // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
-            aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
-        }
-        // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
-        for(unsigned int i = 0; i < node->mNumChildren; i++)
-        {
-            processNode(node->mChildren[i], scene);
-        }
-
+        int root = graph.AddNode(parent, nodes.empty() ? placement : placement * nodes[0].transform);
+        for(unsigned int i = 1; i < nodes.size(); i++)
+            graph.AddNode(root + nodes[i].parent, nodes[i].transform);
+        return root;
     }
 
-    Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+    // converts the vertices and faces of an assimp mesh to the Vertex layout and an index list.
+    // CPU only, the benchmarks call it without a GL context
+    static void ConvertMesh(const aiMesh *mesh, vector<Vertex> &vertices, vector<unsigned int> &indices)
     {
-        // data to fill
-        vector<Vertex> vertices;
-        vector<unsigned int> indices;
-        vector<Texture> textures;
-
+        vertices.reserve(vertices.size() + mesh->mNumVertices);
         // Walk through each of the mesh's vertices
         for(unsigned int i = 0; i < mesh->mNumVertices; i++)
         {
@@ -136,11 +124,68 @@ private:
         // now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
         for(unsigned int i = 0; i < mesh->mNumFaces; i++)
         {
-            aiFace face = mesh->mFaces[i];
+            const aiFace &face = mesh->mFaces[i];
             // retrieve all indices of the face and store them in the indices vector
             for(unsigned int j = 0; j < face.mNumIndices; j++)
                 indices.push_back(face.mIndices[j]);
         }
+    }
+
+private:
+    /*  Functions   */
+    // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
+    void loadModel(string const &path)
+    {
+        // read file via ASSIMP
+        Assimp::Importer importer;
+        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+        // check for errors
+        if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+        {
+            cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+            return;
+        }
+        // retrieve the directory path of the filepath
+        directory = path.substr(0, path.find_last_of('/'));
+
+        // process ASSIMP's root node recursively
+        processNode(scene->mRootNode, scene, -1);
+    }
+
+    // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
+    // the node keeps its transform relative to the parent, so parts of the model can be moved on their own
+    void processNode(aiNode *node, const aiScene *scene, int parent)
+    {
+        // assimp matrices are row major, glm matrices column major
+        int index = (int)nodes.size();
+        nodes.push_back({ parent, glm::transpose(glm::make_mat4(&node->mTransformation.a1)) });
+
+        // process each mesh located at the current node
+        for(unsigned int i = 0; i < node->mNumMeshes; i++)
+        {
+            // the node object only contains indices to index the actual objects in the scene.
+            // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
+            aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
+            meshes.push_back(processMesh(mesh, scene));
+            meshNodes.push_back(index);
+        }
+        // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
+        for(unsigned int i = 0; i < node->mNumChildren; i++)
+        {
+            processNode(node->mChildren[i], scene, index);
+        }
+
+    }
+
+    Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+    {
+        // data to fill
+        vector<Vertex> vertices;
+        vector<unsigned int> indices;
+        vector<Texture> textures;
+
+        ConvertMesh(mesh, vertices, indices);
+
         // process materials
         aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
         // we assume a convention for sampler names in the shaders. Each diffuse texture should be named
@@ -228,7 +273,7 @@ unsigned int TextureFromFile(const char *path, const string &directory, bool gam
             internalFormat = gamma ? GL_SRGB_ALPHA : format;
         }
 
-        glBindTexture(GL_TEXTURE_2D, textureID);
+        glState.BindTexture(0, GL_TEXTURE_2D, textureID);
         glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_UNSIGNED_BYTE, data);
         glGenerateMipmap(GL_TEXTURE_2D);
 
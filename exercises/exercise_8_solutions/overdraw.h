@@ -0,0 +1,238 @@
+#ifndef OVERDRAW_H
+#define OVERDRAW_H
+
+#include <glad/glad.h>
+
+#include "gl_state.h"
+#include "shader.h"
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+// fragments per pixel of one frame, read back from the GPU
+struct OverdrawStats
+{
+    static const int HISTOGRAM_BINS = 16; // bin i counts the pixels shaded i times, the last bin 15 times or more
+
+    uint64_t frame = 0;
+    bool valid = false;
+    int width = 0, height = 0;
+    float min = 0.0f, max = 0.0f, average = 0.0f;
+    uint64_t fragments = 0; // sum over all the pixels
+    uint64_t histogram[HISTOGRAM_BINS] = {};
+};
+
+// Debug view of the fragment shader invocations: the color passes draw with a shader that adds 1 to an
+// R32F target (additive blending) instead of shading, so every fragment that is rasterized is counted,
+// also the ones the lighting shader would discard and the ones of every additive light pass.
+// The counts are shown as a heatmap and read back with a pixel buffer READBACK_LATENCY frames later at
+// the latest, only when the fence of the frame says the copy is done, so reading them never stalls.
+// The shadow passes draw into the shadow maps and are not counted.
+class OverdrawCounter
+{
+public:
+    static const int READBACK_LATENCY = 3;
+    static const int STATS_HISTORY = 16;
+
+    unsigned int readbacksDropped = 0; // copies that were not done when their buffer came around again
+
+    OverdrawCounter() : history(STATS_HISTORY) {}
+
+    // the counting framebuffer, (re)created at the size of the screen
+    void Resize(int newWidth, int newHeight)
+    {
+        if (framebuffer != 0 && width == newWidth && height == newHeight)
+            return;
+        release();
+        width = newWidth;
+        height = newHeight;
+
+        glGenTextures(1, &countTexture);
+        glState.BindTexture(0, GL_TEXTURE_2D, countTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, width, height, 0, GL_RED, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        // the passes test depth like they do when shading
+        glGenRenderbuffers(1, &depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+        glGenFramebuffers(1, &framebuffer);
+        glState.BindFramebuffer(framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, countTexture, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::OVERDRAW:: the counting framebuffer is not complete" << std::endl;
+
+        glGenBuffers(READBACK_LATENCY, readbackBuffers);
+        for (int i = 0; i < READBACK_LATENCY; i++)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffers[i]);
+            glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * sizeof(float), nullptr, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        if (!heatmapShader)
+            heatmapShader.reset(new Shader("shaders/fullscreen.vert", "shaders/overdraw_heatmap.frag"));
+        if (emptyVAO == 0)
+            glGenVertexArrays(1, &emptyVAO);
+    }
+
+    GLuint Framebuffer() const { return framebuffer; }
+    GLuint Texture() const { return countTexture; }
+
+    // binds the counting framebuffer, clears the counts and turns on the additive blending.
+    // the color passes are drawn after this with the counting shaders
+    void Begin()
+    {
+        glState.BindFramebuffer(framebuffer);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glState.SetEnabled(GL_BLEND, true);
+        glState.BlendFunc(GL_ONE, GL_ONE);
+    }
+
+    // restores the blending and copies the counts of the frame into the next pixel buffer
+    void End(uint64_t frame)
+    {
+        glState.SetEnabled(GL_BLEND, false);
+        glState.BlendFunc(GL_ONE, GL_ZERO);
+
+        Collect();
+        Readback &slot = readbacks[frame % READBACK_LATENCY];
+        if (slot.fence)
+        {
+            glDeleteSync(slot.fence);
+            readbacksDropped++;
+        }
+        glState.BindFramebuffer(framebuffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffers[frame % READBACK_LATENCY]);
+        glReadPixels(0, 0, width, height, GL_RED, GL_FLOAT, nullptr);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot.frame = frame;
+        glFlush(); // so the fence gets to the GPU even if nothing else is submitted
+    }
+
+    // computes the stats of the copies the GPU has finished, oldest first
+    void Collect()
+    {
+        for (int i = 0; i < READBACK_LATENCY; i++)
+        {
+            Readback* oldest = nullptr;
+            for (Readback &slot : readbacks)
+                if (slot.fence && (!oldest || slot.frame < oldest->frame))
+                    oldest = &slot;
+            if (!oldest)
+                return;
+            GLenum status = glClientWaitSync(oldest->fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                return;
+            glDeleteSync(oldest->fence);
+            oldest->fence = nullptr;
+
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffers[oldest - readbacks]);
+            const float* counts = (const float*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)width * height * sizeof(float), GL_MAP_READ_BIT);
+            if (counts)
+                computeStats(oldest->frame, counts);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+    }
+
+    // draws the counts into the bound framebuffer, black for none and white from `scale` fragments up
+    void DrawHeatmap(float scale)
+    {
+        glState.SetEnabled(GL_DEPTH_TEST, false);
+        glState.SetEnabled(GL_BLEND, false);
+        heatmapShader->use();
+        heatmapShader->setInt("counts", 0);
+        heatmapShader->setFloat("scale", scale);
+        glState.BindTexture(0, GL_TEXTURE_2D, countTexture);
+        glState.BindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+
+    // the newest frame that was read back, nullptr if there is none yet
+    const OverdrawStats* LastStats() const
+    {
+        return latest ? &history[latestFrame % STATS_HISTORY] : nullptr;
+    }
+
+    // the stats of frame, nullptr if it was not read back or is not in the history anymore
+    const OverdrawStats* StatsAt(uint64_t frame) const
+    {
+        const OverdrawStats &stats = history[frame % STATS_HISTORY];
+        return stats.valid && stats.frame == frame ? &stats : nullptr;
+    }
+
+private:
+    struct Readback
+    {
+        uint64_t frame = 0;
+        GLsync fence = nullptr;
+    };
+
+    int width = 0, height = 0;
+    GLuint framebuffer = 0, countTexture = 0, depthBuffer = 0, emptyVAO = 0;
+    GLuint readbackBuffers[READBACK_LATENCY] = {};
+    Readback readbacks[READBACK_LATENCY];
+    std::unique_ptr<Shader> heatmapShader;
+    std::vector<OverdrawStats> history;
+    bool latest = false;
+    uint64_t latestFrame = 0;
+
+    void computeStats(uint64_t frame, const float* counts)
+    {
+        OverdrawStats &stats = history[frame % STATS_HISTORY];
+        stats = OverdrawStats();
+        stats.frame = frame;
+        stats.width = width;
+        stats.height = height;
+        int pixels = width * height;
+        float minCount = pixels > 0 ? counts[0] : 0.0f, maxCount = minCount;
+        for (int i = 0; i < pixels; i++)
+        {
+            float count = counts[i];
+            minCount = count < minCount ? count : minCount;
+            maxCount = count > maxCount ? count : maxCount;
+            uint64_t fragments = (uint64_t)count;
+            stats.fragments += fragments;
+            stats.histogram[fragments < (uint64_t)OverdrawStats::HISTOGRAM_BINS ? fragments : OverdrawStats::HISTOGRAM_BINS - 1]++;
+        }
+        stats.min = minCount;
+        stats.max = maxCount;
+        stats.average = pixels > 0 ? (float)((double)stats.fragments / pixels) : 0.0f;
+        stats.valid = true;
+        if (!latest || frame > latestFrame)
+            latestFrame = frame;
+        latest = true;
+    }
+
+    void release()
+    {
+        for (Readback &slot : readbacks)
+        {
+            if (slot.fence)
+                glDeleteSync(slot.fence);
+            slot.fence = nullptr;
+        }
+        if (framebuffer != 0)
+        {
+            glDeleteFramebuffers(1, &framebuffer);
+            glDeleteTextures(1, &countTexture);
+            glDeleteRenderbuffers(1, &depthBuffer);
+            glDeleteBuffers(READBACK_LATENCY, readbackBuffers);
+            framebuffer = 0;
+            // the deleted objects were bound, the next names may be the same
+            glState.Invalidate();
+        }
+    }
+};
+
+#endif
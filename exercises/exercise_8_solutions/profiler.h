@@ -0,0 +1,299 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <glad/glad.h>
+
+#include "job_system.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// a timed scope of one frame, in microseconds since the start of the frame
+struct ProfileEvent
+{
+    const char* name;
+    int track; // the job system thread that ran it, or GPU_TRACK
+    double start, end;
+};
+
+struct ProfileFrame
+{
+    uint64_t index = 0;
+    double start = 0.0;      // microseconds since the profiler was created
+    double cpuDuration = 0.0; // until the next BeginFrame(), microseconds
+    double gpuDuration = 0.0; // sum of the GPU scopes, microseconds
+    bool gpuResolved = false;
+    std::vector<ProfileEvent> events;
+
+    // sum of the GPU scopes whose name starts with prefix, microseconds
+    double GpuTime(const char* prefix) const
+    {
+        double time = 0.0;
+        size_t length = std::strlen(prefix);
+        for (const ProfileEvent &event : events)
+            if (event.track == -1 /* Profiler::GPU_TRACK */ && std::strncmp(event.name, prefix, length) == 0)
+                time += event.end - event.start;
+        return time;
+    }
+};
+
+// Keeps the timings of the last FRAME_HISTORY frames: CPU scopes (ProfileScope) from any thread,
+// the jobs of the job system and GPU scopes (GpuScope), measured with GL_TIME_ELAPSED queries.
+// The query results are read QUERY_LATENCY frames later at the earliest and only once the GPU says they
+// are available, so reading them never waits for the GPU. The events before the first BeginFrame()
+// (the loaders) are kept in frame 0.
+// GPU scopes cannot nest (only one GL_TIME_ELAPSED query can be active), and they only have a duration:
+// the timeline lays them out one after the other from the start of the frame.
+class Profiler
+{
+public:
+    static const int FRAME_HISTORY = 128;
+    static const int QUERY_LATENCY = 4;
+    static const int GPU_TRACK = -1;
+
+    bool recording = true; // when off, the history is kept as it is, for inspection
+    unsigned int gpuResultsDropped = 0; // query sets that were not ready when their slot came around again
+
+    Profiler() : created(std::chrono::high_resolution_clock::now()), frames(FRAME_HISTORY)
+    {
+        frames[0].index = 0;
+    }
+
+    // closes the current frame and opens the next one. Call at the top of the frame, on the GL thread
+    void BeginFrame()
+    {
+        collectGpuResults();
+        if (!recording)
+            return;
+
+        double now = elapsedMicroseconds();
+        std::lock_guard<std::mutex> lock(mutex);
+        ProfileFrame &last = frames[currentFrame % FRAME_HISTORY];
+        last.cpuDuration = now - last.start;
+
+        currentFrame++;
+        ProfileFrame &frame = frames[currentFrame % FRAME_HISTORY];
+        frame.index = currentFrame;
+        frame.start = now;
+        frame.cpuDuration = 0.0;
+        frame.gpuDuration = 0.0;
+        frame.gpuResolved = false;
+        frame.events.clear();
+
+        // the query set of this frame was last used QUERY_LATENCY frames ago, collectGpuResults() had every
+        // chance to read it. If the GPU is still not done, its results are lost rather than waited for
+        QuerySet &set = querySets[currentFrame % QUERY_LATENCY];
+        if (set.used > 0)
+            gpuResultsDropped++;
+        set.frame = currentFrame;
+        set.used = 0;
+    }
+
+    // adds the jobs run since jobs.BeginFrame(), in the current frame
+    void AddJobEvents(const JobSystem &jobs, const std::vector<JobEvent> &events)
+    {
+        if (!recording)
+            return;
+        std::chrono::duration<double, std::micro> offset = jobs.FrameStart() - created;
+        std::lock_guard<std::mutex> lock(mutex);
+        ProfileFrame &frame = frames[currentFrame % FRAME_HISTORY];
+        double shift = offset.count() - frame.start;
+        for (const JobEvent &event : events)
+            frame.events.push_back({ event.name, event.thread, event.start + shift, event.end + shift });
+    }
+
+    // the start of a CPU scope, pass the result to EndCpu()
+    double BeginCpu() const
+    {
+        return elapsedMicroseconds();
+    }
+
+    // can be called from any thread, the event goes to the track of the calling job system thread
+    void EndCpu(const char* name, double start)
+    {
+        if (!recording)
+            return;
+        double end = elapsedMicroseconds();
+        std::lock_guard<std::mutex> lock(mutex);
+        ProfileFrame &frame = frames[currentFrame % FRAME_HISTORY];
+        frame.events.push_back({ name, JobSystem::CurrentThread(), start - frame.start, end - frame.start });
+    }
+
+    // GL thread only, GPU scopes must not overlap
+    void BeginGpu(const char* name)
+    {
+        if (!recording || gpuScopeOpen)
+            return;
+        QuerySet &set = querySets[currentFrame % QUERY_LATENCY];
+        if (set.used == (int)set.queries.size())
+        {
+            GLuint query;
+            glGenQueries(1, &query);
+            set.queries.push_back(query);
+            set.names.push_back(nullptr);
+        }
+        set.names[set.used] = name;
+        glBeginQuery(GL_TIME_ELAPSED, set.queries[set.used]);
+        gpuScopeOpen = true;
+    }
+
+    void EndGpu()
+    {
+        if (!gpuScopeOpen)
+            return;
+        glEndQuery(GL_TIME_ELAPSED);
+        querySets[currentFrame % QUERY_LATENCY].used++;
+        gpuScopeOpen = false;
+    }
+
+    // a name that lives as long as the profiler, for scopes with generated names
+    const char* Name(const std::string &name)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return names.insert(name).first->c_str();
+    }
+
+    uint64_t CurrentFrame() const { return currentFrame; }
+
+    // frame i, or nullptr if it is not in the history anymore
+    const ProfileFrame* Frame(uint64_t i) const
+    {
+        if (i > currentFrame)
+            return nullptr;
+        const ProfileFrame &frame = frames[i % FRAME_HISTORY];
+        return frame.index == i ? &frame : nullptr;
+    }
+
+    // the newest frame that is complete, with its GPU results if there are any
+    const ProfileFrame* LatestResolvedFrame() const
+    {
+        for (uint64_t i = currentFrame; i > 0 && currentFrame - i < (uint64_t)FRAME_HISTORY; i--)
+        {
+            const ProfileFrame* frame = Frame(i - 1);
+            if (frame && (frame->gpuResolved || currentFrame - (i - 1) > (uint64_t)QUERY_LATENCY))
+                return frame;
+        }
+        return nullptr;
+    }
+
+    // writes the history in the Trace Event Format, open it in chrome://tracing or ui.perfetto.dev.
+    // returns false if the file cannot be written
+    bool WriteChromeTrace(const std::string &path) const
+    {
+        std::ofstream file(path);
+        if (!file)
+            return false;
+
+        file << "{\"traceEvents\":[\n";
+        file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"GPU\"}}";
+        uint64_t first = currentFrame >= (uint64_t)FRAME_HISTORY ? currentFrame - FRAME_HISTORY + 1 : 0;
+        for (uint64_t i = first; i <= currentFrame; i++)
+        {
+            const ProfileFrame* frame = Frame(i);
+            if (!frame)
+                continue;
+            file << ",\n{\"name\":\"frame " << frame->index << "\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":1,\"ts\":" << frame->start << "}";
+            for (const ProfileEvent &event : frame->events)
+            {
+                // tid 0 is the GPU, the job system threads start at 1
+                file << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"" << (event.track == GPU_TRACK ? "gpu" : "cpu")
+                     << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.track + 1
+                     << ",\"ts\":" << frame->start + event.start << ",\"dur\":" << event.end - event.start << "}";
+            }
+        }
+        file << "\n]}\n";
+        return (bool)file;
+    }
+
+private:
+    struct QuerySet
+    {
+        uint64_t frame = 0;
+        int used = 0;
+        std::vector<GLuint> queries;
+        std::vector<const char*> names;
+    };
+
+    std::chrono::high_resolution_clock::time_point created;
+    std::vector<ProfileFrame> frames;
+    uint64_t currentFrame = 0;
+    QuerySet querySets[QUERY_LATENCY];
+    bool gpuScopeOpen = false;
+    std::mutex mutex; // CPU scopes end on the job threads
+    std::unordered_set<std::string> names;
+
+    double elapsedMicroseconds() const
+    {
+        std::chrono::duration<double, std::micro> elapsed = std::chrono::high_resolution_clock::now() - created;
+        return elapsed.count();
+    }
+
+    // reads the query sets of the older frames, oldest first, and stops at the first one the GPU has
+    // not finished. The queries of a frame complete in order, so the last one tells about all of them
+    void collectGpuResults()
+    {
+        for (uint64_t frameIndex = currentFrame >= (uint64_t)QUERY_LATENCY ? currentFrame - QUERY_LATENCY + 1 : 0;
+             frameIndex < currentFrame; frameIndex++)
+        {
+            QuerySet &set = querySets[frameIndex % QUERY_LATENCY];
+            if (set.frame != frameIndex || set.used == 0)
+                continue;
+            GLuint available = 0;
+            glGetQueryObjectuiv(set.queries[set.used - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                return;
+
+            ProfileFrame &frame = frames[frameIndex % FRAME_HISTORY];
+            bool keep = frame.index == frameIndex;
+            std::lock_guard<std::mutex> lock(mutex);
+            double start = 0.0;
+            for (int i = 0; i < set.used; i++)
+            {
+                GLuint64 nanoseconds = 0;
+                glGetQueryObjectui64v(set.queries[i], GL_QUERY_RESULT, &nanoseconds);
+                double duration = (double)nanoseconds / 1000.0;
+                if (keep)
+                    frame.events.push_back({ set.names[i], GPU_TRACK, start, start + duration });
+                start += duration;
+            }
+            if (keep)
+            {
+                frame.gpuDuration = start;
+                frame.gpuResolved = true;
+            }
+            set.used = 0;
+        }
+    }
+};
+
+// times the enclosing block on the CPU
+class ProfileScope
+{
+public:
+    ProfileScope(Profiler &profiler, const char* name) : profiler(profiler), name(name), start(profiler.BeginCpu()) {}
+    ~ProfileScope() { profiler.EndCpu(name, start); }
+
+private:
+    Profiler &profiler;
+    const char* name;
+    double start;
+};
+
+// times the GL commands issued in the enclosing block on the GPU
+class GpuScope
+{
+public:
+    GpuScope(Profiler &profiler, const char* name) : profiler(profiler) { profiler.BeginGpu(name); }
+    ~GpuScope() { profiler.EndGpu(); }
+
+private:
+    Profiler &profiler;
+};
+
+#endif
@@ -0,0 +1,208 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glad/glad.h>
+
+#include "shader.h"
+#include "gl_state.h"
+
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <cstring>
+
+// passes are submitted in this order
+enum RenderPass
+{
+    PASS_BACKGROUND,  // skybox
+    PASS_OPAQUE,      // first light + ambient, front to back
+    PASS_ADDITIVE,    // one draw per additional light, blended on top of the opaque pass
+    PASS_TRANSPARENT, // back to front
+    PASS_COUNT
+};
+
+// a draw in the queue: the program and textures are bound by the queue,
+// the callback sets the per draw uniforms and issues the draw call
+struct RenderItem
+{
+    struct TextureBinding
+    {
+        GLuint unit;
+        GLenum target;
+        GLuint id;
+    };
+
+    static const int MAX_TEXTURES = 8;
+
+    Shader* shader = nullptr;
+    TextureBinding textures[MAX_TEXTURES];
+    int textureCount = 0;
+    std::function<void()> draw;
+
+    void AddTexture(GLuint unit, GLenum target, GLuint id)
+    {
+        if (textureCount < MAX_TEXTURES)
+            textures[textureCount++] = { unit, target, id };
+    }
+};
+
+// Collects the draws of a frame with a 64 bit sort key each, sorts them with a radix sort and submits them in order.
+// Key layout, from the most significant bit:
+//   pass (4) | program (12) | material (20) | depth (28)    for every pass but PASS_TRANSPARENT
+//   pass (4) | inverted depth (28) | program (12) | material (20)  for PASS_TRANSPARENT
+// so within a pass the draws are grouped by program and textures, and opaque draws of the same
+// material go front to back to get the most out of the early depth test.
+class RenderQueue
+{
+public:
+    // counters for the last Submit(), shown in the GUI
+    int draws = 0;
+    int programSwitches = 0;
+    int materialSwitches = 0;
+
+    // the program and material are GL names, folded into their fields. Collisions only cost a state switch
+    static uint64_t MakeKey(RenderPass pass, GLuint program, GLuint material, uint32_t depth)
+    {
+        uint64_t p = (uint64_t)pass & 0xFu;
+        uint64_t prog = (uint64_t)program & 0xFFFu;
+        uint64_t mat = (uint64_t)material & 0xFFFFFu;
+        uint64_t d = (uint64_t)depth & 0xFFFFFFFu;
+        if (pass == PASS_TRANSPARENT)
+            return (p << 60) | ((0xFFFFFFFu - d) << 32) | (prog << 20) | mat;
+        return (p << 60) | (prog << 48) | (mat << 28) | d;
+    }
+
+    // maps a view distance to the 28 bit depth field
+    static uint32_t QuantizeDepth(float viewDistance, float cameraNear, float cameraFar)
+    {
+        float t = (viewDistance - cameraNear) / (cameraFar - cameraNear);
+        t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+        return (uint32_t)(t * (float)0xFFFFFFFu);
+    }
+
+    void Clear()
+    {
+        items.clear();
+        commands.clear();
+    }
+
+    // adds a draw, the returned item is filled by the caller. It is only valid until the next Add()
+    RenderItem& Add(uint64_t key)
+    {
+        commands.push_back({ key, (unsigned int)items.size() });
+        items.emplace_back();
+        return items.back();
+    }
+
+    // called when the submission enters and leaves a pass, to set the blend and depth state of the pass
+    void SetPassState(RenderPass pass, std::function<void()> begin, std::function<void()> end)
+    {
+        passBegin[pass] = begin;
+        passEnd[pass] = end;
+    }
+
+    // least significant digit radix sort, 8 bits per digit. Digits that are the same for
+    // every key (e.g. the pass when there is only one) are skipped
+    void Sort()
+    {
+        size_t n = commands.size();
+        if (n < 2)
+            return;
+        scratch.resize(n);
+        Command* src = commands.data();
+        Command* dst = scratch.data();
+        for (int shift = 0; shift < 64; shift += 8)
+        {
+            size_t counts[256];
+            std::memset(counts, 0, sizeof(counts));
+            for (size_t i = 0; i < n; i++)
+                counts[(src[i].key >> shift) & 0xFF]++;
+            if (counts[(src[0].key >> shift) & 0xFF] == n)
+                continue;
+
+            size_t offset = 0;
+            for (int d = 0; d < 256; d++)
+            {
+                size_t c = counts[d];
+                counts[d] = offset;
+                offset += c;
+            }
+            for (size_t i = 0; i < n; i++)
+                dst[counts[(src[i].key >> shift) & 0xFF]++] = src[i];
+            Command* tmp = src;
+            src = dst;
+            dst = tmp;
+        }
+        if (src != commands.data())
+            commands.swap(scratch);
+    }
+
+    // binds the program and textures of each draw through the state cache and calls it
+    void Submit()
+    {
+        draws = programSwitches = materialSwitches = 0;
+        int currentPass = -1;
+        GLuint currentProgram = 0;
+        uint64_t currentMaterial = ~(uint64_t)0;
+        for (const Command &command : commands)
+        {
+            int pass = (int)(command.key >> 60);
+            if (pass != currentPass)
+            {
+                if (currentPass >= 0 && passEnd[currentPass])
+                    passEnd[currentPass]();
+                currentPass = pass;
+                if (passBegin[pass])
+                    passBegin[pass]();
+            }
+
+            RenderItem &item = items[command.item];
+            if (item.shader && item.shader->ID != currentProgram)
+            {
+                currentProgram = item.shader->ID;
+                programSwitches++;
+            }
+            if (item.shader)
+                item.shader->use();
+
+            uint64_t material = materialBits(command.key);
+            if (material != currentMaterial)
+            {
+                currentMaterial = material;
+                materialSwitches++;
+            }
+            for (int t = 0; t < item.textureCount; t++)
+                glState.BindTexture(item.textures[t].unit, item.textures[t].target, item.textures[t].id);
+
+            if (item.draw)
+                item.draw();
+            draws++;
+        }
+        if (currentPass >= 0 && passEnd[currentPass])
+            passEnd[currentPass]();
+    }
+
+    int Size() const { return (int)commands.size(); }
+
+private:
+    struct Command
+    {
+        uint64_t key;
+        unsigned int item;
+    };
+
+    std::vector<RenderItem> items;
+    std::vector<Command> commands;
+    std::vector<Command> scratch;
+    std::function<void()> passBegin[PASS_COUNT];
+    std::function<void()> passEnd[PASS_COUNT];
+
+    static uint64_t materialBits(uint64_t key)
+    {
+        if ((key >> 60) == PASS_TRANSPARENT)
+            return key & 0xFFFFFu;
+        return (key >> 28) & 0xFFFFFu;
+    }
+};
+
+#endif
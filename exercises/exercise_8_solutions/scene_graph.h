@@ -0,0 +1,126 @@
+#ifndef SCENE_GRAPH_H
+#define SCENE_GRAPH_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+// Transform hierarchy stored as parallel arrays (structure of arrays), with every node after its parent
+// and every subtree in one contiguous range [node, subtreeEnd[node]). Updating the world matrices is
+// then a forward walk over the ranges of the nodes whose local matrix changed: a parent's world matrix
+// is always computed before its children read it, and untouched subtrees are never visited.
+// Nodes are appended depth first (a new node's parent must be the last node or one of its ancestors),
+// which is the order a recursive loader produces. Nodes are never removed, so their indices stay valid.
+class SceneGraph
+{
+public:
+    static const int NO_PARENT = -1;
+
+    // nodes [begin, end)
+    struct Range
+    {
+        int begin, end;
+    };
+
+    // counters of the last UpdateWorld(), shown in the GUI
+    int nodesUpdated = 0;
+    int subtreesUpdated = 0;
+
+    // returns the index of the new node, or -1 if the subtree of the parent is already closed
+    int AddNode(int parentNode, const glm::mat4 &localTransform)
+    {
+        int node = Size();
+        if (parentNode != NO_PARENT && (parentNode >= node || subtreeEnd[parentNode] != node))
+            return -1;
+
+        parent.push_back(parentNode);
+        subtreeEnd.push_back(node + 1);
+        local.push_back(localTransform);
+        world.push_back(parentNode == NO_PARENT ? localTransform : world[parentNode] * localTransform);
+        dirty.push_back(0);
+
+        // the new node extends the subtree of every ancestor
+        for (int ancestor = parentNode; ancestor != NO_PARENT; ancestor = parent[ancestor])
+            subtreeEnd[ancestor] = node + 1;
+
+        addChanged(node, node + 1);
+        return node;
+    }
+
+    int Size() const { return (int)parent.size(); }
+    int Parent(int node) const { return parent[node]; }
+    int SubtreeEnd(int node) const { return subtreeEnd[node]; }
+    const glm::mat4& Local(int node) const { return local[node]; }
+    const glm::mat4& World(int node) const { return world[node]; }
+    const glm::mat4* WorldMatrices() const { return world.empty() ? nullptr : &world[0]; }
+
+    // the world matrices of the node and its subtree are recomputed by the next UpdateWorld()
+    void SetLocal(int node, const glm::mat4 &localTransform)
+    {
+        local[node] = localTransform;
+        if (!dirty[node])
+        {
+            dirty[node] = 1;
+            dirtyNodes.push_back(node);
+        }
+    }
+
+    // propagates the changed local matrices to the world matrices of their subtrees.
+    // a dirty node inside a subtree that is already being updated costs nothing extra
+    void UpdateWorld()
+    {
+        nodesUpdated = 0;
+        subtreesUpdated = 0;
+        if (dirtyNodes.empty())
+            return;
+
+        std::sort(dirtyNodes.begin(), dirtyNodes.end());
+        int covered = 0; // nodes before this are up to date
+        for (int root : dirtyNodes)
+        {
+            dirty[root] = 0;
+            if (root < covered)
+                continue;
+            int end = subtreeEnd[root];
+            for (int node = root; node < end; node++)
+            {
+                int p = parent[node];
+                world[node] = p == NO_PARENT ? local[node] : world[p] * local[node];
+            }
+            nodesUpdated += end - root;
+            subtreesUpdated++;
+            addChanged(root, end);
+            covered = end;
+        }
+        dirtyNodes.clear();
+    }
+
+    // the ranges of nodes whose world matrix changed since the last call, in no particular order.
+    // the list is emptied, so there should be only one consumer
+    void TakeChangedRanges(std::vector<Range> &ranges)
+    {
+        ranges.clear();
+        ranges.swap(changed);
+    }
+
+private:
+    std::vector<int> parent;
+    std::vector<int> subtreeEnd;
+    std::vector<glm::mat4> local;
+    std::vector<glm::mat4> world;
+    std::vector<uint8_t> dirty;
+    std::vector<int> dirtyNodes;
+    std::vector<Range> changed;
+
+    void addChanged(int begin, int end)
+    {
+        if (!changed.empty() && changed.back().end == begin)
+            changed.back().end = end;
+        else
+            changed.push_back({ begin, end });
+    }
+};
+
+#endif
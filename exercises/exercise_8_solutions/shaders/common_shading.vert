@@ -3,26 +3,36 @@ layout (location = 0) in vec3 vertex;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec2 textCoord;
 layout (location = 3) in vec3 tangent;
+layout (location = 5) in mat4 instanceModel; // per-instance model matrix (locations 5 to 8)
+layout (location = 9) in float objectIndex;  // object of the vertex in a static batch
 
 //uniform mat4 model; // represents model coordinates in the world coord space
 uniform mat4 viewProjection;  // represents the view and projection matrices combined
-uniform mat4 lightSpaceMatrix;   // transforms from world space to light space
-// @PHIJ 
-uniform mat4 models[100]; // - uniform denoting offset positions for instancing.
 
+// static batches draw many objects in one call, their model matrices are 4 texels each in a buffer texture
+uniform bool useObjectTransforms;
+uniform samplerBuffer objectTransforms;
 
 out vec4 worldPos;
 out vec3 worldNormal;
 out vec3 worldTangent;
 out vec2 textureCoordinates;
-
-// TODO 8.1 : Add an 'out' variable for vertex position in light space
-out vec4 lightPos;
+flat out float dissolve; // share of the pixels of a leaf the density LOD drops, see density_lod.h
 
 
 void main() {
 
-    mat4 model = models[gl_InstanceID];
+    // the bottom row of an affine matrix is (0, 0, 0, 1), the density LOD keeps the dissolve of the leaf in it
+    mat4 model = instanceModel;
+    dissolve = model[0][3];
+    model[0][3] = 0.0;
+    if (useObjectTransforms)
+    {
+        int base = int(objectIndex) * 4;
+        model = mat4(texelFetch(objectTransforms, base), texelFetch(objectTransforms, base + 1),
+                     texelFetch(objectTransforms, base + 2), texelFetch(objectTransforms, base + 3));
+        dissolve = 0.0;
+    }
 
    // vertex in world space (for lighting computation)
    worldPos = model * vec4(vertex, 1.0);
@@ -31,8 +41,7 @@ void main() {
    // tangent in world space (for lighting computation)
    worldTangent = (model * vec4(tangent, 0.0)).xyz;
 
-   // TODO 8.1 : obtain and pass to fragment shader the position in light space, converting from world space
-   lightPos = lightSpaceMatrix * worldPos;
+   // the position in light space is computed in the fragment shader, once the shadow cascade is known
 
    textureCoordinates = textCoord;
 
@@ -24,8 +24,28 @@ uniform sampler2D texture_diffuse1;		// gl_tex1 - albedo coloring
 uniform sampler2D texture_normal1;		// gl_tex2 - normal map (wo/ bumps)
 uniform sampler2D texture_ambient1;		// unused - no ambient texture
 uniform sampler2D texture_specular1;	// unused - no specular texture, we compute this instead.
-uniform samplerCube skybox;				// gl_tex5 - Skybox cubemap
-uniform sampler2D shadowMap;			// gl_tex6 - shadow map
+uniform samplerCube skybox;				// gl_tex5 - sky prefiltered with GGX, mip = roughness * 5
+uniform sampler2D brdfLut;				// gl_tex13 - split sum scale and bias of F0, by N.V and roughness
+uniform sampler2DArray shadowMap;		// gl_tex6 - shadow map cascades
+
+// irradiance of the sky as 9 spherical harmonics coefficients, baked by EnvironmentBaker
+layout (std140) uniform Environment
+{
+   vec4 irradianceSH[9];
+};
+
+// shadow cascades, see pbr_shading.frag
+#define MAX_SHADOW_CASCADES 4
+uniform mat4 lightSpaceMatrices[MAX_SHADOW_CASCADES]; // transforms from world space to the light space of each cascade
+uniform float cascadeSplits[MAX_SHADOW_CASCADES];     // far view distance of each cascade
+uniform int cascadeCount;
+uniform vec3 camForward; // to compute the view distance of the fragment
+
+// positional light shadows, a tile of the shared shadow atlas
+uniform sampler2D shadowAtlas;  // gl_tex9
+uniform int lightHasShadow;
+uniform mat4 lightShadowMatrix; // transforms from world space to the light's perspective
+uniform vec4 shadowAtlasRect;   // uv offset (xy) and scale (zw) of the light's tile
 
 // @PHIJ -- 
 uniform sampler2D texture_translucency1;// gl_tex7 - translucency texture
@@ -34,20 +54,58 @@ uniform sampler2D texture_roughness1;   // gl_tex8 - roughness texture
 uniform float epsilonC; // - A float of a computed constant value for beer's law.
 uniform float minThickness, maxThickness; // - unifron floats for thickness filtering.
 
+// back-lit light of the reduced resolution translucency pass (translucency.frag), see translucency.h
+uniform int translucencyMode;             // 0: shaded here, 1: read and added by this pass (first light), 2: read, added by the first light
+uniform sampler2D translucencyLight;      // gl_tex11 - back-lit light of every light without the albedo, transmittance in alpha
+uniform sampler2D translucencyGuide;      // gl_tex12 - face normal and distance to the camera of the reduced pixels
+uniform vec2 translucencyScale;           // from full resolution pixels to reduced pixels
+uniform vec2 translucencySize;            // reduced pixels drawn
+uniform float translucencyDepthTolerance; // relative distance difference that halves the weight of a reduced pixel
+
+// material level of detail of the instanced batch, see material_lod.h. The same for every fragment of a draw,
+// so the branches on it are coherent and the fetches of the skipped paths are never issued
+uniform int materialTier;      // 0: full, 1: face normal and constant roughness, 2: also mean translucency and no reflection fetch
+uniform float lodRoughness;    // mean roughness of the leaf, tiers 1 and 2
+uniform float lodTranslucency; // mean of the translucency texture, tier 2
+
 // 'in' variables to receive the interpolated Position and Normal from the vertex shader
 in vec4 worldPos;
 in vec3 worldNormal;
 in vec3 worldTangent;
 in vec2 textureCoordinates;
+flat in float dissolve;
 
 
 const float PI = 3.14159265359;
 float rough_local; // replaced all uses of roughness uniform with roughness texture sampling.
 
-vec3 GetAmbientLighting(vec3 albedo, vec3 normal)
+// the pixels of a leaf the density LOD drops while it fades out, an ordered dither so the passes of
+// the leaf drop the same ones
+bool Dissolved()
+{
+   const float BAYER[16] = float[16](0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0, 3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+   ivec2 p = ivec2(gl_FragCoord.xy) & 3;
+   return dissolve > (BAYER[p.y * 4 + p.x] + 0.5) / 16.0;
+}
+
+// irradiance of the sky arriving at a surface facing n
+vec3 IrradianceSH(vec3 n)
 {
+   return irradianceSH[0].rgb * 0.282095
+        + irradianceSH[1].rgb * (0.488603 * n.y)
+        + irradianceSH[2].rgb * (0.488603 * n.z)
+        + irradianceSH[3].rgb * (0.488603 * n.x)
+        + irradianceSH[4].rgb * (1.092548 * n.x * n.y)
+        + irradianceSH[5].rgb * (1.092548 * n.y * n.z)
+        + irradianceSH[6].rgb * (0.315392 * (3.0 * n.z * n.z - 1.0))
+        + irradianceSH[7].rgb * (1.092548 * n.x * n.z)
+        + irradianceSH[8].rgb * (0.546274 * (n.x * n.x - n.y * n.y));
+}
 
-   vec3 ambient = textureLod(skybox, normal, 5.0f).rgb;
+vec3 GetAmbientLighting(vec3 albedo, vec3 normal)
+{
+   // the cosine weighted mean of the sky around the normal, what the blurred mip of the sky stood for
+   vec3 ambient = IrradianceSH(normal) / PI;
 
    ambient *= albedo / PI;
    ambient *= ambientLightColor.a; 
@@ -59,13 +117,24 @@ vec3 GetAmbientLighting(vec3 albedo, vec3 normal)
    return ambient;
 }
 
+// scale and bias of F0 for the specular of the sky (BrdfLut), the Fresnel weight of the prefiltered sky
+vec3 EnvironmentFresnel(vec3 F0, float NdotV, float roughness)
+{
+   vec2 scaleBias = texture(brdfLut, vec2(NdotV, roughness)).rg;
+   return F0 * scaleBias.x + scaleBias.y;
+}
+
 vec3 GetEnvironmentLighting(vec3 N, vec3 V)
 {
    // Compute reflected light vector (R)
    vec3 R = reflect(-V, N);
 
-   // Sample cubemap
-   vec3 reflection = textureLod(skybox, R, rough_local * 5.0f).rgb;
+   // Sample the mip of the prefiltered sky with the roughness, the far leaves take the irradiance around R instead
+   vec3 reflection;
+   if (materialTier < 2)
+      reflection = textureLod(skybox, R, rough_local * 5.0f).rgb;
+   else
+      reflection = IrradianceSH(R) / PI;
     reflection *= ambientLightColor.a; 
 
    return reflection;
@@ -161,6 +230,35 @@ vec3 GetLambertianDiffuse(vec3 texC){
     return texC / PI;
 }
 
+// joint bilateral upsampling of the reduced pass: the 4 reduced pixels around this one, weighted bilinearly and
+// by how well their surface matches this one. False when none of them saw this surface (edges of the leaves),
+// the pass shades the translucency of its light at full rate then
+bool UpsampleTranslucency(vec3 faceNormal, float viewDistance, out vec4 upsampled)
+{
+   vec2 p = gl_FragCoord.xy * translucencyScale - 0.5;
+   vec2 base = floor(p);
+   vec2 f = p - base;
+   ivec2 lastTexel = ivec2(translucencySize) - 1;
+
+   vec4 sum = vec4(0.0);
+   float weightSum = 0.0;
+   for (int i = 0; i < 4; i++)
+   {
+      ivec2 offset = ivec2(i & 1, i >> 1);
+      ivec2 texel = clamp(ivec2(base) + offset, ivec2(0), lastTexel);
+      vec4 guide = texelFetch(translucencyGuide, texel, 0);
+      vec2 bilinear = mix(1.0 - f, f, vec2(offset));
+      // the cleared pixels have no surface
+      float depthWeight = guide.w > 0.0 ? exp2(-abs(guide.w - viewDistance) / (translucencyDepthTolerance * viewDistance)) : 0.0;
+      float normalWeight = pow(max(dot(guide.xyz, faceNormal), 0.0), 8.0);
+      float weight = bilinear.x * bilinear.y * depthWeight * normalWeight;
+      sum += texelFetch(translucencyLight, texel, 0) * weight;
+      weightSum += weight;
+   }
+   upsampled = sum / max(weightSum, 1e-6);
+   return weightSum > 1e-3;
+}
+
 float GetAttenuation(vec4 P)
 {
    float distToLight = distance(lightPosition, P.xyz);
@@ -171,16 +269,57 @@ float GetAttenuation(vec4 P)
    return attenuation * falloff;
 }
 
+// the leaves cast on themselves, so both sides of a leaf get the same shadow
+float GetShadow()
+{
+   // Select the cascade that covers the view distance of the fragment, no shadow past the last one
+   float viewDistance = dot(worldPos.xyz - camPosition, camForward);
+   int cascade = 0;
+   while (cascade < cascadeCount && viewDistance > cascadeSplits[cascade])
+      cascade++;
+   if (cascade == cascadeCount)
+      return 1.0;
+
+   vec4 lightPos = lightSpaceMatrices[cascade] * worldPos;
+   vec3 shadowMapSpacePos = (lightPos.xyz / lightPos.w) * 0.5 + 0.5;
+   float depth = texture(shadowMap, vec3(shadowMapSpacePos.xy, cascade)).r;
+   return depth + 0.01f <= clamp(shadowMapSpacePos.z, -1, 1) ? 0.0 : 1.0;
+}
+
+float GetAtlasShadow()
+{
+   if (lightHasShadow == 0)
+      return 1.0;
+
+   vec4 lightPos = lightShadowMatrix * worldPos;
+   vec3 shadowMapSpacePos = (lightPos.xyz / lightPos.w) * 0.5 + 0.5;
+
+   // outside of the light frustum there are no casters
+   if (lightPos.w <= 0.0 || any(lessThan(shadowMapSpacePos, vec3(0.0))) || any(greaterThan(shadowMapSpacePos, vec3(1.0))))
+      return 1.0;
+
+   // map to the tile, half a texel away from its border so filtering does not read the neighbours
+   vec2 halfTexel = 0.5 / vec2(textureSize(shadowAtlas, 0));
+   vec2 uv = clamp(shadowAtlasRect.xy + shadowMapSpacePos.xy * shadowAtlasRect.zw, shadowAtlasRect.xy + halfTexel, shadowAtlasRect.xy + shadowAtlasRect.zw - halfTexel);
+   float depth = texture(shadowAtlas, uv).r;
+   return depth + 0.0005 <= shadowMapSpacePos.z ? 0.0 : 1.0;
+}
+
 void main()
 {
     // Variable declarations.
 	vec4 texColor = texture(texture_diffuse1, textureCoordinates); // albedo
+    // the translucency texture may be read in a branch below, where the derivatives of the quad are not defined
+    vec2 uvDx = dFdx(textureCoordinates);
+    vec2 uvDy = dFdy(textureCoordinates);
     // Alpha discarding - no need to do work on non-rendered (transparent) fragments.
-	if(texColor.a < 0.5f ){
+	if(texColor.a < 0.5f || Dissolved()){
 		discard;
 	}
-    vec4 transluscencySample = texture(texture_translucency1, textureCoordinates); // translusency texture, secondary albedo.
-    vec3 N = GetNormalMap();
+    vec3 faceNormal = normalize(worldNormal) * (gl_FrontFacing ? -1.0f : 1.0f);
+    vec3 N = faceNormal;
+    if (materialTier == 0)
+        N = GetNormalMap();
     vec4 P = worldPos;
 	bool directional = lightRadius <= 0; // Checks if light is directional
     vec3 L = normalize(lightPosition - (directional ? vec3(0.0f) : worldPos.xyz)); // light direction
@@ -189,7 +328,10 @@ void main()
     vec3 F0 = vec3(0.028f); // Assumption that the leaf has the same base reflectance as human skin.
     vec3 F = FresnelSchlick(F0, max(dot(H, V), 0.0));
     // overwrite roughness uniform.
-    rough_local = 1.0f - vec4(texture(texture_roughness1, textureCoordinates).rgb, 1.0f).r;
+    if (materialTier == 0)
+        rough_local = 1.0f - vec4(texture(texture_roughness1, textureCoordinates).rgb, 1.0f).r;
+    else
+        rough_local = lodRoughness;
 
     //-----
     
@@ -201,23 +343,40 @@ void main()
     vec3 lightRadiance = lightColor;
     float attenuation = directional ? 1.0f : GetAttenuation(P);
     lightRadiance *= attenuation;
+    lightRadiance *= directional ? GetShadow() : GetAtlasShadow();
     lightRadiance *= dot(N, L);
-    vec3 FAmbient = FresnelSchlick(F0, max(dot(N, V), 0.0));
+    vec3 FAmbient = EnvironmentFresnel(F0, max(dot(N, V), 0.0), rough_local);
     vec3 indirectLight = mix(ambient, GetEnvironmentLighting(N,V), FAmbient);
     
 
-    float transSample = transluscencySample.r;
     vec3 transluscentLight = GetLambertianDiffuse(texColor.rgb);
-    
-    float thickness = mix(maxThickness, minThickness, transSample);
-    
+
     // front and back-face radiance
     vec3 frontRadiance = max(lightRadiance, 0.0f);
     vec3 backRadiance = max(-lightRadiance, 0.0f);
 
-    // lighting interpolation
-    vec3 notSpecular = mix(diffuse * frontRadiance, transluscentLight * backRadiance, exp(-epsilonC*(thickness)));
-    vec3 directLight = mix(notSpecular, specular * frontRadiance, F);
+    vec3 directLight;
+    vec4 upsampled;
+    if (translucencyMode != 0 && UpsampleTranslucency(faceNormal, distance(camPosition, P.xyz), upsampled))
+    {
+        // the reduced pass has the transmittance, and the back-lit light of every light already
+        // weighted by it and by (1 - F), only the albedo is missing
+        vec3 notSpecular = (1.0f - upsampled.a) * diffuse * frontRadiance;
+        directLight = mix(notSpecular, specular * frontRadiance, F);
+        if (translucencyMode == 1)
+            directLight += transluscentLight * upsampled.rgb;
+    }
+    else
+    {
+        float transSample = lodTranslucency;
+        if (materialTier < 2)
+            transSample = textureGrad(texture_translucency1, textureCoordinates, uvDx, uvDy).r; // translusency texture, secondary albedo.
+        float thickness = mix(maxThickness, minThickness, transSample);
+
+        // lighting interpolation
+        vec3 notSpecular = mix(diffuse * frontRadiance, transluscentLight * backRadiance, exp(-epsilonC*(thickness)));
+        directLight = mix(notSpecular, specular * frontRadiance, F);
+    }
 
 
     // final frag coloring.
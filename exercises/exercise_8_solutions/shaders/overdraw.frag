@@ -0,0 +1,10 @@
+#version 330 core
+// replaces the lighting shaders in the overdraw view: every fragment adds one to the R32F count target
+// (the blending is GL_ONE, GL_ONE). Nothing is discarded, the fragments the lighting shaders discard after
+// running are counted too
+out vec4 FragColor;
+
+void main()
+{
+   FragColor = vec4(1.0, 0.0, 0.0, 0.0);
+}
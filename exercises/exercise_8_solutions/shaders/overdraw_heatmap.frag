@@ -0,0 +1,26 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D counts;  // fragments per pixel, see overdraw.frag
+uniform float scale;       // count shown in red, anything above fades to white
+
+void main()
+{
+   float count = texture(counts, TexCoords).r;
+   if (count < 0.5)
+   {
+      FragColor = vec4(0.0, 0.0, 0.0, 1.0);
+      return;
+   }
+   // blue for one fragment, then cyan, green, yellow and red at the scale
+   float t = clamp((count - 1.0) / max(scale - 1.0, 1.0), 0.0, 1.0);
+   vec3 color = t < 0.25 ? mix(vec3(0.0, 0.0, 1.0), vec3(0.0, 1.0, 1.0), t * 4.0)
+              : t < 0.5  ? mix(vec3(0.0, 1.0, 1.0), vec3(0.0, 1.0, 0.0), t * 4.0 - 1.0)
+              : t < 0.75 ? mix(vec3(0.0, 1.0, 0.0), vec3(1.0, 1.0, 0.0), t * 4.0 - 2.0)
+              :            mix(vec3(1.0, 1.0, 0.0), vec3(1.0, 0.0, 0.0), t * 4.0 - 3.0);
+   // past the scale, up to twice of it
+   color = mix(color, vec3(1.0), clamp(count / scale - 1.0, 0.0, 1.0));
+   FragColor = vec4(color, 1.0);
+}
@@ -24,8 +24,28 @@ uniform sampler2D texture_diffuse1;
 uniform sampler2D texture_normal1;
 uniform sampler2D texture_ambient1;
 uniform sampler2D texture_specular1;
-uniform samplerCube skybox;
-uniform sampler2D shadowMap;
+uniform samplerCube skybox;       // prefiltered with GGX, mip = roughness * 5
+uniform sampler2D brdfLut;        // split sum scale and bias of F0, by N.V and roughness
+uniform sampler2DArray shadowMap; // one layer per shadow cascade
+
+// irradiance of the sky as 9 spherical harmonics coefficients, baked by EnvironmentBaker
+layout (std140) uniform Environment
+{
+   vec4 irradianceSH[9];
+};
+
+// shadow cascades
+#define MAX_SHADOW_CASCADES 4
+uniform mat4 lightSpaceMatrices[MAX_SHADOW_CASCADES]; // transforms from world space to the light space of each cascade
+uniform float cascadeSplits[MAX_SHADOW_CASCADES];     // far view distance of each cascade
+uniform int cascadeCount;
+uniform vec3 camForward; // to compute the view distance of the fragment
+
+// positional light shadows, a tile of the shared shadow atlas
+uniform sampler2D shadowAtlas;
+uniform int lightHasShadow;
+uniform mat4 lightShadowMatrix; // transforms from world space to the light's perspective
+uniform vec4 shadowAtlasRect;   // uv offset (xy) and scale (zw) of the light's tile
 
 // @PHIJ -- 
 uniform sampler2D leafTex;
@@ -38,9 +58,6 @@ in vec3 worldNormal;
 in vec3 worldTangent;
 in vec2 textureCoordinates;
 
-// TODO 8.1 : Add an 'in' variable for vertex position in light space
-in vec4 lightPos;
-
 // Constant Pi
 const float PI = 3.14159265359;
 
@@ -131,13 +148,28 @@ vec3 GetNormalMap()
    return TBN * normalMap;
 }
 
+// irradiance of the sky arriving at a surface facing n
+vec3 IrradianceSH(vec3 n)
+{
+   return irradianceSH[0].rgb * 0.282095
+        + irradianceSH[1].rgb * (0.488603 * n.y)
+        + irradianceSH[2].rgb * (0.488603 * n.z)
+        + irradianceSH[3].rgb * (0.488603 * n.x)
+        + irradianceSH[4].rgb * (1.092548 * n.x * n.y)
+        + irradianceSH[5].rgb * (1.092548 * n.y * n.z)
+        + irradianceSH[6].rgb * (0.315392 * (3.0 * n.z * n.z - 1.0))
+        + irradianceSH[7].rgb * (1.092548 * n.x * n.z)
+        + irradianceSH[8].rgb * (0.546274 * (n.x * n.x - n.y * n.y));
+}
+
 vec3 GetAmbientLighting(vec3 albedo, vec3 normal)
 {
    // TODO 8.2 : Remove this line
    //vec3 ambient = ambientLightColor.rgb * albedo;
 
    // TODO 8.2 : Get the ambient color by sampling the skybox using the normal.
-   vec3 ambient = textureLod(skybox, normal, 5.0f).rgb;
+   // the cosine weighted mean of the sky around the normal, from the baked irradiance
+   vec3 ambient = IrradianceSH(normal) / PI;
 
    // TODO 8.2 : Scale the light by the albedo, considering also that it gets reflected equally in all directions
    ambient *= albedo / PI;
@@ -152,6 +184,13 @@ vec3 GetAmbientLighting(vec3 albedo, vec3 normal)
    return ambient;
 }
 
+// scale and bias of F0 for the specular of the sky (BrdfLut), the Fresnel weight of the prefiltered sky
+vec3 EnvironmentFresnel(vec3 F0, float NdotV, float roughness)
+{
+   vec2 scaleBias = texture(brdfLut, vec2(NdotV, roughness)).rg;
+   return F0 * scaleBias.x + scaleBias.y;
+}
+
 vec3 GetEnvironmentLighting(vec3 N, vec3 V)
 {
    //NEW! Environment reflection
@@ -160,7 +199,7 @@ vec3 GetEnvironmentLighting(vec3 N, vec3 V)
    vec3 R = reflect(-V, N);
 
    // Sample cubemap
-   // HACK: We sample a different mipmap depending on the roughness. Rougher surface will have blurry reflection
+   // The mips of the sky are prefiltered with the GGX lobe of roughness mip / 5 (EnvironmentBaker)
    vec3 reflection = textureLod(skybox, R, roughness * 5.0f).rgb;
 
    // We packed the amount of reflection in ambientLightColor.a
@@ -205,17 +244,48 @@ float GetAttenuation(vec4 P)
 
 float GetShadow()
 {
+   // Select the cascade that covers the view distance of the fragment, no shadow past the last one
+   float viewDistance = dot(worldPos.xyz - camPosition, camForward);
+   int cascade = 0;
+   while (cascade < cascadeCount && viewDistance > cascadeSplits[cascade])
+      cascade++;
+   if (cascade == cascadeCount)
+      return 1.0;
+
+   vec4 lightPos = lightSpaceMatrices[cascade] * worldPos;
+
    // TODO 8.1 : Transform the position in light space to shadow map space: from range (-1, 1) to range (0, 1)
    vec3 shadowMapSpacePos = (lightPos.xyz / lightPos.w) * 0.5 + 0.5;
 
    // TODO 8.1 : Sample the shadow map texture using the XY components of the light in shadow map space
-   float depth = texture(shadowMap, shadowMapSpacePos.xy).r;
+   float depth = texture(shadowMap, vec3(shadowMapSpacePos.xy, cascade)).r;
 
    // TODO 8.1 : Compare the depth value obtained with the Z component of the light in shadow map space. Return 0 if depth is smaller or equal, 1 otherwise
    return depth + 0.01f <= clamp(shadowMapSpacePos.z, -1, 1) ? 0.0 : 1.0;
 }
 
 
+float GetAtlasShadow()
+{
+   if (lightHasShadow == 0)
+      return 1.0;
+
+   vec4 lightPos = lightShadowMatrix * worldPos;
+   vec3 shadowMapSpacePos = (lightPos.xyz / lightPos.w) * 0.5 + 0.5;
+
+   // outside of the light frustum there are no casters
+   if (lightPos.w <= 0.0 || any(lessThan(shadowMapSpacePos, vec3(0.0))) || any(greaterThan(shadowMapSpacePos, vec3(1.0))))
+      return 1.0;
+
+   // map to the tile, half a texel away from its border so filtering does not read the neighbours
+   vec2 halfTexel = 0.5 / vec2(textureSize(shadowAtlas, 0));
+   vec2 uv = clamp(shadowAtlasRect.xy + shadowMapSpacePos.xy * shadowAtlasRect.zw, shadowAtlasRect.xy + halfTexel, shadowAtlasRect.xy + shadowAtlasRect.zw - halfTexel);
+   float depth = texture(shadowAtlas, uv).r;
+
+   // perspective depth is not linear, so the bias is smaller than for the cascades
+   return depth + 0.0005 <= shadowMapSpacePos.z ? 0.0 : 1.0;
+}
+
 void main()
 {
    
@@ -246,8 +316,8 @@ void main()
    float attenuation = positional ? GetAttenuation(P) : 1.0f;
    lightRadiance *= attenuation;
 
-   // Modulate lightRadiance by shadow (only for directional light)
-   float shadow = positional ? 1.0f : GetShadow();
+   // Modulate lightRadiance by shadow (cascades for the directional light, atlas tile for positional lights)
+   float shadow = positional ? GetAtlasShadow() : GetShadow();
    lightRadiance *= shadow;
 
    // Modulate the radiance with the angle of incidence
@@ -264,7 +334,8 @@ void main()
    ambient = mix(ambient, vec3(0), metalness);
 
    // TODO 8.4 : Compute the Fresnel term for indirect light, using the clamped cosine of the angle formed by the NORMAL vector and the view vector
-   vec3 FAmbient = FresnelSchlick(F0, max(dot(N, V), 0.0));
+   // the Fresnel of the whole GGX lobe, with its shadowing and masking (split sum)
+   vec3 FAmbient = EnvironmentFresnel(F0, max(dot(N, V), 0.0), roughness);
 
    // TODO 8.4 : Mix ambient and environment using the fresnel you just computed as blend factor
    vec3 indirectLight = mix(ambient, environment, FAmbient);
@@ -22,7 +22,20 @@ uniform sampler2D texture_normal1;
 uniform sampler2D texture_ambient1;
 uniform sampler2D texture_specular1;
 uniform samplerCube skybox;
-uniform sampler2D shadowMap;
+uniform sampler2DArray shadowMap; // one layer per shadow cascade
+
+// shadow cascades
+#define MAX_SHADOW_CASCADES 4
+uniform mat4 lightSpaceMatrices[MAX_SHADOW_CASCADES]; // transforms from world space to the light space of each cascade
+uniform float cascadeSplits[MAX_SHADOW_CASCADES];     // far view distance of each cascade
+uniform int cascadeCount;
+uniform vec3 camForward; // to compute the view distance of the fragment
+
+// positional light shadows, a tile of the shared shadow atlas
+uniform sampler2D shadowAtlas;
+uniform int lightHasShadow;
+uniform mat4 lightShadowMatrix; // transforms from world space to the light's perspective
+uniform vec4 shadowAtlasRect;   // uv offset (xy) and scale (zw) of the light's tile
 
 // 'in' variables to receive the interpolated Position and Normal from the vertex shader
 in vec4 worldPos;
@@ -30,9 +43,6 @@ in vec3 worldNormal;
 in vec3 worldTangent;
 in vec2 textureCoordinates;
 
-// TODO 8.1 : Add an 'in' variable for vertex position in light space
-in vec4 lightPos;
-
 
 vec3 GetNormalMap()
 {
@@ -121,16 +131,47 @@ float GetAttenuation(vec4 P)
 
 float GetShadow()
 {
+   // Select the cascade that covers the view distance of the fragment, no shadow past the last one
+   float viewDistance = dot(worldPos.xyz - camPosition, camForward);
+   int cascade = 0;
+   while (cascade < cascadeCount && viewDistance > cascadeSplits[cascade])
+      cascade++;
+   if (cascade == cascadeCount)
+      return 1.0;
+
+   vec4 lightPos = lightSpaceMatrices[cascade] * worldPos;
+
    // TODO 8.1 : Transform the position in light space to shadow map space: from range (-1, 1) to range (0, 1)
    vec3 shadowMapSpacePos = (lightPos.xyz / lightPos.w) * 0.5 + 0.5;
 
    // TODO 8.1 : Sample the shadow map texture using the XY components of the light in shadow map space
-   float depth = texture(shadowMap, shadowMapSpacePos.xy).r;
+   float depth = texture(shadowMap, vec3(shadowMapSpacePos.xy, cascade)).r;
 
    // TODO 8.1 : Compare the depth value obtained with the Z component of the light in shadow map space. Return 0 if depth is smaller or equal, 1 otherwise
    return depth + 0.01f <= clamp(shadowMapSpacePos.z, -1, 1) ? 0.0 : 1.0;
 }
 
+float GetAtlasShadow()
+{
+   if (lightHasShadow == 0)
+      return 1.0;
+
+   vec4 lightPos = lightShadowMatrix * worldPos;
+   vec3 shadowMapSpacePos = (lightPos.xyz / lightPos.w) * 0.5 + 0.5;
+
+   // outside of the light frustum there are no casters
+   if (lightPos.w <= 0.0 || any(lessThan(shadowMapSpacePos, vec3(0.0))) || any(greaterThan(shadowMapSpacePos, vec3(1.0))))
+      return 1.0;
+
+   // map to the tile, half a texel away from its border so filtering does not read the neighbours
+   vec2 halfTexel = 0.5 / vec2(textureSize(shadowAtlas, 0));
+   vec2 uv = clamp(shadowAtlasRect.xy + shadowMapSpacePos.xy * shadowAtlasRect.zw, shadowAtlasRect.xy + halfTexel, shadowAtlasRect.xy + shadowAtlasRect.zw - halfTexel);
+   float depth = texture(shadowAtlas, uv).r;
+
+   // perspective depth is not linear, so the bias is smaller than for the cascades
+   return depth + 0.0005 <= shadowMapSpacePos.z ? 0.0 : 1.0;
+}
+
 void main()
 {
    vec4 P = worldPos;
@@ -161,8 +202,8 @@ void main()
    float attenuation = positional ? GetAttenuation(P) : 1.0f;
    lightRadiance *= attenuation;
 
-   // Modulate lightRadiance by shadow (only for directional light)
-   float shadow = positional ? 1.0f : GetShadow();
+   // Modulate lightRadiance by shadow (cascades for the directional light, atlas tile for positional lights)
+   float shadow = positional ? GetAtlasShadow() : GetShadow();
    lightRadiance *= shadow;
 
    vec3 indirectLight = ambient + environment;
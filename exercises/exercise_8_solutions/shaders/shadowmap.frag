@@ -1,6 +1,13 @@
 #version 330 core
 
+uniform sampler2D opacityTexture; // single channel opacity of the leaf
+
+in vec2 textureCoordinates;
+
 void main()
 {
+   // same cutoff as the alpha discard in leaf_shading.frag, so the shadow matches the visible leaf
+   if (texture(opacityTexture, textureCoordinates).r < 0.5)
+      discard;
    // gl_FragDepth = gl_FragCoord.z;
 }
\ No newline at end of file
@@ -1,10 +1,14 @@
 #version 330 core
 layout (location = 0) in vec3 vertex;
+layout (location = 2) in vec2 textCoord;
+layout (location = 5) in mat4 instanceModel; // same per-instance transforms as the color pass
 
 uniform mat4 lightSpaceMatrix;
-uniform mat4 model;
+
+out vec2 textureCoordinates;
 
 void main()
 {
-   gl_Position = lightSpaceMatrix * model * vec4(vertex, 1.0);
+   textureCoordinates = textCoord;
+   gl_Position = lightSpaceMatrix * instanceModel * vec4(vertex, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,97 @@
+#version 330 core
+// reduced resolution translucency pass, see translucency.h. The terms are the ones of leaf_shading.frag
+layout (location = 0) out vec4 BackLight; // back-lit light of every light without the albedo, transmittance in alpha
+layout (location = 1) out vec4 Guide;     // face normal and distance to the camera
+
+uniform vec3 camPosition;
+
+// every light of the scene in one pass, up to MAX_LIGHTS (the light passes of the others shade their own)
+const int MAX_LIGHTS = 16;
+uniform int lightCount;
+uniform vec3 lightPositions[MAX_LIGHTS];
+uniform vec3 lightColors[MAX_LIGHTS];
+uniform float lightRadii[MAX_LIGHTS];
+
+uniform sampler2D texture_diffuse1;      // gl_tex1 - albedo, only the alpha is used
+uniform sampler2D texture_normal1;       // gl_tex2 - normal map
+uniform sampler2D texture_translucency1; // gl_tex7 - translucency texture
+
+uniform float epsilonC; // Epsilon * C of beer's law
+uniform float minThickness, maxThickness;
+
+in vec4 worldPos;
+in vec3 worldNormal;
+in vec3 worldTangent;
+in vec2 textureCoordinates;
+flat in float dissolve;
+
+// the normal of the quad, turned like in GetNormalMap()
+vec3 GetFaceNormal()
+{
+   vec3 N = normalize(worldNormal);
+   return gl_FrontFacing ? -N : N;
+}
+
+// the pixels of a leaf the density LOD drops while it fades out, an ordered dither so the leaf is dropped
+// like in leaf_shading.frag
+bool Dissolved()
+{
+   const float BAYER[16] = float[16](0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0, 3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+   ivec2 p = ivec2(gl_FragCoord.xy) & 3;
+   return dissolve > (BAYER[p.y * 4 + p.x] + 0.5) / 16.0;
+}
+
+vec3 GetNormalMap()
+{
+   vec3 normalMap = normalize(texture(texture_normal1, textureCoordinates).rgb * 2.0 - 1.0);
+   vec3 N = normalize(worldNormal);
+   vec3 B = normalize(cross(worldTangent, N));
+   vec3 T = cross(N, B);
+   if(gl_FrontFacing){
+        N *= -1.0f;
+    }
+   return mat3(T, B, N) * normalMap;
+}
+
+vec3 FresnelSchlick(vec3 F0, float cosTheta)
+{
+   return F0 + (1.0 - F0) * pow(clamp(1.0 - cosTheta, 0.0, 1.0), 5.0);
+}
+
+float GetAttenuation(vec3 P, vec3 lightPosition, float lightRadius)
+{
+   float distToLight = distance(lightPosition, P);
+   float attenuation = 1.0f / (distToLight * distToLight);
+   float falloff = smoothstep(lightRadius, lightRadius*0.5f, distToLight);
+   return attenuation * falloff;
+}
+
+void main()
+{
+   if (texture(texture_diffuse1, textureCoordinates).a < 0.5f || Dissolved())
+      discard;
+
+   vec3 N = GetNormalMap();
+   vec3 P = worldPos.xyz;
+   vec3 V = normalize(camPosition - P);
+   vec3 F0 = vec3(0.028f);
+
+   float thickness = mix(maxThickness, minThickness, texture(texture_translucency1, textureCoordinates).r);
+   float transmittance = exp(-epsilonC * thickness);
+
+   // the part of mix(notSpecular, specular, F) in leaf_shading.frag that comes from the back radiance
+   vec3 backLight = vec3(0.0f);
+   for (int i = 0; i < lightCount; i++)
+   {
+      bool directional = lightRadii[i] <= 0;
+      vec3 L = normalize(lightPositions[i] - (directional ? vec3(0.0f) : P));
+      vec3 H = normalize(L + V);
+      vec3 F = FresnelSchlick(F0, max(dot(H, V), 0.0));
+      float attenuation = directional ? 1.0f : GetAttenuation(P, lightPositions[i], lightRadii[i]);
+      vec3 backRadiance = max(-lightColors[i] * attenuation * dot(N, L), 0.0f);
+      backLight += (1.0 - F) * transmittance * backRadiance;
+   }
+
+   BackLight = vec4(backLight, transmittance);
+   Guide = vec4(GetFaceNormal(), distance(camPosition, P));
+}
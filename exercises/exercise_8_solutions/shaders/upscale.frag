@@ -0,0 +1,35 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D scene;   // the scaled frame is in the lower left part of it
+uniform vec2 region;       // size of that part, in texture coordinates
+uniform vec2 texelSize;
+uniform float sharpness;   // 0 to 1
+
+vec3 sampleScene(vec2 uv)
+{
+   // stay half a texel inside the drawn part, so the bilinear filter never reads what is outside of it
+   return texture(scene, clamp(uv, 0.5 * texelSize, region - 0.5 * texelSize)).rgb;
+}
+
+// contrast adaptive sharpening (after AMD FidelityFX CAS): the cross of neighbours is subtracted from the
+// center, less where the local contrast is already high, so edges get crisper without ringing
+void main()
+{
+   vec2 uv = TexCoords * region;
+   vec3 center = sampleScene(uv);
+   vec3 up = sampleScene(uv + vec2(0.0, texelSize.y));
+   vec3 down = sampleScene(uv - vec2(0.0, texelSize.y));
+   vec3 left = sampleScene(uv - vec2(texelSize.x, 0.0));
+   vec3 right = sampleScene(uv + vec2(texelSize.x, 0.0));
+
+   vec3 low = min(center, min(min(up, down), min(left, right)));
+   vec3 high = max(center, max(max(up, down), max(left, right)));
+   vec3 amount = sqrt(clamp(min(low, 1.0 - high) / max(high, vec3(1e-4)), 0.0, 1.0));
+   vec3 weight = -amount / mix(8.0, 5.0, sharpness);
+
+   vec3 color = (center + (up + down + left + right) * weight) / (1.0 + 4.0 * weight);
+   FragColor = vec4(clamp(color, 0.0, 1.0), 1.0);
+}
@@ -0,0 +1,247 @@
+#ifndef SHADOW_ATLAS_H
+#define SHADOW_ATLAS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <algorithm>
+
+// square region of the atlas, in texels
+struct AtlasTile
+{
+    int x, y, size;
+};
+
+// Packs the shadow maps of many lights into one depth texture.
+// Tiles are power of two squares handed out by a quadtree buddy allocator: a tile is split in four
+// when a smaller one is needed, and merged back when its four children are free again.
+// Each light asks for a tile size based on how much of the screen it covers, and only a limited
+// number of tiles are redrawn per frame, picking the ones that were updated least recently.
+class ShadowAtlas
+{
+public:
+    // per light bookkeeping, indexed by light index
+    struct Slot
+    {
+        bool allocated = false;
+        bool valid = false;             // tile contents match matrix
+        AtlasTile tile = {0, 0, 0};
+        glm::mat4 matrix;               // light space matrix the tile was rendered with
+        glm::mat4 pendingMatrix;        // light space matrix requested this frame
+        unsigned int casterVersion = 0; // casters the tile was rendered with
+        unsigned int lastUpdateFrame = 0;
+    };
+
+    int size;
+    int minTileSize, maxTileSize;
+    int updatesPerFrame = 4; // at most this many tiles are redrawn each frame
+
+    // counters for the last frame
+    int tilesUpdated = 0;
+    int tilesPending = 0; // tiles that needed an update but were over the budget
+
+    ShadowAtlas(int size, int minTileSize, int maxTileSize)
+        : size(size), minTileSize(minTileSize), maxTileSize(maxTileSize)
+    {
+        Reset();
+    }
+
+    // frees every tile
+    void Reset()
+    {
+        levels = 0;
+        while ((size >> levels) > minTileSize)
+            levels++;
+        freeTiles.assign(levels + 1, std::vector<AtlasTile>());
+        freeTiles[0].push_back({0, 0, size});
+        slots.clear();
+    }
+
+    const Slot* GetSlot(int light) const
+    {
+        if (light < 0 || light >= (int)slots.size() || !slots[light].allocated)
+            return nullptr;
+        return &slots[light];
+    }
+
+    // tile size for a light covering `importance` (0 to 1) of the screen height
+    int TileSizeFor(float importance) const
+    {
+        int tileSize = minTileSize;
+        while (tileSize < maxTileSize && (float)tileSize < importance * (float)maxTileSize)
+            tileSize *= 2;
+        return tileSize;
+    }
+
+    // (re)assigns a tile to the light and records the matrix it should be rendered with.
+    // an importance of 0 releases the tile. returns false if the atlas is full
+    bool Request(int light, float importance, const glm::mat4 &lightSpaceMatrix, unsigned int casterVersion)
+    {
+        if (light >= (int)slots.size())
+            slots.resize(light + 1);
+        Slot &slot = slots[light];
+
+        if (importance <= 0.0f)
+        {
+            release(slot);
+            return false;
+        }
+
+        int wanted = TileSizeFor(importance);
+        if (!slot.allocated || slot.tile.size != wanted)
+        {
+            release(slot);
+            // if the atlas is too fragmented, settle for a smaller tile
+            for (int tileSize = wanted; tileSize >= minTileSize && !slot.allocated; tileSize /= 2)
+                slot.allocated = allocate(levelOf(tileSize), slot.tile);
+            if (!slot.allocated)
+                return false;
+        }
+
+        slot.pendingMatrix = lightSpaceMatrix;
+        if (slot.valid && (slot.matrix != lightSpaceMatrix || slot.casterVersion != casterVersion))
+            slot.valid = false;
+        slot.casterVersion = casterVersion;
+        return true;
+    }
+
+    // frees the tile of a light that is gone, a light added later at the same index starts without one
+    void Release(int light)
+    {
+        if (light >= 0 && light < (int)slots.size())
+            release(slots[light]);
+    }
+
+    // picks the tiles to redraw this frame: invalid tiles, least recently updated first, up to the budget.
+    // the caller renders them and then calls MarkUpdated()
+    std::vector<int> CollectUpdates()
+    {
+        std::vector<int> dirty;
+        for (int i = 0; i < (int)slots.size(); i++)
+            if (slots[i].allocated && !slots[i].valid)
+                dirty.push_back(i);
+
+        // tiles that have never been rendered have lastUpdateFrame = 0, so they go first
+        std::sort(dirty.begin(), dirty.end(), [this](int a, int b) {
+            return slots[a].lastUpdateFrame < slots[b].lastUpdateFrame;
+        });
+
+        tilesPending = 0;
+        if ((int)dirty.size() > updatesPerFrame)
+        {
+            tilesPending = (int)dirty.size() - updatesPerFrame;
+            dirty.resize(updatesPerFrame);
+        }
+        tilesUpdated = (int)dirty.size();
+        return dirty;
+    }
+
+    void MarkUpdated(int light, unsigned int frame)
+    {
+        Slot &slot = slots[light];
+        slot.matrix = slot.pendingMatrix;
+        slot.valid = true;
+        slot.lastUpdateFrame = frame;
+    }
+
+    // pending tiles that still hold old contents keep sampling with the matrix they were rendered with;
+    // tiles that were never rendered have nothing to sample
+    bool HasShadow(int light) const
+    {
+        const Slot* slot = GetSlot(light);
+        return slot && slot->lastUpdateFrame != 0;
+    }
+
+    // uv offset (xy) and scale (zw) of the light's tile
+    glm::vec4 GetUVRect(int light) const
+    {
+        const AtlasTile &tile = slots[light].tile;
+        return glm::vec4((float)tile.x / (float)size, (float)tile.y / (float)size,
+                         (float)tile.size / (float)size, (float)tile.size / (float)size);
+    }
+
+    int AllocatedTexels() const
+    {
+        int texels = 0;
+        for (const Slot &slot : slots)
+            if (slot.allocated)
+                texels += slot.tile.size * slot.tile.size;
+        return texels;
+    }
+
+private:
+    int levels;                                  // level 0 is the whole atlas, level `levels` is minTileSize
+    std::vector<std::vector<AtlasTile>> freeTiles; // free tiles per level
+    std::vector<Slot> slots;
+
+    int levelOf(int tileSize) const
+    {
+        int level = 0;
+        while ((size >> level) > tileSize)
+            level++;
+        return level;
+    }
+
+    bool allocate(int level, AtlasTile &tile)
+    {
+        if (!freeTiles[level].empty())
+        {
+            tile = freeTiles[level].back();
+            freeTiles[level].pop_back();
+            return true;
+        }
+        if (level == 0)
+            return false;
+
+        // split a bigger tile, keep one child and put the other three in the free list
+        AtlasTile parent;
+        if (!allocate(level - 1, parent))
+            return false;
+        int half = parent.size / 2;
+        freeTiles[level].push_back({parent.x + half, parent.y, half});
+        freeTiles[level].push_back({parent.x, parent.y + half, half});
+        freeTiles[level].push_back({parent.x + half, parent.y + half, half});
+        tile = {parent.x, parent.y, half};
+        return true;
+    }
+
+    void free(int level, AtlasTile tile)
+    {
+        if (level > 0)
+        {
+            // merge with the three buddies if they are all free
+            int parentSize = tile.size * 2;
+            int px = tile.x - tile.x % parentSize;
+            int py = tile.y - tile.y % parentSize;
+            std::vector<AtlasTile> &list = freeTiles[level];
+            int buddies[3];
+            int found = 0;
+            for (int i = 0; i < (int)list.size() && found < 3; i++)
+                if (list[i].x >= px && list[i].x < px + parentSize && list[i].y >= py && list[i].y < py + parentSize)
+                    buddies[found++] = i;
+            if (found == 3)
+            {
+                // remove from the back so the indices stay valid
+                for (int i = 2; i >= 0; i--)
+                {
+                    list[buddies[i]] = list.back();
+                    list.pop_back();
+                }
+                free(level - 1, {px, py, parentSize});
+                return;
+            }
+        }
+        freeTiles[level].push_back(tile);
+    }
+
+    void release(Slot &slot)
+    {
+        if (slot.allocated)
+            free(levelOf(slot.tile.size), slot.tile);
+        slot = Slot();
+    }
+};
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef SHADOW_CACHE_H
+#define SHADOW_CACHE_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstring>
+
+// Remembers what was last rendered into a shadow map, so the depth pass can be skipped when
+// nothing that affects it changed, or limited to the texels covered by the casters that moved.
+// It tracks the light space matrix, the caster transforms and the number of casters.
+class ShadowCache
+{
+public:
+    enum Update
+    {
+        UPDATE_NONE,   // cached map is still valid, nothing to draw
+        UPDATE_REGION, // only the texels in dirtyRect need to be cleared and redrawn
+        UPDATE_FULL    // the whole map has to be cleared and redrawn
+    };
+
+    // counters, shown in the GUI
+    unsigned int framesReused = 0;
+    unsigned int framesRegionUpdate = 0;
+    unsigned int framesFullUpdate = 0;
+
+    // x, y, width, height of the area that has to be redrawn, in shadow map texels
+    int dirtyRect[4] = {0, 0, 0, 0};
+
+    // if the dirty region grows above this fraction of the map, a full redraw is cheaper
+    float maxRegionFraction = 0.5f;
+
+    ShadowCache(int width, int height) : width(width), height(height)
+    {
+    }
+
+    // force a full redraw next frame (e.g. the shadow map texture was recreated)
+    void Invalidate()
+    {
+        valid = false;
+    }
+
+    // compares the current state against the cached one and decides how much of the map has to be redrawn.
+    // casterMin/casterMax are the local space bounds shared by all casters (e.g. the leaf quad).
+    Update Check(const glm::mat4 &lightSpaceMatrix, const glm::mat4 *casterTransforms, int casterCount,
+                 const glm::vec3 &casterMin, const glm::vec3 &casterMax)
+    {
+        Update update = UPDATE_NONE;
+
+        if (!valid || lightSpaceMatrix != cachedLightSpaceMatrix)
+        {
+            update = UPDATE_FULL;
+        }
+        else
+        {
+            // accumulate the light space bounds of every caster that moved, appeared or disappeared.
+            // we need both the old and the new position, since the old shadow has to be erased too
+            glm::vec2 ndcMin(1.0f), ndcMax(-1.0f);
+            int maxCount = casterCount > (int)cachedTransforms.size() ? casterCount : (int)cachedTransforms.size();
+            for (int i = 0; i < maxCount; i++)
+            {
+                bool hasNew = i < casterCount;
+                bool hasOld = i < (int)cachedTransforms.size();
+                if (hasNew && hasOld && std::memcmp(&casterTransforms[i], &cachedTransforms[i], sizeof(glm::mat4)) == 0)
+                    continue;
+
+                if (hasOld)
+                    expandBounds(lightSpaceMatrix * cachedTransforms[i], casterMin, casterMax, ndcMin, ndcMax);
+                if (hasNew)
+                    expandBounds(lightSpaceMatrix * casterTransforms[i], casterMin, casterMax, ndcMin, ndcMax);
+            }
+
+            if (ndcMin.x <= ndcMax.x && ndcMin.y <= ndcMax.y)
+            {
+                update = toTexelRect(ndcMin, ndcMax) ? UPDATE_REGION : UPDATE_NONE;
+                if (update == UPDATE_REGION && (float)(dirtyRect[2] * dirtyRect[3]) > maxRegionFraction * (float)(width * height))
+                    update = UPDATE_FULL;
+            }
+        }
+
+        if (update == UPDATE_FULL)
+        {
+            dirtyRect[0] = 0;
+            dirtyRect[1] = 0;
+            dirtyRect[2] = width;
+            dirtyRect[3] = height;
+        }
+
+        // store the state that the map will contain after this frame
+        if (update != UPDATE_NONE)
+        {
+            cachedLightSpaceMatrix = lightSpaceMatrix;
+            cachedTransforms.assign(casterTransforms, casterTransforms + casterCount);
+            valid = true;
+        }
+
+        switch (update)
+        {
+            case UPDATE_NONE: framesReused++; break;
+            case UPDATE_REGION: framesRegionUpdate++; break;
+            case UPDATE_FULL: framesFullUpdate++; break;
+        }
+        return update;
+    }
+
+    void ResetCounters()
+    {
+        framesReused = framesRegionUpdate = framesFullUpdate = 0;
+    }
+
+private:
+    int width, height;
+    bool valid = false;
+    glm::mat4 cachedLightSpaceMatrix;
+    std::vector<glm::mat4> cachedTransforms;
+
+    // grows the 2D NDC bounds with the 8 corners of a box transformed to light clip space
+    static void expandBounds(const glm::mat4 &toLightClip, const glm::vec3 &bmin, const glm::vec3 &bmax,
+                             glm::vec2 &ndcMin, glm::vec2 &ndcMax)
+    {
+        for (int c = 0; c < 8; c++)
+        {
+            glm::vec4 corner((c & 1) ? bmax.x : bmin.x, (c & 2) ? bmax.y : bmin.y, (c & 4) ? bmax.z : bmin.z, 1.0f);
+            glm::vec4 p = toLightClip * corner;
+            glm::vec2 ndc = glm::vec2(p.x, p.y) / p.w;
+            ndcMin = glm::min(ndcMin, ndc);
+            ndcMax = glm::max(ndcMax, ndc);
+        }
+    }
+
+    // converts NDC bounds to a texel rectangle clamped to the map, padded by one texel for filtering.
+    // returns false if the region lies completely outside of the map
+    bool toTexelRect(glm::vec2 ndcMin, glm::vec2 ndcMax)
+    {
+        int x0 = (int)glm::floor((ndcMin.x * 0.5f + 0.5f) * (float)width) - 1;
+        int y0 = (int)glm::floor((ndcMin.y * 0.5f + 0.5f) * (float)height) - 1;
+        int x1 = (int)glm::ceil((ndcMax.x * 0.5f + 0.5f) * (float)width) + 1;
+        int y1 = (int)glm::ceil((ndcMax.y * 0.5f + 0.5f) * (float)height) + 1;
+        x0 = x0 < 0 ? 0 : x0;
+        y0 = y0 < 0 ? 0 : y0;
+        x1 = x1 > width ? width : x1;
+        y1 = y1 > height ? height : y1;
+        if (x1 <= x0 || y1 <= y0)
+            return false;
+
+        dirtyRect[0] = x0;
+        dirtyRect[1] = y0;
+        dirtyRect[2] = x1 - x0;
+        dirtyRect[3] = y1 - y0;
+        return true;
+    }
+};
+
+#endif
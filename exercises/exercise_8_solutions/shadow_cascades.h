@@ -0,0 +1,88 @@
+#ifndef SHADOW_CASCADES_H
+#define SHADOW_CASCADES_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cmath>
+
+// must match MAX_SHADOW_CASCADES in the lighting shaders
+const int MAX_SHADOW_CASCADES = 4;
+
+// Splits the camera frustum into cascades and fits an ortographic light volume to each of them.
+// The split distances follow the practical split scheme (a blend between logarithmic and uniform
+// splits), and each volume is a bounding sphere snapped to shadow map texels, so the shadows do not
+// shimmer when the camera moves or rotates.
+struct ShadowCascades
+{
+    int count = 4;
+    float splitLambda = 0.75f;      // 0 = uniform splits, 1 = logarithmic splits
+    float shadowDistance = 30.0f;   // shadows are only rendered up to this view distance
+    float casterMargin = 10.0f;     // how far behind a cascade (towards the light) casters are still captured
+
+    // results of Update()
+    float splitFar[MAX_SHADOW_CASCADES];             // far view distance of each cascade
+    glm::mat4 lightSpaceMatrices[MAX_SHADOW_CASCADES];
+
+    // fits the cascades to the camera frustum. lightDir points towards the (directional) light
+    void Update(const glm::mat4 &cameraView, float fovy, float aspect, float cameraNear, float cameraFar,
+                const glm::vec3 &lightDir, int resolution)
+    {
+        float farPlane = shadowDistance < cameraFar ? shadowDistance : cameraFar;
+
+        // light orientation is fixed for all cascades, only the volume moves
+        glm::vec3 dir = glm::normalize(lightDir);
+        glm::vec3 up = std::fabs(dir.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), -dir, up);
+        glm::mat4 invCameraView = glm::inverse(cameraView);
+
+        float tanY = std::tan(fovy * 0.5f);
+        float tanX = tanY * aspect;
+
+        float sliceNear = cameraNear;
+        for (int i = 0; i < count; i++)
+        {
+            // practical split scheme
+            float t = (float)(i + 1) / (float)count;
+            float logSplit = cameraNear * std::pow(farPlane / cameraNear, t);
+            float uniformSplit = cameraNear + (farPlane - cameraNear) * t;
+            float sliceFar = splitLambda * logSplit + (1.0f - splitLambda) * uniformSplit;
+            splitFar[i] = sliceFar;
+
+            // corners of the frustum slice, in world space
+            glm::vec3 corners[8];
+            for (int c = 0; c < 8; c++)
+            {
+                float d = (c & 4) ? sliceFar : sliceNear;
+                glm::vec4 viewCorner((c & 1) ? tanX * d : -tanX * d, (c & 2) ? tanY * d : -tanY * d, -d, 1.0f);
+                corners[c] = glm::vec3(invCameraView * viewCorner);
+            }
+
+            // bounding sphere of the slice, its size does not change when the camera rotates
+            glm::vec3 center(0.0f);
+            for (int c = 0; c < 8; c++)
+                center += corners[c];
+            center /= 8.0f;
+            float radius = 0.0f;
+            for (int c = 0; c < 8; c++)
+                radius = glm::max(radius, glm::length(corners[c] - center));
+            radius = std::ceil(radius * 16.0f) / 16.0f;
+
+            // snap the center to whole texels in light space
+            float texelSize = 2.0f * radius / (float)resolution;
+            glm::vec3 centerLS = glm::vec3(lightView * glm::vec4(center, 1.0f));
+            centerLS.x = std::floor(centerLS.x / texelSize) * texelSize;
+            centerLS.y = std::floor(centerLS.y / texelSize) * texelSize;
+
+            // light view space looks towards -z, ortho near and far are distances along the view direction
+            glm::mat4 lightProjection = glm::ortho(centerLS.x - radius, centerLS.x + radius,
+                                                   centerLS.y - radius, centerLS.y + radius,
+                                                   -centerLS.z - radius - casterMargin, -centerLS.z + radius);
+            lightSpaceMatrices[i] = lightProjection * lightView;
+
+            sliceNear = sliceFar;
+        }
+    }
+};
+
+#endif
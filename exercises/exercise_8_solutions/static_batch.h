@@ -0,0 +1,164 @@
+#ifndef STATIC_BATCH_H
+#define STATIC_BATCH_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "model.h"
+#include "scene_graph.h"
+#include "gl_state.h"
+
+#include <vector>
+#include <map>
+
+// Draws the meshes of static models with one glMultiDrawElementsBaseVertex per material.
+// All meshes live in meshArena, so a batch only needs the index count, index offset and base vertex
+// of each of its meshes, which are gathered once in Build().
+// OpenGL 3.3 has neither gl_DrawID nor base instance, so the draw index cannot come from an instanced
+// attribute. Instead every vertex carries the index of its object in a buffer parallel to the arena,
+// and the vertex shader reads the model matrix of that object from a buffer texture.
+// An object is a mesh, placed by the world matrix of its scene graph node.
+class StaticBatcher
+{
+public:
+    // texture unit of the model matrices, must not collide with the material textures
+    static const int TRANSFORM_UNIT = 10;
+
+    // counters, shown in the GUI
+    int meshCount = 0; // draw calls it would take without batching
+    int batchCount = 0;
+
+    // groups the meshes of the models by material. roots[i] is the scene node of models[i], see Model::AddToScene()
+    void Build(const std::vector<Model*> &models, const std::vector<int> &roots, const SceneGraph &graph)
+    {
+        batches.clear();
+        objectNodes.clear();
+        meshCount = 0;
+        if (models.empty())
+        {
+            batchCount = 0;
+            return;
+        }
+        if (objectIndexVBO == 0)
+        {
+            glGenBuffers(1, &objectIndexVBO);
+            glGenBuffers(1, &transformBuffer);
+            glGenTextures(1, &transformTexture);
+        }
+
+        // object index of every vertex of the arena, vertices of meshes outside the batches stay 0
+        std::vector<float> objectIndices(meshArena.VertexCapacity(), 0.0f);
+        std::map<std::vector<unsigned int>, int> batchOfMaterial;
+        for (int m = 0; m < (int)models.size(); m++)
+        {
+            for (int i = 0; i < (int)models[m]->meshes.size(); i++)
+            {
+                Mesh &mesh = models[m]->meshes[i];
+                int object = (int)objectNodes.size();
+                objectNodes.push_back(roots[m] + models[m]->meshNodes[i]);
+                const GeometryArena::Allocation &allocation = meshArena.Get(mesh.arenaHandle);
+                for (int v = 0; v < allocation.vertexCount; v++)
+                    objectIndices[allocation.baseVertex + v] = (float)object;
+
+                // meshes with the same textures can be drawn together
+                std::vector<unsigned int> material;
+                for (const Texture &texture : mesh.textures)
+                    material.push_back(texture.id);
+                std::map<std::vector<unsigned int>, int>::iterator found = batchOfMaterial.find(material);
+                int batchIndex;
+                if (found == batchOfMaterial.end())
+                {
+                    batchIndex = (int)batches.size();
+                    batchOfMaterial[material] = batchIndex;
+                    batches.emplace_back();
+                    batches.back().material = &mesh;
+                }
+                else
+                {
+                    batchIndex = found->second;
+                }
+
+                Batch &batch = batches[batchIndex];
+                batch.counts.push_back(allocation.indexCount);
+                batch.offsets.push_back((void*)(allocation.firstIndex * sizeof(unsigned int)));
+                batch.baseVertices.push_back(allocation.baseVertex);
+                meshCount++;
+            }
+        }
+        batchCount = (int)batches.size();
+
+        // the index attribute is part of the shared arena VAO, but only enabled by Draw(): its buffer has the
+        // vertex capacity of the arena at this Build(), the per-mesh draws of a grown arena would read past its end
+        glState.BindVertexArray(meshArena.VAO());
+        glState.BindBuffer(GL_ARRAY_BUFFER, objectIndexVBO);
+        glBufferData(GL_ARRAY_BUFFER, objectIndices.size() * sizeof(float), &objectIndices[0], GL_STATIC_DRAW);
+        glVertexAttribPointer(9, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)0);
+
+        // model matrices, one RGBA32F texel per column
+        glBindBuffer(GL_TEXTURE_BUFFER, transformBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, objectNodes.size() * sizeof(glm::mat4), NULL, GL_DYNAMIC_DRAW);
+        glState.BindTexture(TRANSFORM_UNIT, GL_TEXTURE_BUFFER, transformTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, transformBuffer);
+        UpdateTransforms(graph);
+
+        arenaLayout = meshArena.grows + meshArena.compactions;
+    }
+
+    // uploads the world matrices of the objects again, after the scene graph moved some of them
+    void UpdateTransforms(const SceneGraph &graph)
+    {
+        if (objectNodes.empty())
+            return;
+        transforms.resize(objectNodes.size());
+        for (int object = 0; object < (int)objectNodes.size(); object++)
+            transforms[object] = graph.World(objectNodes[object]);
+        glBindBuffer(GL_TEXTURE_BUFFER, transformBuffer);
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, transforms.size() * sizeof(glm::mat4), &transforms[0]);
+    }
+
+    // the offsets are stale once the arena moved its contents
+    bool NeedsRebuild() const
+    {
+        return arenaLayout != meshArena.grows + meshArena.compactions;
+    }
+
+    // one draw call per material
+    void Draw(Shader* shader)
+    {
+        if (batches.empty())
+            return;
+        shader->use();
+        shader->setBool("useObjectTransforms", true);
+        shader->setInt("objectTransforms", TRANSFORM_UNIT);
+        glState.BindTexture(TRANSFORM_UNIT, GL_TEXTURE_BUFFER, transformTexture);
+        glState.BindVertexArray(meshArena.VAO());
+        glEnableVertexAttribArray(9);
+        for (Batch &batch : batches)
+        {
+            batch.material->BindTextures(*shader);
+            glMultiDrawElementsBaseVertex(GL_TRIANGLES, &batch.counts[0], GL_UNSIGNED_INT, &batch.offsets[0],
+                                          (GLsizei)batch.counts.size(), &batch.baseVertices[0]);
+        }
+        glDisableVertexAttribArray(9);
+        shader->setBool("useObjectTransforms", false);
+    }
+
+private:
+    struct Batch
+    {
+        Mesh* material; // first mesh of the batch, its textures are bound for the whole batch
+        std::vector<GLsizei> counts;
+        std::vector<void*> offsets;
+        std::vector<GLint> baseVertices;
+    };
+
+    std::vector<Batch> batches;
+    std::vector<int> objectNodes; // scene node of every object
+    std::vector<glm::mat4> transforms;
+    GLuint objectIndexVBO = 0;
+    GLuint transformBuffer = 0, transformTexture = 0;
+    unsigned int arenaLayout = 0;
+};
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+
+#include <glad/glad.h>
+
+#include <chrono>
+#include <cstring>
+
+// Ring allocator for data that is written every frame (instance transforms, light data, uniform blocks).
+// One buffer is split in `sections` equal parts, and each frame writes into the next part.
+// The ranges are mapped unsynchronized, so the driver never waits for the GPU to finish reading
+// the old contents; instead a fence is placed at the end of each frame, and the CPU only waits on it
+// when it comes back to that section, `sections` frames later (normally long after the GPU is done).
+class StreamBuffer
+{
+public:
+    // counters for the last finished frame, shown in the GUI
+    size_t bytesStreamed = 0;
+    int allocations = 0;
+    int overflows = 0;       // allocations that did not fit in the section
+    unsigned int waits = 0;  // frames where the CPU had to wait for the GPU, since the start
+    double waitMilliseconds = 0.0;
+
+    StreamBuffer(GLsizeiptr sectionSize, int sections = 3)
+        : sectionSize(sectionSize), sections(sections)
+    {
+    }
+
+    GLuint Buffer() const
+    {
+        return buffer;
+    }
+
+    GLsizeiptr SectionSize() const
+    {
+        return sectionSize;
+    }
+
+    // offset alignment required to bind a range as a uniform block
+    static GLint UniformAlignment()
+    {
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        return alignment;
+    }
+
+    // moves to the next section, waiting for the GPU if it is still reading it
+    void BeginFrame()
+    {
+        if (buffer == 0)
+            create();
+
+        bytesStreamed = currentBytes;
+        allocations = currentAllocations;
+        overflows = currentOverflows;
+        currentBytes = 0;
+        currentAllocations = 0;
+        currentOverflows = 0;
+
+        section = (section + 1) % sections;
+        offset = 0;
+        if (fences[section] != 0)
+        {
+            // check without waiting first, so the common case costs no flush
+            GLenum result = glClientWaitSync(fences[section], 0, 0);
+            if (result == GL_TIMEOUT_EXPIRED)
+            {
+                std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+                while (result == GL_TIMEOUT_EXPIRED)
+                    result = glClientWaitSync(fences[section], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); // 1 ms
+                std::chrono::duration<double, std::milli> waited = std::chrono::high_resolution_clock::now() - start;
+                waits++;
+                waitMilliseconds += waited.count();
+            }
+            glDeleteSync(fences[section]);
+            fences[section] = 0;
+        }
+    }
+
+    // fences the section written this frame, call after the last draw that reads it
+    void EndFrame()
+    {
+        if (buffer == 0)
+            return;
+        fences[section] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    // copies the data into the current section and returns its offset in Buffer(), or -1 if it does not fit.
+    // alignment must be a power of two
+    GLintptr Upload(const void* data, GLsizeiptr size, GLintptr alignment = 16)
+    {
+        GLintptr aligned = (offset + alignment - 1) & ~(alignment - 1);
+        if (aligned + size > sectionSize)
+        {
+            currentOverflows++;
+            return -1;
+        }
+        GLintptr bufferOffset = section * sectionSize + aligned;
+
+        // the fence of this section has passed, nothing reads this range anymore
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        void* ptr = glMapBufferRange(GL_COPY_WRITE_BUFFER, bufferOffset, size,
+                                     GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+        if (!ptr)
+            return -1;
+        std::memcpy(ptr, data, size);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+
+        offset = aligned + size;
+        currentBytes += size;
+        currentAllocations++;
+        return bufferOffset;
+    }
+
+private:
+    static const int MAX_SECTIONS = 4;
+
+    GLsizeiptr sectionSize;
+    int sections;
+    GLuint buffer = 0;
+    GLsync fences[MAX_SECTIONS] = {};
+    int section = 0;
+    GLintptr offset = 0;
+    size_t currentBytes = 0;
+    int currentAllocations = 0;
+    int currentOverflows = 0;
+
+    void create()
+    {
+        if (sections > MAX_SECTIONS)
+            sections = MAX_SECTIONS;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, sectionSize * sections, NULL, GL_STREAM_DRAW);
+    }
+};
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef TRANSLUCENCY_H
+#define TRANSLUCENCY_H
+
+#include <glad/glad.h>
+
+#include "gl_state.h"
+
+#include <iostream>
+
+// Target of the reduced resolution translucency pass: the leaves are drawn once at a half or a quarter of
+// the resolution, and the light that comes through them from behind (Beer's law transmittance of the
+// translucency texture, back-lit radiance of every light) is summed without the albedo. The leaf shader
+// of the full resolution passes reads it back with a joint bilateral upsampling and multiplies it by its
+// own albedo, so the texture detail stays sharp while the low frequency part is shaded 4 or 16 times less.
+// Two color targets:
+//   0 RGBA16F  back-lit light (rgb) and transmittance (a)
+//   1 RGBA16F  face normal (xyz) and distance to the camera (w, 0 where no leaf was drawn), the guide of the upsampling
+// The target is allocated for the output size, a scaled frame (see DynamicResolution) uses its lower left part.
+class TranslucencyTarget
+{
+public:
+    // the resolution is divided by this on each axis, 1 shades the translucency at full rate in the color passes
+    int divisor = 2;
+    // distance difference, relative to the distance to the camera, that halves the weight of a reduced pixel
+    float depthTolerance = 0.05f;
+
+    bool Reduced() const { return divisor > 1; }
+
+    // the target for output at the current divisor, call when either may have changed
+    void Resize(int width, int height)
+    {
+        int reducedWidth = ReducedSize(width), reducedHeight = ReducedSize(height);
+        if (framebuffer != 0 && allocatedWidth == reducedWidth && allocatedHeight == reducedHeight)
+            return;
+        release();
+        allocatedWidth = reducedWidth;
+        allocatedHeight = reducedHeight;
+
+        // the upsampling reads single texels, no filtering
+        glGenTextures(2, textures);
+        for (GLuint texture : textures)
+        {
+            glState.BindTexture(0, GL_TEXTURE_2D, texture);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, reducedWidth, reducedHeight, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+
+        glGenFramebuffers(1, &framebuffer);
+        glState.BindFramebuffer(framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[0], 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, textures[1], 0);
+        GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(2, drawBuffers);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::TRANSLUCENCY:: the reduced framebuffer is not complete" << std::endl;
+    }
+
+    GLuint Framebuffer() const { return framebuffer; }
+    GLuint LightTexture() const { return textures[0]; }
+    GLuint GuideTexture() const { return textures[1]; }
+
+    // reduced pixels covering size full resolution pixels
+    int ReducedSize(int size) const { return (size + divisor - 1) / divisor; }
+
+private:
+    int allocatedWidth = 0, allocatedHeight = 0;
+    GLuint framebuffer = 0;
+    GLuint textures[2] = {};
+
+    void release()
+    {
+        if (framebuffer == 0)
+            return;
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteTextures(2, textures);
+        framebuffer = 0;
+        // the deleted objects were bound, the next names may be the same
+        glState.Invalidate();
+    }
+};
+
+#endif